@@ -28,20 +28,32 @@
 #include <ctype.h>      // isprint
 #include <getopt.h>     // no_argument, getopt_long, required_argument, option
 #include <incbot.h>     // read_id_table_file, incbot_src_file,
-                        // read_config_file, show_includes, trace_identifier
+                        // read_config_file, show_includes, trace_identifier,
+                        // write_id_table_image, read_id_table_builtin,
+                        // incbot_tables_freeze, incbot_tables_release,
+                        // set_id_filter_bits, set_id_filter_counting,
+                        // get_id_filter_stats, id_filter_stats_t,
+                        // set_incbot_lexer, LEXER_STANDARD, LEXER_FUSED,
+                        // get_table_dict_stats
 #include <stdbool.h>    // true, bool, false
 #include <stddef.h>     // size_t, NULL
 #include <stdio.h>      // fputs, fputc, FILE, snprintf, stdout
-#include <stdlib.h>     // exit, realpath
-#include <string.h>     // strlen, memcpy, strcmp
-#include <unistd.h>     // access, R_OK
+#include <stdlib.h>     // exit, strtoul, getenv
+#include <string.h>     // strcmp, strncmp
+#include <cf.h>         // cf_scan_set_impl, cf_scan_impl_by_name,
+                        // cf_scan_set_verify, cf_scan_get_verify_stats,
+                        // cf_scan_get_impl, cf_scan_impl_name,
+                        // cf_scan_verify_stats_t
+#include <dict.h>       // dict_set_verify, dict_get_verify_stats,
+                        // DICT_VERIFY_*, dict_set_backend,
+                        // dict_backend_by_name, dict_set_count_lookups,
+                        // dict_stats_t, DICT_STATS_NHIST
 #include "cscript.h"    // eprintf, filev_probe, eprint, fshow_str_array,
-                        // guard_malloc, set_debug_fh, set_eprint_fh, sname
+                        // set_debug_fh, set_eprint_fh, sname
 // IWYU::END
 
 const char *program_path;
 const char *program_name;
-char *program_realpath;
 
 size_t filec;               // Count of elements in filev
 char **filev;               // Non-option elements of argv
@@ -52,10 +64,6 @@ bool debug   = false;
 FILE *errprint_fh = NULL;
 FILE *dbgprint_fh = NULL;
 
-static const char *default_id_table
-    = "/home/shaw/v/psdk/dist/share/lib/incbot/id-table";
-//  = "/usr/local/           /share/lib/incbot/id-table";
-
 static struct option long_options[] = {
     {"help",           no_argument,       0,  'h'},
     {"version",        no_argument,       0,  'V'},
@@ -64,6 +72,16 @@ static struct option long_options[] = {
     {"conf",           required_argument, 0,  'c'},
     {"id-table",       required_argument, 0,  't'},
     {"trace",          required_argument, 0,  'T'},
+    {"compile-table",  required_argument, 0,  'C'},
+    {"no-builtin-table", no_argument,     0,  'N'},
+    {"dict-verify",    required_argument, 0,  'D'},
+    {"dict-backend",   required_argument, 0,  'B'},
+    {"dict-stats",     no_argument,       0,  'K'},
+    {"id-filter-bits", required_argument, 0,  'F'},
+    {"id-filter-stats", no_argument,      0,  'S'},
+    {"lexer",          required_argument, 0,  'L'},
+    {"scan-impl",      required_argument, 0,  'I'},
+    {"scan-verify",    no_argument,       0,  'Y'},
     {0, 0, 0, 0}
 };
 
@@ -76,8 +94,47 @@ static const char usage_text[] =
     "  --conf      <fname>  configuration file\n"
     "  --id-table  <fname>  load file containing descriptions of identifiers\n"
     "                       There can be any number of id-table files.\n"
+    "                       They are layered on top of the built-in id-table,\n"
+    "                       in order.  A later description of an identifier\n"
+    "                       replaces an earlier one.\n"
+    "  --no-builtin-table   Do not load the built-in id-table\n"
+    "  --dict-verify=<mode> Cross-check dictionary lookups against\n"
+    "                       a linear search, and report the results.\n"
+    "                       <mode> is off, full, or sampled[:N],\n"
+    "                       which checks 1 in N lookups (default 64).\n"
+    "  --dict-backend=<kind> Kind of index for dictionaries: chained\n"
+    "                       (the default), swiss, sorted, trie, or linear.\n"
+    "                       The default comes from $INCBOT_DICT_BACKEND,\n"
+    "                       if it is set.  Only chained lookups go through\n"
+    "                       a perfect hash index, once tables are loaded.\n"
+    "  --dict-stats         Report memory use, hash table shape, and\n"
+    "                       probes and string compares per lookup,\n"
+    "                       of the identifier and string dictionaries.\n"
+    "  --id-filter-bits=<n> Size of the filter in front of identifier\n"
+    "                       lookup, in bits per identifier (default 10).\n"
+    "                       0 means no filter.\n"
+    "  --id-filter-stats    Report how well the identifier filter did.\n"
+    "  --lexer=<kind>       Scanner for source files, standard (the default)\n"
+    "                       or fused, which reads each file whole, and\n"
+    "                       matches identifiers against a trie of the\n"
+    "                       id-table as it goes.\n"
+    "  --scan-impl=<kind>   How the standard scanner finds comments and\n"
+    "                       literals: auto (the default, the best this\n"
+    "                       CPU can run), scalar, sse2, avx2, or table,\n"
+    "                       which runs the transition table over every\n"
+    "                       byte.\n"
+    "  --scan-verify        Cross-check the scanner, byte by byte, against\n"
+    "                       the hand-written, one-character-at-a-time\n"
+    "                       libcf state machine, and report the results.\n"
+    "                       The fused lexer has no such scanner, so this\n"
+    "                       cannot be used with --lexer=fused.\n"
     "  --trace=<symbol>     Trace usage of the given symbol\n"
     "                       There can be any number of --trace=symbol\n"
+    "  --compile-table <in> <out>\n"
+    "                       Compile id-table <in>, layered on top of any\n"
+    "                       --id-table files, into a binary image, <out>,\n"
+    "                       and exit.  The built-in id-table is not included.\n"
+    "                       An image can be given anywhere an id-table can.\n"
     ;
 
 static const char version_text[] =
@@ -162,6 +219,300 @@ incbot_all_files(size_t filec, char **filev)
 }
 
 
+// ========== Section: dictionary verification ==========
+
+static int dict_verify_mode = DICT_VERIFY_OFF;
+
+static int
+set_dict_verify(const char *mode)
+{
+    size_t rate = 64;
+
+    if (strcmp(mode, "off") == 0) {
+        dict_verify_mode = DICT_VERIFY_OFF;
+    }
+    else if (strcmp(mode, "full") == 0) {
+        dict_verify_mode = DICT_VERIFY_FULL;
+    }
+    else if (strncmp(mode, "sampled", 7) == 0
+             && (mode[7] == '\0' || mode[7] == ':')) {
+        if (mode[7] == ':') {
+            char *end;
+
+            rate = strtoul(mode + 8, &end, 10);
+            if (*end != '\0' || rate == 0) {
+                return (-1);
+            }
+        }
+        dict_verify_mode = DICT_VERIFY_SAMPLED;
+    }
+    else {
+        return (-1);
+    }
+
+    dict_set_verify(dict_verify_mode, rate);
+    return (0);
+}
+
+/*
+ * Report on dictionary verification, if it was on.
+ * Return the number of mismatches.
+ */
+static size_t
+show_dict_verify_stats(void)
+{
+    dict_verify_stats_t stats;
+
+    if (dict_verify_mode == DICT_VERIFY_OFF) {
+        return (0);
+    }
+
+    dict_get_verify_stats(&stats);
+    eprintf("dict-verify: %zu lookups, %zu checked, %zu mismatched\n",
+        stats.nlookup, stats.ncheck, stats.nmismatch);
+    return (stats.nmismatch);
+}
+
+static int
+set_dict_backend(const char *kind)
+{
+    int backend = dict_backend_by_name(kind);
+
+    if (backend < 0) {
+        return (-1);
+    }
+    dict_set_backend(backend);
+    return (0);
+}
+
+static bool fused_lexer = false;
+
+static int
+set_lexer(const char *kind)
+{
+    if (strcmp(kind, "standard") == 0) {
+        set_incbot_lexer(LEXER_STANDARD);
+        fused_lexer = false;
+    }
+    else if (strcmp(kind, "fused") == 0) {
+        set_incbot_lexer(LEXER_FUSED);
+        fused_lexer = true;
+    }
+    else {
+        return (-1);
+    }
+    return (0);
+}
+
+// ========== Section: scanner verification ==========
+
+static bool scan_verify = false;
+
+static int
+set_scan_impl(const char *kind)
+{
+    int impl = cf_scan_impl_by_name(kind);
+
+    if (impl < 0) {
+        return (-1);
+    }
+    return (cf_scan_set_impl(impl));
+}
+
+/*
+ * Report on scanner verification, if it was on.
+ * Return the number of mismatches.
+ */
+static size_t
+show_scan_verify_stats(void)
+{
+    cf_scan_verify_stats_t stats;
+
+    if (!scan_verify) {
+        return (0);
+    }
+
+    cf_scan_get_verify_stats(&stats);
+    eprintf("scan-verify: %s, %zu bytes checked, %zu mismatched\n",
+        cf_scan_impl_name(cf_scan_get_impl()), stats.nbyte, stats.nmismatch);
+    return (stats.nmismatch);
+}
+
+// ========== Section: dictionary statistics ==========
+
+static bool show_dict_stats_flag = false;
+
+static size_t
+hist_total(const size_t *hist)
+{
+    size_t total = 0;
+    size_t i;
+
+    for (i = 0; i < DICT_STATS_NHIST; ++i) {
+        total += hist[i];
+    }
+    return (total);
+}
+
+static void
+show_hist(const char *name, const char *what, const size_t *hist)
+{
+    char buf[32 * DICT_STATS_NHIST];
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < DICT_STATS_NHIST; ++i) {
+        pos += snprintf(buf + pos, sizeof (buf) - pos, " %zu%s:%zu",
+            i, i == DICT_STATS_NHIST - 1 ? "+" : "", hist[i]);
+    }
+    eprintf("dict-stats: %s: %s:%s\n", name, what, buf);
+}
+
+static void
+show_lookup_stats(const char *name, const char *what, size_t n,
+    size_t probes, size_t max_probes, size_t strcmps)
+{
+    eprintf("dict-stats: %s: %zu %s, %.2f probes avg, %zu max,"
+        " %.2f string compares avg\n",
+        name, n, what,
+        n == 0 ? 0.0 : (double)probes / n, max_probes,
+        n == 0 ? 0.0 : (double)strcmps / n);
+}
+
+static void
+show_one_dict_stats(const char *name, const dict_stats_t *st)
+{
+    eprintf("dict-stats: %s: %s, lookups by %s, %zu symbols%s%s\n",
+        name, st->backend, st->lookup_index, st->nsym,
+        st->frozen ? ", frozen" : "", st->mapped ? ", mapped" : "");
+    eprintf("dict-stats: %s: bytes: sv %zu, strings %zu (%zu used),"
+        " index %zu (tbl %zu, ovfl %zu), phash %zu\n",
+        name, st->sv_bytes, st->strs_bytes, st->strs_used,
+        st->index_bytes, st->tbl_bytes, st->ovfl_bytes, st->phash_bytes);
+    if (st->nbkt != 0) {
+        eprintf("dict-stats: %s: %zu buckets, load factor %.2f\n",
+            name, st->nbkt, st->load_factor);
+    }
+    if (hist_total(st->bkt_hist) != 0) {
+        show_hist(name, "buckets by symbols", st->bkt_hist);
+        show_hist(name, "buckets by overflow chain", st->chain_hist);
+        eprintf("dict-stats: %s: longest overflow chain %zu\n",
+            name, st->max_chain);
+    }
+    if (st->counted) {
+        const dict_lookup_stats_t *lk = &st->lookups;
+
+        show_lookup_stats(name, "hits", lk->nhit, lk->hit_probes,
+            lk->hit_max_probes, lk->hit_strcmps);
+        show_lookup_stats(name, "misses", lk->nmiss, lk->miss_probes,
+            lk->miss_max_probes, lk->miss_strcmps);
+    }
+}
+
+static void
+show_dict_stats(void)
+{
+    dict_stats_t id_stats;
+    dict_stats_t str_stats;
+
+    if (!show_dict_stats_flag) {
+        return;
+    }
+
+    get_table_dict_stats(&id_stats, &str_stats);
+    show_one_dict_stats("id", &id_stats);
+    show_one_dict_stats("str", &str_stats);
+}
+
+// ========== Section: identifier filter ==========
+
+static bool show_filter_stats = false;
+
+static int
+set_id_filter(const char *bits)
+{
+    unsigned long bpk;
+    char *end;
+
+    bpk = strtoul(bits, &end, 10);
+    if (*bits == '\0' || *end != '\0' || bpk > 64) {
+        return (-1);
+    }
+    set_id_filter_bits((unsigned int)bpk);
+    return (0);
+}
+
+static void
+show_id_filter_stats(void)
+{
+    id_filter_stats_t stats;
+    size_t nabsent;
+
+    if (!show_filter_stats) {
+        return;
+    }
+
+    get_id_filter_stats(&stats);
+    if (stats.nkey == 0) {
+        eprintf("id-filter: off\n");
+        return;
+    }
+
+    nabsent = stats.nreject + stats.nfalse_pos;
+    eprintf("id-filter: %zu identifiers, %zu bytes, %u bits/id, k=%u,"
+        " expected FPR %.3f%%\n",
+        stats.nkey, stats.nbytes, stats.bits_per_key, stats.k,
+        100.0 * stats.expected_fpr);
+    eprintf("id-filter: %zu lookups, %zu hits, %zu misses,"
+        " %zu rejected, %zu false positives, observed FPR %.3f%%\n",
+        stats.nlookup, stats.nlookup - nabsent, nabsent,
+        stats.nreject, stats.nfalse_pos,
+        nabsent == 0 ? 0.0 : 100.0 * stats.nfalse_pos / nabsent);
+}
+
+// ========== Section: manage id-tables ==========
+
+static const char *tblv[64];
+static size_t ntbl;
+
+static void
+add_id_table(const char *fname)
+{
+    if (ntbl >= sizeof (tblv) / sizeof (tblv[0])) {
+        eprintf("%s: Too many id-tables.\n", program_name);
+        exit(2);
+    }
+    tblv[ntbl] = fname;
+    ++ntbl;
+}
+
+static void
+read_all_id_tables(void)
+{
+    size_t tblnr;
+
+    //  Here, it matters only that a table was mentioned,
+    //  not whether it was read without errors.
+    //
+    for (tblnr = 0; tblnr < ntbl; ++tblnr) {
+        (void) read_id_table_file(tblv[tblnr]);
+    }
+}
+
+static int
+compile_id_table(const char *in_fname, const char *out_fname)
+{
+    int rv;
+
+    read_all_id_tables();
+    rv = read_id_table_file(in_fname);
+    if (rv != 0) {
+        return (rv);
+    }
+    return (write_id_table_image(out_fname));
+}
+
+
 // ========== Section: manage tracing of selected identifiers ==========
 
 static const char *trcv[64];
@@ -196,9 +547,13 @@ main(int argc, char **argv)
     int err_count;
     int optc;
     int rv;
-    bool have_id_table = false;
+    bool use_builtin_table = true;
+    const char *compile_in = NULL;
+    const char *compile_out = NULL;
+    const char *dict_backend_env;
 
     ntrace = 0;
+    ntbl = 0;
     set_eprint_fh();
     program_path = *argv;
     program_name = sname(program_path);
@@ -206,6 +561,14 @@ main(int argc, char **argv)
     err_count = 0;
     opterr = 0;
 
+    dict_backend_env = getenv("INCBOT_DICT_BACKEND");
+    if (dict_backend_env != NULL && *dict_backend_env != '\0'
+        && set_dict_backend(dict_backend_env) != 0) {
+        eprintf("%s: unknown INCBOT_DICT_BACKEND, '%s'\n",
+            program_name, dict_backend_env);
+        ++err_count;
+    }
+
     while (true) {
         int this_option_optind;
 
@@ -216,7 +579,7 @@ main(int argc, char **argv)
 
         this_option_optind = optind ? optind : 1;
 
-        optc = getopt_long(argc, argv, "+hVdvc:t:T:", long_options, &option_index);
+        optc = getopt_long(argc, argv, "+hVdvc:t:T:C:ND:B:KF:SL:I:Y", long_options, &option_index);
         if (optc == -1) {
             break;
         }
@@ -246,14 +609,71 @@ main(int argc, char **argv)
             rv = read_config_file(optarg);
             break;
         case 't':
-            rv = read_id_table_file(optarg);
-            //  Here, it matters only that a table was mentioned,
-            //  not whether it was read without errors.
-            have_id_table = true;
+            add_id_table(optarg);
+            break;
+        case 'N':
+            use_builtin_table = false;
+            break;
+        case 'D':
+            if (set_dict_verify(optarg) != 0) {
+                eprintf("%s: unknown --dict-verify mode, '%s'\n",
+                    program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'B':
+            if (set_dict_backend(optarg) != 0) {
+                eprintf("%s: unknown --dict-backend, '%s'\n",
+                    program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'K':
+            show_dict_stats_flag = true;
+            dict_set_count_lookups(true);
+            break;
+        case 'F':
+            if (set_id_filter(optarg) != 0) {
+                eprintf("%s: bad --id-filter-bits, '%s'\n",
+                    program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'S':
+            show_filter_stats = true;
+            set_id_filter_counting(true);
+            break;
+        case 'L':
+            if (set_lexer(optarg) != 0) {
+                eprintf("%s: unknown --lexer, '%s'\n",
+                    program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'I':
+            if (set_scan_impl(optarg) != 0) {
+                eprintf("%s: unknown or unsupported --scan-impl, '%s'\n",
+                    program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'Y':
+            scan_verify = true;
+            cf_scan_set_verify(true);
             break;
         case 'T':
             add_trace_identifiers(optarg);
             break;
+        case 'C':
+            if (optind >= argc) {
+                eprintf("%s: --compile-table requires <in> and <out>.\n",
+                    program_name);
+                exit(1);
+            }
+            compile_in  = optarg;
+            compile_out = argv[optind];
+            ++optind;
+            break;
         case '?':
             eprint(program_name);
             eprint(": ");
@@ -278,6 +698,13 @@ main(int argc, char **argv)
 
     verbose = verbose || debug;
 
+    // Nothing would be checked, and "0 mismatched" would read as a pass.
+    if (scan_verify && fused_lexer) {
+        eprintf("%s: --scan-verify cannot be used with --lexer=fused.\n",
+            program_name);
+        ++err_count;
+    }
+
     if (argc != 0) {
         filec = (size_t) (argc - optind);
         filev = argv + optind;
@@ -304,47 +731,25 @@ main(int argc, char **argv)
         exit(1);
     }
 
-    if (!have_id_table) {
-        rv = access(default_id_table, R_OK);
-        if (rv == 0) {
-            rv = read_id_table_file(default_id_table);
-            if (rv != 0) {
-                exit(rv);
-            }
-            have_id_table = true;
-        }
+    if (compile_in != NULL) {
+        exit(compile_id_table(compile_in, compile_out));
     }
 
-    if (!have_id_table) {
-        program_realpath = realpath(program_path, NULL);
-        const char *cmd_sfx = "/src/cmd/incbot";
-        const char *tbl_sfx = "/src/table/id-table";
-        size_t len = strlen(program_realpath);
-        size_t off = len - strlen(cmd_sfx);
-
-        // fprintf(stderr, "program_realpath = [%s]\n", program_realpath);
-        // fprintf(stderr, "  + off=%zu = [%s]\n", off, program_realpath + off);
-
-        if (strcmp(program_realpath + off, cmd_sfx) == 0) {
-            char *tbl_path = guard_malloc(off + strlen(tbl_sfx) + 1);
-            memcpy(tbl_path, program_realpath, off);
-            memcpy(tbl_path + off, tbl_sfx, strlen(tbl_sfx) + 1);
-            // fprintf(stderr, "tbl_path=[%s]\n", tbl_path);
-            rv = access(tbl_path, R_OK);
-            if (rv == 0) {
-                rv = read_id_table_file(tbl_path);
-                if (rv != 0) {
-                    exit(rv);
-                }
-                have_id_table = true;
-            }
+    if (use_builtin_table) {
+        rv = read_id_table_builtin();
+        if (rv != 0) {
+            exit(rv);
         }
     }
-
-    if (!have_id_table) {
-        eprintf("Could not find identifier table.\n");
+    else if (ntbl == 0) {
+        eprintf("No identifier table.\n");
         exit(2);
     }
+    read_all_id_tables();
+    rv = incbot_tables_freeze();
+    if (rv != 0) {
+        exit(rv);
+    }
 
     mark_all_traced_identifiers();
     if (filec == 0) {
@@ -360,6 +765,16 @@ main(int argc, char **argv)
         rv = incbot_all_files(filec, filev);
     }
 
+    show_id_filter_stats();
+    show_dict_stats();
+    if (show_dict_verify_stats() != 0 && rv == 0) {
+        rv = 2;
+    }
+    if (show_scan_verify_stats() != 0 && rv == 0) {
+        rv = 2;
+    }
+    incbot_tables_release();
+
     if (rv != 0) {
         exit(rv);
     }
@@ -0,0 +1,195 @@
+/*
+ * Filename: src/cmd/test/ccv-test.c
+ * Project: incbot
+ * Brief: Test of the ring buffer of super-characters, 'ccv_t'
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * incbot never pushes back more than one byte, so a ccv_t
+ * in actual use never has to grow.  This test makes one grow,
+ * from both ends, while the front of the ring is anywhere
+ * in the array, and checks every operation against a plain
+ * array that holds the same super-characters.
+ *
+ * Exit status is 0 if all is well, 1 otherwise.
+ */
+
+#include <stdbool.h>    // bool, false, true
+#include <stddef.h>     // size_t, NULL
+#include <stdio.h>      // FILE, fprintf, printf, stderr
+#include <stdlib.h>     // exit, rand, srand
+#include <cf.h>         // ccv_t, ccv_new, ccv_push, ccv_pop, ccv_top,
+                        // ccv_push_front, ccv_pop_front, ccv_at,
+                        // ccv_empty, ccv_clear, ccv_delete
+
+#define NOPS    200000
+#define NFRONT  1000
+
+char *program_name = "ccv-test";
+FILE *errprint_fh = NULL;
+FILE *dbgprint_fh = NULL;
+bool verbose = false;
+bool debug   = false;
+
+// The model: model[mhead .. mhead + mlen), with room to grow
+// NOPS entries in either direction.
+//
+static int model[2 * NOPS + 1];
+static size_t mhead;
+static size_t mlen;
+
+static size_t nerr;
+
+static void
+check(ccv_t *ccv, const char *what)
+{
+    size_t i;
+
+    if (ccv->len != mlen || ccv_empty(ccv) != (mlen == 0)) {
+        fprintf(stderr, "%s: len is %zu; expected %zu.\n",
+            what, ccv->len, mlen);
+        ++nerr;
+        return;
+    }
+    for (i = 0; i < mlen; ++i) {
+        if (ccv_at(ccv, i)->chr != model[mhead + i]
+            || ccv_at(ccv, i)->ccl != model[mhead + i] % 7) {
+            fprintf(stderr, "%s: entry %zu of %zu is %d; expected %d.\n",
+                what, i, mlen, ccv_at(ccv, i)->chr, model[mhead + i]);
+            ++nerr;
+            return;
+        }
+    }
+}
+
+static void
+push(ccv_t *ccv, int chr)
+{
+    ccv_push(ccv, chr, chr % 7);
+    model[mhead + mlen++] = chr;
+}
+
+static void
+push_front(ccv_t *ccv, int chr)
+{
+    ccv_push_front(ccv, chr, chr % 7);
+    model[--mhead] = chr;
+    ++mlen;
+}
+
+static void
+pop(ccv_t *ccv, bool front)
+{
+    int chr;
+    int ccl;
+    int rv;
+    int expect;
+
+    rv = front ? ccv_pop_front(ccv, &chr, &ccl) : ccv_pop(ccv, &chr, &ccl);
+    if (mlen == 0) {
+        if (rv == 0) {
+            fprintf(stderr, "pop of empty ccv_t succeeded.\n");
+            ++nerr;
+        }
+        return;
+    }
+    if (front) {
+        expect = model[mhead++];
+    }
+    else {
+        expect = model[mhead + mlen - 1];
+    }
+    --mlen;
+    if (rv != 0 || chr != expect || ccl != expect % 7) {
+        fprintf(stderr, "pop%s: got %d; expected %d.\n",
+            front ? "_front" : "", chr, expect);
+        ++nerr;
+    }
+}
+
+int
+main(void)
+{
+    ccv_t *ccv;
+    size_t sz0;
+    size_t op;
+    int chr;
+    int ccl;
+
+    errprint_fh = stderr;
+    dbgprint_fh = stderr;
+    ccv = ccv_new();
+    sz0 = ccv->sz;
+    mhead = NOPS;
+    mlen = 0;
+
+    // Pushback, as deep as it goes: the front wraps around
+    // to the end of the array before every doubling.
+    //
+    for (op = 0; op < NFRONT; ++op) {
+        push_front(ccv, (int)op);
+    }
+    check(ccv, "after push_front");
+    if (ccv_top(ccv, &chr, &ccl) != 0 || chr != 0) {
+        fprintf(stderr, "ccv_top() is %d; expected 0.\n", chr);
+        ++nerr;
+    }
+    while (mlen != 0) {
+        pop(ccv, true);
+    }
+    check(ccv, "after pop_front");
+
+    // Then anything, mostly growing, with the front anywhere.
+    //
+    srand(1);
+    for (op = 0; op < NOPS - NFRONT; ++op) {
+        int r = rand() % 10;
+
+        if (r < 3) {
+            push(ccv, rand() & 0xff);
+        }
+        else if (r < 6) {
+            push_front(ccv, rand() & 0xff);
+        }
+        else if (r < 8) {
+            pop(ccv, true);
+        }
+        else {
+            pop(ccv, false);
+        }
+        if (op % 1000 == 0) {
+            check(ccv, "random");
+        }
+    }
+    check(ccv, "random");
+
+    ccv_clear(ccv);
+    mhead = NOPS;
+    mlen = 0;
+    push_front(ccv, 'a');
+    push(ccv, 'b');
+    check(ccv, "after ccv_clear");
+
+    printf("ccv: grew from %zu to %zu, %zu errors.\n", sz0, ccv->sz, nerr);
+    if (ccv->sz <= sz0) {
+        ++nerr;
+    }
+    ccv_delete(ccv);
+    exit(nerr == 0 ? 0 : 1);
+}
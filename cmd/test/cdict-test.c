@@ -0,0 +1,271 @@
+/*
+ * Filename: src/cmd/test/cdict-test.c
+ * Project: incbot
+ * Brief: Stress test of the concurrent dictionary, 'cdict_t'
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Several threads upsert, and look up, the same set of keys,
+ * each in a different order, so that they race to add most of them.
+ * Then check that:
+ *
+ *   - every thread got the same symbol number for the same key;
+ *   - symbol numbers are dense, 1 .. nkeys, and no two keys share one;
+ *   - cdict_getname_nr() gives back the key for its number;
+ *   - cdict_export() makes a dict_t that gives every key the same
+ *     number, and that holds the same symbols as a dict_t
+ *     built from the keys serially.
+ *
+ * Exit status is 0 if all is well, 1 otherwise.
+ */
+
+#include <pthread.h>    // pthread_create, pthread_join, pthread_t
+#include <stdbool.h>    // bool, false, true
+#include <stddef.h>     // size_t, NULL
+#include <stdio.h>      // FILE, fprintf, printf, snprintf, stderr
+#include <stdlib.h>     // exit, free
+#include <string.h>     // strcmp, strlen
+#include <cdict.h>      // cdict_t, cdict_new, cdict_upsert, cdict_find,
+                        // cdict_getname_nr, cdict_len, cdict_export,
+                        // cdict_delete
+#include <dict.h>       // dict_t, dict_new, dict_upsert, dict_find,
+                        // dict_getname_nr, dict_delete, undef_symnr
+#include "cscript.h"    // guard_malloc, guard_calloc
+
+// Enough keys to fill several segments of the symbol vector,
+// several string pool arenas, and chains of a dozen or so entries.
+//
+#define NKEYS    50000
+#define NTHREADS 8
+#define NROUNDS  10
+
+char *program_name = "cdict-test";
+FILE *errprint_fh = NULL;
+FILE *dbgprint_fh = NULL;
+bool verbose = false;
+bool debug   = false;
+
+static char *keyv[NKEYS];
+
+// Each thread goes through all the keys, by its own stride.
+// None of them divides NKEYS, so each visits every key once.
+//
+static const size_t stridev[NTHREADS] = { 1, 3, 7, 11, 13, 17, 19, 23 };
+
+struct worker {
+    pthread_t thread;
+    cdict_t *cd;
+    size_t start;
+    size_t stride;
+    size_t symv[NKEYS];         // Symbol number this thread got, by key
+    size_t nerr;
+};
+
+typedef struct worker worker_t;
+
+static worker_t workerv[NTHREADS];
+
+static void
+make_keys(void)
+{
+    char buf[64];
+    size_t i;
+
+    for (i = 0; i < NKEYS; ++i) {
+        // Vary the length, so entries straddle cache lines and arenas.
+        snprintf(buf, sizeof (buf), "k%zu_%.*s", i, (int)(i % 37),
+            "abcdefghijklmnopqrstuvwxyz0123456789_");
+        keyv[i] = (char *) guard_malloc(strlen(buf) + 1);
+        strcpy(keyv[i], buf);
+    }
+}
+
+static void *
+worker_run(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    size_t k = w->start;
+    size_t prev = k;
+    size_t i;
+
+    for (i = 0; i < NKEYS; ++i) {
+        const char *key = keyv[k];
+        size_t len = strlen(key);
+        bool inserted;
+        size_t symnr;
+
+        symnr = cdict_upsert(w->cd, key, len, &inserted);
+        w->symv[k] = symnr;
+        if (symnr == undef_symnr) {
+            ++w->nerr;
+        }
+        if (cdict_find(w->cd, key, len) != symnr) {
+            ++w->nerr;
+        }
+
+        // A key this thread has already seen must still be there,
+        // with the same number, while other threads are adding theirs.
+        //
+        if (cdict_find(w->cd, keyv[prev], strlen(keyv[prev]))
+            != w->symv[prev]) {
+            ++w->nerr;
+        }
+        prev = k;
+        k = (k + w->stride) % NKEYS;
+    }
+    return (NULL);
+}
+
+static size_t
+check_round(cdict_t *cd)
+{
+    bool *seen;
+    dict_t *exported;
+    dict_t *serial;
+    size_t nerr = 0;
+    size_t i;
+    size_t t;
+
+    for (t = 0; t < NTHREADS; ++t) {
+        nerr += workerv[t].nerr;
+    }
+    if (nerr != 0) {
+        fprintf(stderr, "%zu lookups disagreed with upserts.\n", nerr);
+    }
+
+    if (cdict_len(cd) != NKEYS + 1) {
+        fprintf(stderr, "cdict_len() is %zu; expected %zu.\n",
+            cdict_len(cd), (size_t)NKEYS + 1);
+        ++nerr;
+    }
+
+    seen = (bool *) guard_calloc(NKEYS + 1, sizeof (bool));
+    for (i = 0; i < NKEYS; ++i) {
+        size_t symnr = workerv[0].symv[i];
+        const char *name;
+
+        for (t = 1; t < NTHREADS; ++t) {
+            if (workerv[t].symv[i] != symnr) {
+                fprintf(stderr, "'%s': thread 0 got %zu, thread %zu got %zu.\n",
+                    keyv[i], symnr, t, workerv[t].symv[i]);
+                ++nerr;
+            }
+        }
+        if (symnr == undef_symnr || symnr > NKEYS) {
+            fprintf(stderr, "'%s': symnr %zu is out of range.\n",
+                keyv[i], symnr);
+            ++nerr;
+            continue;
+        }
+        if (seen[symnr]) {
+            fprintf(stderr, "'%s': symnr %zu is given out twice.\n",
+                keyv[i], symnr);
+            ++nerr;
+        }
+        seen[symnr] = true;
+        name = cdict_getname_nr(cd, symnr);
+        if (name == NULL || strcmp(name, keyv[i]) != 0) {
+            fprintf(stderr, "'%s': cdict_getname_nr(%zu) is '%s'.\n",
+                keyv[i], symnr, name != NULL ? name : "(null)");
+            ++nerr;
+        }
+    }
+    free(seen);
+
+    exported = dict_new();
+    cdict_export(cd, exported);
+    serial = dict_new();
+    for (i = 0; i < NKEYS; ++i) {
+        bool inserted;
+
+        dict_upsert(serial, keyv[i], strlen(keyv[i]), &inserted);
+    }
+
+    if (exported->len != serial->len) {
+        fprintf(stderr, "Exported dict has %zu symbols; serial has %zu.\n",
+            exported->len, serial->len);
+        ++nerr;
+    }
+    for (i = 0; i < NKEYS; ++i) {
+        size_t symnr = dict_find(exported, keyv[i]);
+
+        if (symnr != workerv[0].symv[i]) {
+            fprintf(stderr, "'%s': exported symnr %zu, cdict symnr %zu.\n",
+                keyv[i], symnr, workerv[0].symv[i]);
+            ++nerr;
+        }
+        if (dict_find(serial, keyv[i]) == undef_symnr) {
+            fprintf(stderr, "'%s': not in serial dict.\n", keyv[i]);
+            ++nerr;
+        }
+    }
+    for (i = 1; i < exported->len; ++i) {
+        const char *name = dict_getname_nr(exported, i);
+
+        if (dict_find(serial, name) == undef_symnr) {
+            fprintf(stderr, "'%s': exported, but not in serial dict.\n",
+                name);
+            ++nerr;
+        }
+    }
+
+    dict_delete(exported);
+    dict_delete(serial);
+    return (nerr);
+}
+
+int
+main(void)
+{
+    size_t nerr = 0;
+    size_t round;
+    size_t t;
+
+    errprint_fh = stderr;
+    dbgprint_fh = stderr;
+    make_keys();
+
+    for (round = 0; round < NROUNDS; ++round) {
+        // Fewer buckets than keys, so that chains are long
+        // enough for upserts to collide in them.
+        //
+        cdict_t *cd = cdict_new(NKEYS / 16);
+
+        for (t = 0; t < NTHREADS; ++t) {
+            workerv[t].cd = cd;
+            workerv[t].start = (t * NKEYS) / NTHREADS;
+            workerv[t].stride = stridev[t];
+            workerv[t].nerr = 0;
+            if (pthread_create(&workerv[t].thread, NULL, worker_run,
+                               &workerv[t]) != 0) {
+                fprintf(stderr, "pthread_create() failed.\n");
+                exit(2);
+            }
+        }
+        for (t = 0; t < NTHREADS; ++t) {
+            pthread_join(workerv[t].thread, NULL);
+        }
+        nerr += check_round(cd);
+        cdict_delete(cd);
+    }
+
+    printf("cdict: %d threads, %d keys, %d rounds, %zu errors.\n",
+        NTHREADS, NKEYS, NROUNDS, nerr);
+    exit(nerr == 0 ? 0 : 1);
+}
@@ -0,0 +1,272 @@
+/*
+ * Filename: src/cmd/test/cf-scan-test.c
+ * Project: incbot
+ * Brief: Test of cf_scan_block(), with input cut into blocks of every size
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * incbot hands each source file to cf_scan_block() whole, so it never
+ * has a block end in the middle of a comment, or between a '\\'
+ * and the character it escapes.  This test does.
+ *
+ * Each file named on the command line, and a few thousand short
+ * strings made up of the characters that matter to libcf, are cut
+ * into blocks of every size from 1 to MAX_BLOCK bytes, and scanned
+ * by every scan implementation that this CPU can run.  The class
+ * of every byte must be the class that cf_next_ref(), the hand-written
+ * state machine, gives it, one character at a time.  Verification is
+ * on, as well, so cf_scan_block() also checks itself as it goes.
+ *
+ * Exit status is 0 if all is well, 1 otherwise.
+ */
+
+#include <stdbool.h>    // bool, false, true
+#include <stddef.h>     // size_t, NULL
+#include <stdio.h>      // EOF, FILE, fopen, fread, fclose, fprintf, printf,
+                        // stderr
+#include <stdlib.h>     // exit, free, rand, srand
+#include <cf.h>         // cf_t, cf_init, cf_scan_block, cf_scan_end,
+                        // cf_span_t, cf_scan_set_impl, cf_scan_impl_name,
+                        // cf_scan_set_verify, cf_scan_get_verify_stats,
+                        // ccv_new, ccv_clear, ccv_at, ccv_delete, CC_*
+#include <cf-impl.h>    // struct cf, cf_next_ref
+#include "cscript.h"    // guard_malloc, guard_realloc
+
+#define MAX_BLOCK   70
+#define NRANDOM     2000
+#define RANDOM_LEN  140
+
+char *program_name = "cf-scan-test";
+FILE *errprint_fh = NULL;
+FILE *dbgprint_fh = NULL;
+bool verbose = false;
+bool debug   = false;
+
+static const int implv[] = {
+    CF_SCAN_SCALAR, CF_SCAN_SSE2, CF_SCAN_AVX2, CF_SCAN_TABLE
+};
+
+#define NIMPL (sizeof (implv) / sizeof (implv[0]))
+
+// The class of each byte, as reported by the spans
+static int *span_classv;
+static size_t span_nbyte;
+
+static int
+record_span(void *arg, const cf_span_t *span)
+{
+    size_t i;
+
+    (void)arg;
+    for (i = 0; i < span->len; ++i) {
+        span_classv[span->off + i] = span->ccl;
+    }
+    span_nbyte += span->len;
+    return (0);
+}
+
+/*
+ * Fill in |classv| with the class cf_next_ref() gives each byte of |buf|.
+ * Return the number of bytes it gave a class to.  That can be one short
+ * of |len|, if |buf| ends in a '/'.
+ */
+static size_t
+ref_classify(const char *buf, size_t len, int *classv)
+{
+    cf_t cf;
+    ccv_t *ccv;
+    size_t nclass = 0;
+    size_t i;
+
+    cf_init(&cf, CC_CODE);
+    ccv = ccv_new();
+    for (i = 0; i <= len; ++i) {
+        int chr = i < len ? (unsigned char)buf[i] : EOF;
+        size_t k;
+
+        ccv_clear(ccv);
+        cf_next_ref(&cf, ccv, chr);
+        for (k = 0; k < ccv->len; ++k) {
+            if (ccv_at(ccv, k)->ccl != CC_EOF) {
+                classv[nclass++] = ccv_at(ccv, k)->ccl;
+            }
+        }
+    }
+    ccv_delete(ccv);
+    return (nclass);
+}
+
+/*
+ * Scan |buf| in blocks of |blksz| bytes, and compare against |refv|.
+ * Return true if all is well.
+ */
+static bool
+check_blocks(const char *name, const char *buf, size_t len,
+    const int *refv, size_t nref, size_t blksz)
+{
+    cf_t cf;
+    size_t pos;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        span_classv[i] = CC_UNDEF;
+    }
+    span_nbyte = 0;
+
+    cf_init(&cf, CC_CODE);
+    for (pos = 0; pos < len; pos += blksz) {
+        size_t n = len - pos < blksz ? len - pos : blksz;
+
+        if (cf_scan_block(&cf, buf + pos, n, record_span, NULL) != 0) {
+            fprintf(stderr, "%s: cf_scan_block() failed.\n", name);
+            return (false);
+        }
+    }
+    if (cf_scan_end(&cf, record_span, NULL) != 0) {
+        fprintf(stderr, "%s: cf_scan_end() failed.\n", name);
+        return (false);
+    }
+
+    if (span_nbyte != len) {
+        fprintf(stderr, "%s, %s, blocks of %zu: spans cover %zu of %zu bytes.\n",
+            name, cf_scan_impl_name(cf_scan_get_impl()), blksz,
+            span_nbyte, len);
+        return (false);
+    }
+    for (i = 0; i < nref; ++i) {
+        if (span_classv[i] != refv[i]) {
+            fprintf(stderr, "%s, %s, blocks of %zu: byte %zu is %s;"
+                " cf_next_ref() says %s.\n",
+                name, cf_scan_impl_name(cf_scan_get_impl()), blksz, i,
+                decode_cclass(span_classv[i]), decode_cclass(refv[i]));
+            return (false);
+        }
+    }
+    return (true);
+}
+
+/*
+ * Check |buf| in blocks of every size up to MAX_BLOCK, and whole.
+ */
+static bool
+check_buf(const char *name, const char *buf, size_t len)
+{
+    int *refv;
+    size_t nref;
+    size_t blksz;
+    bool ok = true;
+
+    refv = (int *) guard_malloc((len + 1) * sizeof (int));
+    span_classv = (int *) guard_realloc(span_classv, (len + 1) * sizeof (int));
+    nref = ref_classify(buf, len, refv);
+    if (nref != len && !(nref + 1 == len && buf[len - 1] == '/')) {
+        fprintf(stderr, "%s: cf_next_ref() classified %zu of %zu bytes.\n",
+            name, nref, len);
+        ok = false;
+    }
+    for (blksz = 1; ok && blksz <= MAX_BLOCK; ++blksz) {
+        ok = check_blocks(name, buf, len, refv, nref, blksz);
+    }
+    if (ok && len > MAX_BLOCK) {
+        ok = check_blocks(name, buf, len, refv, nref, len);
+    }
+    free(refv);
+    return (ok);
+}
+
+static char *
+read_file(const char *fname, size_t *rlen)
+{
+    FILE *f;
+    char *buf = NULL;
+    size_t sz = 0;
+    size_t len = 0;
+    size_t n;
+
+    f = fopen(fname, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s: cannot open.\n", fname);
+        exit(2);
+    }
+    do {
+        sz = sz ? sz * 2 : 4096;
+        buf = (char *) guard_realloc(buf, sz);
+        n = fread(buf + len, 1, sz - len, f);
+        len += n;
+    } while (len == sz);
+    fclose(f);
+    *rlen = len;
+    return (buf);
+}
+
+int
+main(int argc, char **argv)
+{
+    // Everything that changes the state of libcf, and a letter
+    static const char alphabet[] = "a/*\"'\\\n ";
+    cf_scan_verify_stats_t stats;
+    size_t nimpl = 0;
+    size_t nfail = 0;
+    size_t impl;
+    int argi;
+
+    errprint_fh = stderr;
+    dbgprint_fh = stderr;
+    cf_scan_set_verify(true);
+
+    for (impl = 0; impl < NIMPL; ++impl) {
+        unsigned int seed;
+
+        if (cf_scan_set_impl(implv[impl]) != 0) {
+            printf("cf-scan: %s: not supported on this CPU.\n",
+                cf_scan_impl_name(implv[impl]));
+            continue;
+        }
+        ++nimpl;
+
+        for (argi = 1; argi < argc; ++argi) {
+            size_t len;
+            char *buf = read_file(argv[argi], &len);
+
+            nfail += !check_buf(argv[argi], buf, len);
+            free(buf);
+        }
+
+        for (seed = 1; seed <= NRANDOM; ++seed) {
+            char buf[RANDOM_LEN];
+            char name[32];
+            size_t len;
+            size_t i;
+
+            srand(seed);
+            len = (size_t)rand() % RANDOM_LEN;
+            for (i = 0; i < len; ++i) {
+                buf[i] = alphabet[rand() % (sizeof (alphabet) - 1)];
+            }
+            snprintf(name, sizeof (name), "random %u", seed);
+            nfail += !check_buf(name, buf, len);
+        }
+    }
+
+    cf_scan_get_verify_stats(&stats);
+    printf("cf-scan: %zu implementations, %zu failures;"
+        " verify: %zu bytes checked, %zu mismatched.\n",
+        nimpl, nfail, stats.nbyte, stats.nmismatch);
+    exit(nfail == 0 && stats.nmismatch == 0 ? 0 : 1);
+}
@@ -0,0 +1,14 @@
+main()
+{
+    size_t n = strlen(s);
+    size_tt m;
+    ssize_t k;
+    int NULLs = 0;
+    FILE_ *f;
+    bool_t b = true;
+    printf_("%d\n", n);
+    exit_(0);
+    int (*p)() = printf;
+    errno_t e;
+    free(malloc(n));
+}
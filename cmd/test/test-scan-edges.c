@@ -0,0 +1,21 @@
+main()
+{
+    int pad00;
+    int pad01;
+    int pad02_________;
+/* ENOENT is in a comment that starts at the end of a block. */
+    int pad03;
+    int pad04;
+    int pad05____;
+    char *s = "\"strlen(s) is in a string, after an escape across a block\"";
+    int pad06;
+    int pad07;
+    int pad08_____;
+    int q = 1; // malloc(1) is in a line comment that starts
+    ;               // at the end of a block.
+    int pad09_______;
+    char c = '\'';
+    q = q / 2;
+    FILE *f = fopen(s, "r");
+    exit(0);
+}
@@ -0,0 +1,7 @@
+main()
+{
+    printf("%d\n", 1);
+}
+
+/* A comment that is never closed.  abort() and ENOMEM are in it.
+   Scanning stops at the end of the file, still in the comment.
\ No newline at end of file
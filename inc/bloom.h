@@ -0,0 +1,105 @@
+/*
+ * Filename: src/inc/bloom.h
+ * Project: libincbot
+ * Brief: Blocked Bloom filter over 64-bit hash values
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOOM_H
+
+#define BLOOM_H 1
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint64_t
+
+/*
+ * A Bloom filter answers "is this key in the set?" with either
+ * "certainly not" or "maybe".  It is used in front of a lookup
+ * where most keys are expected to be absent, so that most misses
+ * never get as far as the real table.
+ *
+ * This is a "blocked" Bloom filter.  The bits are divided into
+ * blocks of 512 bits, one 64-byte cache line each.  All k bits of
+ * a key are in the same block, so a query touches one cache line.
+ * That costs a little in false-positive rate, compared to a classic
+ * Bloom filter of the same size.
+ *
+ * Keys are not strings, but hash values that the caller has already
+ * computed, such as dict_hash() values.  All 64 bits must be
+ * well mixed.  The high 32 bits select the block; the bit positions
+ * within a block come from a remix of the whole value.
+ */
+
+#define BLOOM_BLOCK_BITS  512
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BITS / 64)
+#define BLOOM_MAX_K       7     // 7 bit positions, of 9 bits each
+
+struct bloom {
+    uint64_t *bits;         // [nblock * BLOOM_BLOCK_WORDS]
+    size_t nblock;
+    size_t nkey;            // Number of keys added
+    unsigned int k;         // Number of bits set per key
+    unsigned int bits_per_key;
+};
+
+typedef struct bloom bloom_t;
+
+extern bloom_t *bloom_new(size_t nkey, unsigned int bits_per_key);
+extern void     bloom_delete(bloom_t *bf);
+extern void     bloom_add(bloom_t *bf, uint64_t h);
+extern double   bloom_expected_fpr(const bloom_t *bf);
+
+static inline const uint64_t *
+bloom_block(const bloom_t *bf, uint64_t h)
+{
+    size_t b = (size_t)(((h >> 32) * (uint64_t)bf->nblock) >> 32);
+
+    return (bf->bits + b * BLOOM_BLOCK_WORDS);
+}
+
+static inline uint64_t
+bloom_remix(uint64_t h)
+{
+    return ((h ^ (h >> 31)) * 0x94d049bb133111ebULL);
+}
+
+/*
+ * Return false if |h| was certainly never added to |bf|.
+ */
+static inline bool
+bloom_maybe_contains(const bloom_t *bf, uint64_t h)
+{
+    const uint64_t *blk = bloom_block(bf, h);
+    uint64_t g = bloom_remix(h);
+    unsigned int i;
+
+    for (i = 0; i < bf->k; ++i) {
+        unsigned int bit = (unsigned int)(g >> (64 - 9 * (i + 1))) & 511;
+
+        if ((blk[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+#endif /* BLOOM_H */
@@ -0,0 +1,100 @@
+/*
+ * Filename: src/inc/cdict.h
+ * Project: libincbot
+ * Brief: Concurrent dictionary, 'cdict_t', shared by many threads
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CDICT_H
+
+#define CDICT_H 1
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint64_t
+
+#include <dict.h>
+
+/*
+ * A variant of dict_t that any number of threads can look up
+ * and add symbols to, at the same time, without locks.
+ *
+ * As in a dict_t, symbols are only ever appended, they never move,
+ * and each one has a symbol number; undef_symnr is never a symbol.
+ * The same dict_hash() is used, so a caller that hashes as it scans
+ * can use cdict_find_prehashed().  What is different:
+ *
+ *   - Segments of the symbol vector double in size, one after another,
+ *     so there are never more than CDICT_NSEG of them, and the vector
+ *     of segments is a fixed array, which is never reallocated.
+ *     A segment is allocated by whichever thread needs it first.
+ *
+ *   - The hash table has a fixed number of buckets, chosen when
+ *     the dictionary is made, and is never rehashed.  Each bucket
+ *     is a chain.  A new symbol is pushed onto the front of the chain
+ *     with a compare-and-swap.
+ *
+ *   - Strings are allocated from the current arena with an atomic add.
+ *
+ * Lookups take no locks, and write nothing.  An upsert that does not
+ * find its symbol makes a string pool entry for it, links the entry in,
+ * and only then takes the next symbol number and fills in its slot.
+ * Until then, the entry is not finished; cdict_find() passes over it,
+ * as if it were not there yet.  Two threads that add the same symbol
+ * at once get the same number, because the one that loses the race
+ * to link its entry in finds the other's, and waits for it to be
+ * finished.
+ *
+ * Symbol numbers are dense, but they are given out in the order
+ * in which threads happen to add symbols, so which symbol gets which
+ * number can differ from run to run.
+ */
+
+// Segment k, for k > 0, holds symbol numbers
+// [dict_segment_size << (k - 1), dict_segment_size << k).
+// That covers all of dict_max_symbols.
+//
+#define CDICT_NSEG 24
+
+struct cdict_entry;
+
+struct cdict {
+    char **seg[CDICT_NSEG];     // Segments of the symbol vector
+    size_t len;                 // Next symbol number to give out
+    struct cdict_entry **bkt;   // [nbkt] Hash chains
+    size_t nbkt;                // A power of 2
+    void *arena;                // Current string pool arena
+};
+
+typedef struct cdict cdict_t;
+
+extern cdict_t *cdict_new(size_t nsym);
+extern void     cdict_delete(cdict_t *cd);
+extern size_t   cdict_find(cdict_t *cd, const char *s, size_t len);
+extern size_t   cdict_find_prehashed(cdict_t *cd, const char *s, size_t len,
+                                     uint64_t h);
+extern size_t   cdict_upsert(cdict_t *cd, const char *s, size_t len,
+                             bool *rinserted);
+extern char    *cdict_getname_nr(cdict_t *cd, size_t symnr);
+extern size_t   cdict_len(cdict_t *cd);
+extern void     cdict_export(cdict_t *cd, dict_t *dict);
+
+#endif /* CDICT_H */
@@ -28,10 +28,15 @@
 
 #define CF_IMPL_H 1
 
+#include <stdint.h>
+    // Import type uint8_t
+    // Import type uint16_t
+
 struct cf {
     int err;
     int state;
     enum cclass_set cclass;
+    size_t pos;         // Bytes seen so far by cf_scan_block()
 };
 
 enum state {
@@ -48,6 +53,38 @@ enum state {
     S_EOF,
 };
 
+/*
+ * The state machine, as tables, generated by mk-cf-table-c.
+ * All that matters about a byte is which of these it is.
+ */
+enum cf_byte_class {
+    CF_BC_OTHER,
+    CF_BC_DQUOTE,
+    CF_BC_SQUOTE,
+    CF_BC_SLASH,
+    CF_BC_STAR,
+    CF_BC_BSLASH,
+    CF_BC_NL,
+    CF_NBCLASS,
+};
+
+#define CF_NSTATE S_EOF
+
+struct cf_trans {
+    uint8_t  next;      // Next state
+    uint8_t  nemit;     // 0, 1, or 2 (the held '/', then this byte)
+    uint16_t ccl;       // Class of what is emitted
+};
+
+typedef struct cf_trans cf_trans_t;
+
+extern const uint8_t cf_byte_class[256];
+extern const cf_trans_t cf_trans[CF_NSTATE][CF_NBCLASS];
+extern const uint16_t cf_state_cclass[CF_NSTATE + 1];
+
 extern const char *decode_state(int state);
 
+// The hand-written state machine, that the tables are checked against.
+extern int cf_next_ref(cf_t *ctx, ccv_t *rccv, int chr);
+
 #endif /* CF_IMPL_H */
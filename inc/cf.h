@@ -26,6 +26,8 @@
 
 #include <stdbool.h>
     // Import type bool
+#include <stdint.h>
+    // Import type uint16_t
 #include <unistd.h>
     // Import type size_t
 
@@ -66,14 +68,32 @@ struct ccl {
 
 typedef struct ccl ccl_t;
 
+/*
+ * A ccv_t is a ring buffer of super-characters.  cf_next() uses it
+ * as a stack, with ccv_push(), ccv_top(), and ccv_pop().  A scanner
+ * can also take super-characters off the front, with ccv_pop_front(),
+ * and push back as many as it likes, with ccv_push_front().
+ * All of those take constant time; the buffer grows as needed.
+ *
+ * ccv_at(ccv, i) is the i'th super-character from the front,
+ * for i < ccv->len.
+ */
+
 struct cclassv {
-    size_t sz;
+    size_t sz;          // Capacity; a power of 2
     size_t len;
-    ccl_t  array[0];
+    size_t head;        // Where in array[] the front is
+    ccl_t  *array;
 };
 
 typedef struct cclassv ccv_t;
 
+static inline ccl_t *
+ccv_at(ccv_t *ccv, size_t i)
+{
+    return (ccv->array + ((ccv->head + i) & (ccv->sz - 1)));
+}
+
 struct cf;
 typedef struct cf cf_t;
 
@@ -88,6 +108,9 @@ extern int  ccv_push(ccv_t *ccv, int chr, int cclass);
 extern int  ccv_top(ccv_t *ccv, int *rchr, int *rccl);
 extern int  ccv_pop(ccv_t *ccv, int *rchr, int *rccl);
 extern bool ccv_empty(ccv_t *ccv);
+extern void ccv_clear(ccv_t *ccv);
+extern int  ccv_push_front(ccv_t *ccv, int chr, int cclass);
+extern int  ccv_pop_front(ccv_t *ccv, int *rchr, int *rccl);
 extern const char *decode_cclass(int);
 
 
@@ -101,4 +124,88 @@ extern void cf_init(cf_t *ctx, int cclset);
 extern cf_t *cf_new(int cclset);
 extern int cf_next(cf_t *ctx, ccv_t *rccv, int chr);
 
+
+/*
+ * Block-at-a-time interface.
+ *
+ * Instead of feeding one character at a time to cf_next(),
+ * hand a whole block to cf_scan_block(), and get back spans,
+ * that is, maximal runs of characters of the same class:
+ * { offset, length, class }.  Offsets count from the start of
+ * the first block given to the cf_t, so blocks can follow one another,
+ * and the state carries over from one to the next.
+ * Call cf_scan_end() after the last block.
+ *
+ * A caller that only wants code can skip over whole comments
+ * and literals, without looking at them.
+ *
+ * A span callback returns 0 to go on, or anything else to stop.
+ */
+
+struct cf_span {
+    size_t off;
+    size_t len;
+    int ccl;
+};
+
+typedef struct cf_span cf_span_t;
+
+typedef int cf_span_fn_t(void *arg, const cf_span_t *span);
+
+extern int cf_scan_block(cf_t *ctx, const char *buf, size_t len,
+                         cf_span_fn_t *fn, void *arg);
+extern int cf_scan_end(cf_t *ctx, cf_span_fn_t *fn, void *arg);
+
+/*
+ * cf_scan_block() finds the bytes that matter with whichever of these
+ * the CPU can run; by default, the best one.  CF_SCAN_TABLE does not
+ * skip; it runs the transition table over every byte.
+ * Verification runs the hand-written reference state machine, which
+ * does not use the tables, alongside it, and counts the bytes
+ * whose class differs.
+ */
+
+enum cf_scan_impl {
+    CF_SCAN_AUTO,
+    CF_SCAN_SCALAR,
+    CF_SCAN_SSE2,
+    CF_SCAN_AVX2,
+    CF_SCAN_TABLE,
+};
+
+struct cf_scan_verify_stats {
+    size_t nbyte;
+    size_t nmismatch;
+};
+
+typedef struct cf_scan_verify_stats cf_scan_verify_stats_t;
+
+extern int  cf_scan_set_impl(int impl);
+extern int  cf_scan_get_impl(void);
+extern const char *cf_scan_impl_name(int impl);
+extern int  cf_scan_impl_by_name(const char *name);
+extern void cf_scan_set_verify(bool verify);
+extern void cf_scan_get_verify_stats(cf_scan_verify_stats_t *rstats);
+
+/*
+ * The class of every byte, rather than spans.
+ *
+ * cf_classify() runs the transition table over a block, with no
+ * branches on the data: classv[i + 1] is the class of buf[i],
+ * classv[0] is the class of a '/' held over from the block before,
+ * if any, and a '/' held at the end is left CC_UNDEF.  |classv| must
+ * have room for |len| + 1 entries.
+ *
+ * cf_classify_multi() does the same for |n| independent streams,
+ * interleaved, CF_CLASSIFY_NSTREAM at a time, each with a block
+ * of the same length.
+ */
+
+#define CF_CLASSIFY_NSTREAM 4
+
+extern void cf_classify(cf_t *ctx, const char *buf, size_t len,
+                        uint16_t *classv);
+extern void cf_classify_multi(cf_t **ctxv, const char **bufv, size_t len,
+                              uint16_t **classvv, size_t n);
+
 #endif /* CF_H */
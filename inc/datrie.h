@@ -0,0 +1,96 @@
+/*
+ * Filename: src/inc/datrie.h
+ * Project: libincbot
+ * Brief: Double-array trie over C identifiers
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATRIE_H
+
+#define DATRIE_H 1
+
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type int32_t
+    // Import type uint8_t
+    // Import type uint32_t
+
+/*
+ * A trie whose alphabet is the 63 characters that can appear
+ * in a C identifier, stored as a double array.
+ *
+ * Every node is a cell.  The child of node |s| on character code |c|
+ * is cell base[s] + c, provided that check[base[s] + c] == s.
+ * So, following an edge is one add, one load, and one compare,
+ * and a string that is not in the trie falls off as soon as
+ * it has no more prefix in common with any key.
+ *
+ * Each node may carry a value; value 0 means no key ends there.
+ *
+ * The arrays always have DATRIE_NCODE spare cells past the
+ * largest base, so a step never needs a bounds check.
+ */
+
+#define DATRIE_NCODE 64         // Character codes 1 .. 63; 0 is unused
+#define DATRIE_ROOT  0
+#define DATRIE_DEAD  (-1)
+
+struct datrie_cell {
+    int32_t base;
+    int32_t check;              // Parent node, or -1 if the cell is free
+};
+
+typedef struct datrie_cell datrie_cell_t;
+
+struct datrie {
+    datrie_cell_t *cell;        // [ncell]
+    uint32_t *value;            // [ncell]
+    size_t ncell;
+    size_t nnode;               // Cells in use
+};
+
+typedef struct datrie datrie_t;
+
+// Character code of each byte; 0 if it cannot be part of an identifier.
+extern const uint8_t datrie_code[256];
+
+extern datrie_t *datrie_build(const char *const *keyv, const uint32_t *valv,
+                              size_t n);
+extern void      datrie_delete(datrie_t *da);
+
+/*
+ * Take one step from node |s| on byte |chr|.
+ * Return the child, or DATRIE_DEAD.  Stepping from DATRIE_DEAD
+ * is not allowed; the caller stops stepping once it falls off.
+ */
+static inline int32_t
+datrie_step(const datrie_t *da, int32_t s, int chr)
+{
+    int32_t t = da->cell[s].base + datrie_code[(unsigned char)chr];
+
+    return (da->cell[t].check == s ? t : DATRIE_DEAD);
+}
+
+static inline uint32_t
+datrie_value(const datrie_t *da, int32_t s)
+{
+    return (s == DATRIE_DEAD ? 0 : da->value[s]);
+}
+
+#endif /* DATRIE_H */
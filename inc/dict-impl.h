@@ -0,0 +1,208 @@
+/*
+ * Filename: src/inc/dict-impl.h
+ * Project: libincbot
+ * Brief: Definitions private to the implementation of data type, 'dict_t'
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DICT_IMPL_H
+
+#ifndef DICT_H
+#error "Require dict.h"
+#endif
+
+#define DICT_IMPL_H 1
+
+#include <stdbool.h>
+    // Import type bool
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <string.h>
+    // Import memcmp()
+
+extern void   dict_grow(dict_t *dict);
+extern size_t dict_append_symbol(dict_t *dict, const char *s, size_t len,
+                                 size_t h);
+extern void   dict_thaw(dict_t *dict);
+extern size_t dict_find_linear_len(dict_t *dict, const char *s, size_t len);
+extern void   dict_freeze_phash(dict_t *dict);
+
+// Number of lookups that dict_find_batch() keeps in flight at once.
+//
+#define DICT_BATCH 16
+
+/*
+ * Every symbol in the string pool of a dict_t is preceded by a header
+ * that caches its hash value and its length.  See dict.c.
+ */
+
+struct symhdr {
+    uint32_t h;         // Low 32 bits of dict_hash() of the string
+    uint32_t len;       // strlen() of the string
+};
+
+typedef struct symhdr symhdr_t;
+
+static inline const symhdr_t *
+sym_hdr(const char *sym)
+{
+    return ((const symhdr_t *)sym - 1);
+}
+
+/*
+ * Lookup counts of a dict_t, and those of the lookup in progress.
+ * See dict_set_count_lookups().  Backends call dict_count_probe()
+ * for each step of a search, and dict_count_strcmp() for each
+ * string compare.  Both cost one test of a pointer that is NULL
+ * unless counting was asked for.
+ */
+struct dict_counts {
+    dict_lookup_stats_t total;
+    size_t probes;
+    size_t strcmps;
+};
+
+static inline void
+dict_count_probe(dict_t *dict)
+{
+    if (dict->counts != NULL) {
+        ++dict->counts->probes;
+    }
+}
+
+static inline void
+dict_count_strcmp(dict_t *dict)
+{
+    if (dict->counts != NULL) {
+        ++dict->counts->strcmps;
+    }
+}
+
+/*
+ * Is |sym| the string, |s|, of length |len|, with hash value |h|?
+ * The cached hash value and length reject most candidates,
+ * without looking at the string.
+ */
+static inline bool
+symbol_match(dict_t *dict, const char *sym, const char *s, size_t len,
+    size_t h)
+{
+    const symhdr_t *hdr;
+
+    if (sym == NULL) {
+        return (false);
+    }
+    hdr = sym_hdr(sym);
+    if (hdr->h != (uint32_t)h || hdr->len != len) {
+        return (false);
+    }
+    dict_count_strcmp(dict);
+    return (memcmp(sym, s, len) == 0);
+}
+
+/*
+ * Hash tables hold the low 32 bits of dict_hash(),
+ * which is also what is cached in the header of each symbol.
+ * Only the perfect hash index uses all 64 bits.
+ */
+static inline size_t
+hash_fold(uint64_t h)
+{
+    return ((uint32_t)h);
+}
+
+/*
+ * The index of a dict_t, in dict->hashtable, is one of several kinds.
+ * Each kind is a backend, a table of the operations on it.
+ * The index is made on first use, of whichever kind is selected
+ * at the time; see dict_set_backend().
+ *
+ *   create    Make the index, with room for |n| symbols, and enter
+ *             all the symbols that are already in the dictionary.
+ *   destroy   Free the index.
+ *   reserve   Make room for a total of |n| symbols.
+ *   find      Look up the symbol, |s|, of length |len|, whose
+ *             dict_hash() value is |h|.  If it is not there, and
+ *             |upsert| is true, append it to the dictionary, with
+ *             dict_append_symbol(), enter it, and set |*rinserted|.
+ *   prefetch  Start fetching what find() will look at first.  May be NULL.
+ *   freeze    No more symbols are expected.  May be NULL.
+ *   stats     Fill in what the backend knows of |*rstats|: the size
+ *             of the index, and, for a hash table, its shape.
+ *   dump      Show the whole index, on stderr.
+ */
+struct dict_backend {
+    const char *name;
+    void   (*create)(dict_t *dict, size_t n);
+    void   (*destroy)(dict_t *dict);
+    void   (*reserve)(dict_t *dict, size_t n);
+    size_t (*find)(dict_t *dict, const char *s, size_t len, uint64_t h,
+                   bool upsert, bool *rinserted);
+    void   (*prefetch)(dict_t *dict, uint64_t h);
+    void   (*freeze)(dict_t *dict);
+    void   (*stats)(dict_t *dict, dict_stats_t *rstats);
+    void   (*dump)(dict_t *dict);
+};
+
+typedef struct dict_backend dict_backend_t;
+
+extern const dict_backend_t dict_backend_chained;
+extern const dict_backend_t dict_backend_swiss;
+extern const dict_backend_t dict_backend_sorted;
+extern const dict_backend_t dict_backend_trie;
+extern const dict_backend_t dict_backend_linear;
+
+/*
+ * Minimal perfect hash index over all the symbols of a frozen dict_t.
+ *
+ * CHD (Compress, Hash, Displace) style.  Each symbol hashes to one of
+ * |nbkt| small buckets.  Each bucket has a displacement, which was
+ * chosen, at build time, so that all the symbols in the bucket land
+ * in distinct, previously unused slots.  There are exactly as many
+ * slots as there are symbols.
+ *
+ * A lookup is one hash, one displacement fetch, one slot fetch,
+ * and one string compare to verify that the symbol really is there.
+ * The hash is derived from the full 64-bit dict_hash() value,
+ * so a caller that already has that value does not hash again.
+ *
+ * The tables contain no pointers, so they can be stored in, and used
+ * in place from, a dictionary image.
+ */
+
+struct phash {
+    uint64_t seed;
+    size_t nbkt;
+    size_t nslot;
+    const uint32_t *disp;   // [nbkt]  Displacement index of each bucket
+    const uint32_t *slot;   // [nslot] Symbol number in each slot
+    bool mapped;            // disp and slot belong to an image
+};
+
+typedef struct phash phash_t;
+
+extern phash_t *phash_build(dict_t *dict);
+extern void     phash_delete(phash_t *ph);
+extern size_t   phash_find(dict_t *dict, const phash_t *ph,
+                           const char *s, size_t len, uint64_t h);
+extern void     phash_find_batch(dict_t *dict, const phash_t *ph,
+                                 const dict_key_t *keyv, size_t n,
+                                 symnr_t *outv);
+
+#endif /* DICT_IMPL_H */
@@ -24,6 +24,17 @@
 
 #define DICT_H 1
 
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+    // Import constant UINT32_MAX
+#include <string.h>
+    // Import memcpy()
+
 /*
  * This implementation of "dictionary" is specialized for symbol
  * tables that get built up as new symbols arrive, but
@@ -46,9 +57,11 @@
  * be pointers would be just entry numbers, which get translated
  * into memory segment offsets, anyway.
  *
- * It also means that, even on a 64-bit ISA, we could use 32-bit
+ * It also means that, even on a 64-bit ISA, we can use 32-bit
  * symbol-table slot numbers, as long as we are willing to live
  * with the restriction that we can only have 4G symbols.
+ * We are.  Symbol numbers are stored as symnr_t, everywhere.
+ * The API still passes them around as size_t.
  *
  * Access by slot number to a segmented array is pretty much
  * just a 2-dimensional, expandable, Iliffe vector.
@@ -56,11 +69,19 @@
  */
 
 
+struct dict_counts;
+
 struct dict {
     char ***sv;		// Segment vector
     size_t sz;		// Allocated capacity, number of entries (not bytes)
     size_t len;		// Number of entries occupied
-    void   *hashtable;
+    void   *strpool;		// Arenas that hold the symbols themselves
+    void   *hashtable;		// Index of the kind given by hash_backend
+    int    hash_backend;	// enum dict_backend_kind
+    void   *phash;		// Perfect hash index, if frozen, or NULL
+    const char   *img_strs;	// Mapped image: string pool, or NULL
+    const uint32_t *img_offv;	// Mapped image: offset of each symbol
+    struct dict_counts *counts;	// Lookup counts, or NULL if not counting
 };
 
 typedef struct dict dict_t;
@@ -74,13 +95,276 @@ typedef struct dict dict_t;
  */
 static const size_t undef_symnr = (size_t)(0);
 
+typedef uint32_t symnr_t;
+
+static const size_t dict_max_symbols = UINT32_MAX;
+
 static const size_t dict_segment_size = 1024;
 
+/*
+ * Hash function for symbols.
+ *
+ * The string is consumed 8 bytes at a time.  A final partial word
+ * is padded with zero bytes.  Words are always taken in little-endian
+ * byte order, so that the incremental form, below, which assembles
+ * words one byte at a time, gives the same result as dict_hash().
+ * The length is mixed in at the end, and the result goes through
+ * a 64-bit finalizer, so all bits of the hash value are usable.
+ */
+
+#define DICT_HASH_SEED 0x243f6a8885a308d3ULL
+
+static inline uint64_t
+dict_hash_word(uint64_t h, uint64_t w)
+{
+    h ^= w * 0xbf58476d1ce4e5b9ULL;
+    h = (h << 31) | (h >> 33);
+    return (h * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline uint64_t
+dict_hash_final(uint64_t h, size_t len)
+{
+    h ^= (uint64_t)len;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (h);
+}
+
+static inline uint64_t
+dict_hash_load(const char *s, size_t n)
+{
+    uint64_t w = 0;
+
+    memcpy(&w, s, n);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return (w);
+}
+
+static inline uint64_t
+dict_hash(const char *s, size_t len)
+{
+    uint64_t h = DICT_HASH_SEED;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        h = dict_hash_word(h, dict_hash_load(s + i, 8));
+    }
+    if (i < len) {
+        h = dict_hash_word(h, dict_hash_load(s + i, len - i));
+    }
+    return (dict_hash_final(h, len));
+}
+
+/*
+ * Incremental form of dict_hash(), for a caller that sees a symbol
+ * one byte at a time anyway, such as a lexer.  It can hash the symbol
+ * as it goes, and then look it up with dict_find_prehashed(),
+ * so the symbol is never read again just to hash it.
+ */
+
+struct dict_hash_state {
+    uint64_t h;
+    uint64_t w;             // Partial word, so far
+    size_t len;
+};
+
+typedef struct dict_hash_state dict_hash_state_t;
+
+static inline void
+dict_hash_start(dict_hash_state_t *hs)
+{
+    hs->h = DICT_HASH_SEED;
+    hs->w = 0;
+    hs->len = 0;
+}
+
+static inline void
+dict_hash_byte(dict_hash_state_t *hs, int c)
+{
+    hs->w |= (uint64_t)(unsigned char)c << (8 * (hs->len & 7));
+    ++hs->len;
+    if ((hs->len & 7) == 0) {
+        hs->h = dict_hash_word(hs->h, hs->w);
+        hs->w = 0;
+    }
+}
+
+static inline uint64_t
+dict_hash_end(dict_hash_state_t *hs)
+{
+    uint64_t h = hs->h;
+
+    if ((hs->len & 7) != 0) {
+        h = dict_hash_word(h, hs->w);
+    }
+    return (dict_hash_final(h, hs->len));
+}
+
+/*
+ * Kinds of index.  All of them give the same results;
+ * the choice is a matter of performance.  Only the chained hash
+ * table, the default, gets a perfect hash index when the dictionary
+ * is frozen; the others go on answering lookups themselves, so that
+ * each of them can be measured on the same workload.
+ */
+enum dict_backend_kind {
+    DICT_BACKEND_CHAINED,   // Set-associative buckets, with overflow chains
+    DICT_BACKEND_SWISS,     // Open addressing, SIMD matching of hash tags
+    DICT_BACKEND_SORTED,    // Sorted array, binary search
+    DICT_BACKEND_TRIE,      // Ternary search trie
+    DICT_BACKEND_LINEAR,    // No index at all; linear search
+    DICT_NBACKEND
+};
+
+/*
+ * Lookup counts, kept only if dict_set_count_lookups() was on
+ * when the dictionary was made.
+ *
+ * A probe is one step of a search: an entry of a hash bucket
+ * or overflow chain, a group of a swiss table, a step of a binary
+ * search, a node of a trie, a symbol of a linear search.
+ * A lookup in a perfect hash index is one probe.  A string compare
+ * is made only when the cached hash value and length of a symbol
+ * already match.  An upsert that adds a symbol is a miss.
+ */
+struct dict_lookup_stats {
+    size_t nhit;
+    size_t nmiss;
+    size_t hit_probes;
+    size_t miss_probes;
+    size_t hit_max_probes;
+    size_t miss_max_probes;
+    size_t hit_strcmps;
+    size_t miss_strcmps;
+};
+
+typedef struct dict_lookup_stats dict_lookup_stats_t;
+
+// Histograms have this many bins.  The last one also counts
+// everything bigger.
+//
+#define DICT_STATS_NHIST 8
+
+/*
+ * What a dictionary, and its index, look like, at the moment.
+ * Sizes are in bytes.  The shape of the index is given only
+ * by the hash tables; nbkt is 0 for other kinds of index.
+ */
+struct dict_stats {
+    const char *backend;    // Name of the kind of index
+    const char *lookup_index; // Name of the index that answers lookups:
+                            // the backend, or "phash", if frozen
+    size_t nsym;            // Number of symbols
+    bool frozen;            // Lookups use a perfect hash index
+    bool mapped;            // Symbols are in a mapped image
+
+    size_t sv_bytes;        // Segment vector, and its segments
+    size_t strs_bytes;      // String pool
+    size_t strs_used;       // String pool, in use
+    size_t index_bytes;     // The whole index, including tbl and ovfl
+    size_t tbl_bytes;       // Hash buckets, or slots
+    size_t ovfl_bytes;      // Overflow entries
+    size_t phash_bytes;     // Perfect hash index
+
+    size_t nbkt;            // Hash buckets, or slots
+    double load_factor;     // Symbols per bucket
+    size_t bkt_hist[DICT_STATS_NHIST];   // Buckets, by symbols in them
+    size_t chain_hist[DICT_STATS_NHIST]; // Buckets, by overflow chain length
+    size_t max_chain;       // Longest overflow chain
+
+    bool counted;           // Lookups were counted
+    dict_lookup_stats_t lookups;
+};
+
+typedef struct dict_stats dict_stats_t;
+
+/*
+ * Modes for cross-checking hash table lookups against a linear search.
+ */
+enum dict_verify_mode {
+    DICT_VERIFY_OFF,
+    DICT_VERIFY_SAMPLED,    // Check 1 in N lookups
+    DICT_VERIFY_FULL,       // Check every lookup
+};
+
+struct dict_verify_stats {
+    size_t nlookup;         // Lookups seen while verification was on
+    size_t ncheck;          // Lookups that were cross-checked
+    size_t nmismatch;       // Cross-checks that disagreed
+};
+
+typedef struct dict_verify_stats dict_verify_stats_t;
+
 extern void dict_init(dict_t *dict);
 extern dict_t *dict_new(void);
+extern void dict_delete(dict_t *dict);
 extern size_t dict_add(dict_t *dict, const char *s);
+extern size_t dict_upsert(dict_t *dict, const char *s, size_t len,
+                          bool *rinserted);
+extern void dict_reserve(dict_t *dict, size_t n);
+extern void dict_set_backend(int backend);
+extern int  dict_backend_by_name(const char *name);
+extern const char *dict_backend_name(int backend);
+extern void dict_stats(dict_t *dict, dict_stats_t *rstats);
+extern void dict_set_count_lookups(bool on);
+extern void dict_set_verify(int mode, size_t sample_rate);
+extern void dict_get_verify_stats(dict_verify_stats_t *rstats);
 extern size_t dict_find(dict_t *dict, const char *s);
+extern size_t dict_find_prehashed(dict_t *dict, const char *s, size_t len,
+                                  uint64_t h);
 extern char *dict_getname_str(dict_t *dict, const char *s);
 extern char *dict_getname_nr(dict_t *dict, size_t pos);
 
+/*
+ * Batched lookup.  Each lookup is a chain of dependent cache misses:
+ * index, then symbol.  Given a group of independent lookups,
+ * dict_find_batch() issues prefetches for all of them, one step
+ * at a time, so that the misses overlap instead of adding up.
+ *
+ * |h| must be dict_hash(s, len).  outv[i] gets the symbol number
+ * of keyv[i], or undef_symnr.  The results are the same as those
+ * of dict_find_prehashed(), one key at a time.
+ */
+struct dict_key {
+    const char *s;
+    size_t len;
+    uint64_t h;
+};
+
+typedef struct dict_key dict_key_t;
+
+extern void dict_find_batch(dict_t *dict, const dict_key_t *keyv, size_t n,
+                            symnr_t *outv);
+
+/*
+ * Freezing a dictionary with a chained hash table builds a minimal
+ * perfect hash index over all of its symbols.  Lookups then cost
+ * one hash, one probe and one string compare.  Other kinds of index
+ * are only completed, and go on answering lookups.  Unless lookups
+ * are being counted or verified, they write nothing, so any number
+ * of threads can share a frozen dictionary.  Adding a new symbol
+ * to a frozen dictionary discards the index.
+ */
+extern void dict_freeze(dict_t *dict);
+
+/*
+ * A dictionary can be "compiled" into a position-independent image,
+ * which contains no pointers, only offsets relative to the start
+ * of the image.  An image can later be used in place, for example
+ * from read-only mmap()-ed memory.  A mapped dictionary is read-only
+ * until something is added to it; then it is copied to the heap.
+ */
+
+extern size_t dict_image_size(dict_t *dict);
+extern void   dict_image_store(dict_t *dict, void *img);
+extern int    dict_image_check(const void *img, size_t sz, size_t *rlen);
+extern int    dict_image_map(dict_t *dict, const void *img, size_t sz);
+extern void   dict_image_unmap(dict_t *dict);
+
 #endif /* DICT_H */
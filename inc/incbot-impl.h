@@ -29,6 +29,193 @@
 
 #define INCBOT_IMPL_H 1
 
-#include <dict.h>
+#include <stdbool.h>     // bool
+#include <stdio.h>       // FILE
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint8_t, uint32_t, uint64_t
+#include <dict.h>        // dict_t, symnr_t
+
+// Index of a record in id_table.  Like symbol numbers, 32 bits is plenty.
+//
+typedef uint32_t index_t;
+
+enum sym_type {
+    TYPE_UNKNOWN  = 0x01,
+    TYPE_FUNCTION = 0x02,
+    TYPE_TYPEDEF  = 0x04,
+    TYPE_KEYWORD  = 0x08,
+    TYPE_CONSTANT = 0x10,
+    TYPE_VAR      = 0x20,
+    TYPE_STRUCT   = 0x40,
+};
+
+#define TYPE_ALL (TYPE_UNKNOWN|TYPE_FUNCTION|TYPE_TYPEDEF|TYPE_KEYWORD|TYPE_CONSTANT|TYPE_VAR|TYPE_STRUCT)
+
+/*
+ * Description of an identifier, as it is read from an id-table.
+ * All strings are symbol numbers.  sym is in id_symtable;
+ * everything else is in strtable.
+ *
+ * The identifier table does not store idinfo_t records as such.
+ * It is split into two parallel arrays; see id_hot and id_cold.
+ */
+struct idinfo {
+    symnr_t sym;
+    symnr_t src1;
+    symnr_t standard1;
+    symnr_t standard2;
+    symnr_t man_sect;
+    symnr_t man_path;
+    symnr_t declare;
+    uint8_t type;           // enum sym_type
+};
+
+typedef struct idinfo idinfo_t;
+
+/*
+ * Hot part of an identifier description: everything the scanner
+ * looks at for every identifier it finds.  8 bytes.
+ *
+ * src1 is undef_symnr if there is no header file to include,
+ * so the scanner does not have to look at the string to find out.
+ *
+ * Nothing about a run, such as which identifiers are traced,
+ * is kept here, so that the table can be read-only.
+ */
+struct idhot {
+    symnr_t  src1;
+    uint8_t  type;          // enum sym_type
+    uint8_t  reserved1;
+    uint16_t reserved;
+};
+
+typedef struct idhot idhot_t;
+
+/*
+ * Cold part: descriptive metadata, only needed for debug or trace
+ * output, and for building compiled images.
+ */
+struct idcold {
+    symnr_t sym;
+    symnr_t standard1;
+    symnr_t standard2;
+    symnr_t man_sect;
+    symnr_t man_path;
+    symnr_t declare;
+};
+
+typedef struct idcold idcold_t;
+
+/*
+ * The identifier tables.
+ *
+ * The id_table is a struct of two arrays, id_hot and id_cold.
+ * id_hot[pos] and id_cold[pos] describe the identifier whose
+ * symbol number in id_symtable is (pos + 1).  All other strings,
+ * such as header file names and standards, are in strtable.
+ *
+ * When the tables come from a compiled image, id_hot and id_cold point
+ * into read-only mapped memory, and id_table_mapped is true.
+ * The table must be thawed, using id_table_thaw(), before
+ * any entry is modified or added.
+ */
+
+extern dict_t   *id_symtable;
+extern dict_t   *strtable;
+extern idhot_t  *id_hot;
+extern idcold_t *id_cold;
+extern size_t    id_table_sz;
+extern size_t    id_table_len;
+extern bool      id_table_mapped;
+
+extern void id_table_release(void);
+extern void id_table_grow(void);
+extern void id_table_commit(const idinfo_t *ent);
+extern void id_table_thaw(void);
+extern void verify_idtable(void);
+
+/*
+ * The distinct identifiers seen in one source file -- see idset.c.
+ *
+ * An identifier is looked up in two contexts: followed by '(',
+ * where it may be a function, and not.  idnr[IDSET_CALL] and
+ * idnr[IDSET_OTHER] hold the result of looking it up in each context.
+ * The bit for a context is set in |resolved| as soon as the lookup
+ * is queued; the scanner looks identifiers up in batches.
+ */
+
+enum idset_context {
+    IDSET_OTHER = 0,
+    IDSET_CALL  = 1,
+};
+
+struct idset_ent {
+    uint64_t h;             // dict_hash() of the identifier
+    uint32_t str;           // Offset of the identifier in strs
+    uint32_t len;
+    index_t  idnr[2];       // [enum idset_context]
+    uint8_t  resolved;      // Bit (1 << context) for each idnr[] set
+};
+
+typedef struct idset_ent idset_ent_t;
+
+struct idset {
+    idset_ent_t *ents;      // [ents_sz] Entries, in order of arrival
+    size_t ents_sz;
+    size_t len;
+    uint32_t *tbl;          // [cap] Entry number + 1, or 0 if free
+    size_t cap;             // A power of 2
+    char *strs;
+    size_t strs_sz;
+    size_t strs_len;
+};
+
+typedef struct idset idset_t;
+
+extern void   idset_init(idset_t *set);
+extern void   idset_free(idset_t *set);
+extern void   idset_reset(idset_t *set);
+extern size_t idset_upsert(idset_t *set, const char *s, size_t len,
+                           uint64_t h);
+
+/*
+ * Entries are numbered, and never move, as far as the caller
+ * is concerned, so an entry number stays good while the set grows.
+ * Pointers from idset_ent() and idset_str() do not.
+ */
+static inline idset_ent_t *
+idset_ent(idset_t *set, size_t entnr)
+{
+    return (set->ents + entnr);
+}
+
+static inline const char *
+idset_str(const idset_t *set, const idset_ent_t *ent)
+{
+    return (set->strs + ent->str);
+}
+
+/*
+ * A recognizer classifies an identifier, |s|, of length |len|,
+ * without looking at any table.  It returns the index of |s|
+ * in the array of names it was installed with, or -1.
+ *
+ * The built-in id-table comes with a generated recognizer for its
+ * keywords and the most common library identifiers.  What each name
+ * means is looked up once, by freeze_id_tables(), in the tables
+ * as they are finally layered.
+ */
+typedef int (*id_recognizer_t)(const char *s, size_t len);
+
+extern void set_id_recognizer(id_recognizer_t fn, const char *const *namev,
+                              size_t n);
+
+// Compiled, mmap-able id-table images -- see id-image.c
+
+extern bool  id_table_image_probe(FILE *f);
+extern int   read_id_table_image(FILE *f, const char *fname);
+extern char *build_id_table_image(size_t *rsz);
+extern int   load_id_table_image(const char *img, size_t sz,
+                 const char *fname, bool trusted, bool *rin_place);
 
 #endif /* INCBOT_IMPL_H */
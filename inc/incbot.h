@@ -26,11 +26,54 @@
 #define INCBOT_H 1
 
 #include <cscript.h>
+#include <dict.h>       // dict_stats_t
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+
+/*
+ * Statistics of the filter that id lookups go through first.
+ * A lookup that the filter passes, but that then is not found,
+ * is a false positive.  Lookups are counted only after
+ * set_id_filter_counting(true), and only for the calling thread.
+ */
+struct id_filter_stats {
+    size_t nkey;            // Identifiers in the filter
+    size_t nbytes;          // Size of the filter
+    unsigned int k;         // Bits set per identifier
+    unsigned int bits_per_key;
+    double expected_fpr;    // Computed from how full the filter is
+    size_t nlookup;
+    size_t nreject;         // Rejected by the filter
+    size_t nfalse_pos;      // Passed by the filter, but not found
+};
+
+typedef struct id_filter_stats id_filter_stats_t;
+
+/*
+ * Scanners for source files.  The fused scanner reads a whole file,
+ * and follows each identifier in a trie of the id-table, as it goes.
+ * Both find the same things.
+ */
+enum incbot_lexer {
+    LEXER_STANDARD,
+    LEXER_FUSED,
+};
 
 extern int  read_config_file(const char *path);
 extern void init_tables(void);
 extern int  read_id_table_file(const char *path);
 extern int  read_id_tables(void);
+extern int  read_id_table_builtin(void);
+extern void freeze_id_tables(void);
+extern int  incbot_tables_freeze(void);
+extern void incbot_tables_release(void);
+extern void set_id_filter_bits(unsigned int bits_per_key);
+extern void set_id_filter_counting(bool counting);
+extern void get_id_filter_stats(id_filter_stats_t *stats);
+extern void get_table_dict_stats(dict_stats_t *id_stats,
+                                 dict_stats_t *str_stats);
+extern int  write_id_table_image(const char *path);
+extern void set_incbot_lexer(int lexer);
 extern int  incbot_src_file(const char *fname);
 extern void show_includes(void);
 extern int  trace_identifier(const char *);
@@ -0,0 +1,209 @@
+/*
+ * Filename: src/libcf/ccv.c
+ * Project: cf and incbot
+ * Library: libcf
+ * Brief: Character-class vectors -- ring buffers of super-characters
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * These are apart from the state machine itself, in libcf.c,
+ * so that mk-cf-table-c can run the reference state machine,
+ * cf_next_ref(), without the tables that it generates.
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stdlib.h>
+    // Import free()
+
+#include <errno.h>
+    // Import constant ENODATA
+
+#include <cf.h>
+
+extern void *guard_malloc(size_t sz);
+
+/*
+ *
+ * Below are the functions to manage character-class vectors.
+ *
+ * It has the usual suspects for poor-man's classes in C:
+ *     *_new(), *_init(), *-delete().
+ *
+ * The array is a ring buffer, so it can be treated like a stack,
+ * by cf_next(), which pushes super-characters,
+ * and like a queue with pushback, by a scanner that takes them
+ * off the front, and sometimes puts one back.
+ *
+ * So, we have *_push(), *_top(), *_pop(), and *_empty() functions,
+ * and *_pop_front() and *_push_front().
+ *
+ * It starts with room for NLOOKAHEAD super-characters, and doubles
+ * whenever it is full, so a push never fails.
+ *
+ */
+
+#define NLOOKAHEAD 4
+
+void
+ccv_init(ccv_t *ccv)
+{
+    ccv->sz    = NLOOKAHEAD;
+    ccv->len   = 0;
+    ccv->head  = 0;
+    ccv->array = guard_malloc(NLOOKAHEAD * sizeof (ccl_t));
+}
+
+ccv_t *
+ccv_new(void)
+{
+    ccv_t *ccv = guard_malloc(sizeof (ccv_t));
+    ccv_init(ccv);
+    return (ccv);
+}
+
+void
+ccv_delete(ccv_t *ccv)
+{
+    free(ccv->array);
+    free(ccv);
+}
+
+/*
+ * Double the capacity, and straighten out the ring,
+ * so that the front is at array[0].
+ */
+static void
+ccv_grow(ccv_t *ccv)
+{
+    size_t sz = ccv->sz * 2;
+    ccl_t *array = guard_malloc(sz * sizeof (ccl_t));
+    size_t i;
+
+    for (i = 0; i < ccv->len; ++i) {
+        array[i] = *ccv_at(ccv, i);
+    }
+    free(ccv->array);
+    ccv->array = array;
+    ccv->sz = sz;
+    ccv->head = 0;
+}
+
+int
+ccv_push(ccv_t *ccv, int chr, int cclass)
+{
+    ccl_t *ent;
+
+    if (ccv->len == ccv->sz) {
+        ccv_grow(ccv);
+    }
+
+    ent = ccv_at(ccv, ccv->len);
+    ent->chr = chr;
+    ent->ccl = cclass;
+    ++ccv->len;
+    return (0);
+}
+
+int
+ccv_top(ccv_t *ccv, int *rchr, int *rccl)
+{
+    const ccl_t *ent;
+
+    if (ccv->len == 0) {
+        *rchr = 0;
+        *rccl = 0;
+        return (ENODATA);
+    }
+    ent = ccv_at(ccv, ccv->len - 1);
+    *rchr = ent->chr;
+    *rccl = ent->ccl;
+    return (0);
+}
+
+int
+ccv_pop(ccv_t *ccv, int *rchr, int *rccl)
+{
+    const ccl_t *ent;
+
+    if (ccv->len == 0) {
+        *rchr = 0;
+        *rccl = 0;
+        return (ENODATA);
+    }
+    --ccv->len;
+    ent = ccv_at(ccv, ccv->len);
+    *rchr = ent->chr;
+    *rccl = ent->ccl;
+    return (0);
+}
+
+/*
+ * Put a super-character back, in front of all the others.
+ */
+int
+ccv_push_front(ccv_t *ccv, int chr, int cclass)
+{
+    ccl_t *ent;
+
+    if (ccv->len == ccv->sz) {
+        ccv_grow(ccv);
+    }
+
+    ccv->head = (ccv->head - 1) & (ccv->sz - 1);
+    ++ccv->len;
+    ent = ccv_at(ccv, 0);
+    ent->chr = chr;
+    ent->ccl = cclass;
+    return (0);
+}
+
+/*
+ * Take the super-character at the front.
+ */
+int
+ccv_pop_front(ccv_t *ccv, int *rchr, int *rccl)
+{
+    const ccl_t *ent;
+
+    if (ccv->len == 0) {
+        *rchr = 0;
+        *rccl = 0;
+        return (ENODATA);
+    }
+    ent = ccv_at(ccv, 0);
+    *rchr = ent->chr;
+    *rccl = ent->ccl;
+    ccv->head = (ccv->head + 1) & (ccv->sz - 1);
+    --ccv->len;
+    return (0);
+}
+
+bool
+ccv_empty(ccv_t *ccv)
+{
+    return (ccv->len == 0);
+}
+
+void
+ccv_clear(ccv_t *ccv)
+{
+    ccv->len  = 0;
+    ccv->head = 0;
+}
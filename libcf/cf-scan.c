@@ -0,0 +1,876 @@
+/*
+ * Filename: src/libcf/cf-scan.c
+ * Project: cf and incbot
+ * Library: libcf
+ * Brief: Run the libcf state machine over a whole block, reporting spans
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * cf_scan_block() does what calling cf_next() on each byte of a block
+ * would do, but instead of super-characters, it reports spans:
+ * maximal runs of bytes of the same character class.
+ *
+ * Most of the work is finding the next byte that can change the state.
+ * In code, that is a quote or a slash; in a string, a quote or
+ * a backslash; in a comment, a star or a newline.  Everything up to
+ * that byte is one span, and is not looked at again.
+ *
+ * Each byte gets exactly the class cf_next() would give it:
+ *   - The quotes around a string or character literal are OUTER,
+ *     and everything between them, escapes included, is INNER.
+ *   - The slash-star or "//" that starts a comment is OUTER; the rest of it,
+ *     including the closing star-slash, or the newline that ends
+ *     a // comment, is INNER.
+ *   - A '/' that does not start a comment is code, and so is the byte
+ *     after it, whatever it is; even a quote.
+ *
+ * A '/' at the very end of a block is held until the next block,
+ * or cf_scan_end(), says what it is.  That is the only lookahead.
+ *
+ * Finding the next byte of interest is the only part that looks
+ * at every byte, so that part comes in several versions: plain C;
+ * SSE2, 64 bytes at a time, in four registers; and AVX2, 64 bytes
+ * at a time, in two.  The vector versions compare a run of bytes
+ * against each of the bytes of interest at once, make a bit mask
+ * of the matches, and take the lowest set bit.  The best one that
+ * the CPU can run is picked the first time it is needed, unless
+ * one was chosen with cf_scan_set_impl().  All of them find the same
+ * bytes, so the state machine steps through the same positions.
+ *
+ * There is also a version that does not skip: CF_SCAN_TABLE runs
+ * the transition table generated from the rules in mk-cf-table-c.c,
+ * the same table that cf_next() runs, over every byte, with no branches
+ * on the data; see cf_classify().  It costs the same whatever the input,
+ * which the others do not; they are faster on most source code.
+ *
+ * With cf_scan_set_verify(true), each block is also fed through
+ * cf_next_ref(), the hand-written state machine that the tables are
+ * checked against, one byte at a time, and the class of every byte is
+ * compared with the spans.
+ */
+
+#include <errno.h>
+    // Import constant ENOTRECOVERABLE
+    // Import constant ENOTSUP
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdio.h>
+    // Import constant EOF
+    // Import fprintf()
+    // Import var stderr
+#include <string.h>
+    // Import strcmp()
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CF_SCAN_X86 1
+#include <immintrin.h>
+    // Import SSE2 and AVX2 intrinsics
+#endif
+
+#include <cf.h>
+#include <cf-impl.h>
+
+extern void *guard_realloc(void *ptr, size_t sz);
+
+/*
+ * A span that is still growing.  Adjacent runs of the same class
+ * are joined, and reported only when a run of another class starts,
+ * or at the end of the block.
+ */
+struct span_out {
+    cf_span_t cur;
+    cf_span_fn_t *fn;
+    void *arg;
+};
+
+typedef struct span_out span_out_t;
+
+static inline int
+span_add(span_out_t *out, size_t off, size_t len, int ccl)
+{
+    int rv;
+
+    if (len == 0) {
+        return (0);
+    }
+    if (out->cur.len != 0) {
+        if (out->cur.ccl == ccl && out->cur.off + out->cur.len == off) {
+            out->cur.len += len;
+            return (0);
+        }
+        rv = out->fn(out->arg, &out->cur);
+        if (rv != 0) {
+            out->cur.len = 0;
+            return (rv);
+        }
+    }
+    out->cur.off = off;
+    out->cur.len = len;
+    out->cur.ccl = ccl;
+    return (0);
+}
+
+static inline int
+span_flush(span_out_t *out)
+{
+    int rv = 0;
+
+    if (out->cur.len != 0) {
+        rv = out->fn(out->arg, &out->cur);
+        out->cur.len = 0;
+    }
+    return (rv);
+}
+
+// ========== Section: finding bytes of interest ==========
+
+/*
+ * Each finder returns the index of the first byte in buf[pos, len)
+ * that is |c1|, |c2|, or |c3|, or |len| if there is none.
+ * To look for fewer than three bytes, repeat one.
+ */
+typedef size_t find_fn_t(const unsigned char *buf, size_t pos, size_t len,
+                         int c1, int c2, int c3);
+
+static size_t
+find_scalar(const unsigned char *buf, size_t pos, size_t len,
+    int c1, int c2, int c3)
+{
+    while (pos < len && buf[pos] != c1 && buf[pos] != c2 && buf[pos] != c3) {
+        ++pos;
+    }
+    return (pos);
+}
+
+#ifdef CF_SCAN_X86
+
+__attribute__((target("sse2")))
+static inline uint32_t
+mask16_sse2(const unsigned char *p, __m128i v1, __m128i v2, __m128i v3)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v1),
+                                          _mm_cmpeq_epi8(x, v2)),
+                             _mm_cmpeq_epi8(x, v3));
+
+    return ((uint32_t)_mm_movemask_epi8(m));
+}
+
+__attribute__((target("sse2")))
+static size_t
+find_sse2(const unsigned char *buf, size_t pos, size_t len,
+    int c1, int c2, int c3)
+{
+    __m128i v1 = _mm_set1_epi8((char)c1);
+    __m128i v2 = _mm_set1_epi8((char)c2);
+    __m128i v3 = _mm_set1_epi8((char)c3);
+
+    while (pos + 64 <= len) {
+        const unsigned char *p = buf + pos;
+        uint64_t mask;
+
+        mask = (uint64_t)mask16_sse2(p, v1, v2, v3)
+            | (uint64_t)mask16_sse2(p + 16, v1, v2, v3) << 16
+            | (uint64_t)mask16_sse2(p + 32, v1, v2, v3) << 32
+            | (uint64_t)mask16_sse2(p + 48, v1, v2, v3) << 48;
+        if (mask != 0) {
+            return (pos + (size_t)__builtin_ctzll(mask));
+        }
+        pos += 64;
+    }
+    while (pos + 16 <= len) {
+        uint32_t mask = mask16_sse2(buf + pos, v1, v2, v3);
+
+        if (mask != 0) {
+            return (pos + (size_t)__builtin_ctz(mask));
+        }
+        pos += 16;
+    }
+    return (find_scalar(buf, pos, len, c1, c2, c3));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t
+mask32_avx2(const unsigned char *p, __m256i v1, __m256i v2, __m256i v3)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, v1),
+                                                _mm256_cmpeq_epi8(x, v2)),
+                                _mm256_cmpeq_epi8(x, v3));
+
+    return ((uint32_t)_mm256_movemask_epi8(m));
+}
+
+__attribute__((target("avx2")))
+static size_t
+find_avx2(const unsigned char *buf, size_t pos, size_t len,
+    int c1, int c2, int c3)
+{
+    __m256i v1 = _mm256_set1_epi8((char)c1);
+    __m256i v2 = _mm256_set1_epi8((char)c2);
+    __m256i v3 = _mm256_set1_epi8((char)c3);
+
+    while (pos + 64 <= len) {
+        const unsigned char *p = buf + pos;
+        uint64_t mask;
+
+        mask = (uint64_t)mask32_avx2(p, v1, v2, v3)
+            | (uint64_t)mask32_avx2(p + 32, v1, v2, v3) << 32;
+        if (mask != 0) {
+            return (pos + (size_t)__builtin_ctzll(mask));
+        }
+        pos += 64;
+    }
+    if (pos + 32 <= len) {
+        uint32_t mask = mask32_avx2(buf + pos, v1, v2, v3);
+
+        if (mask != 0) {
+            return (pos + (size_t)__builtin_ctz(mask));
+        }
+        pos += 32;
+    }
+    return (find_sse2(buf, pos, len, c1, c2, c3));
+}
+
+#endif /* CF_SCAN_X86 */
+
+// ========== Section: the state machine ==========
+
+static find_fn_t *find_any;
+
+/*
+ * cf_scan_block() by way of |find_any|: step the state machine
+ * only at the bytes that can change the state.
+ */
+static int
+scan_block_find(cf_t *ctx, const char *buf, size_t len,
+    cf_span_fn_t *fn, void *arg)
+{
+    const unsigned char *ubuf = (const unsigned char *)buf;
+    find_fn_t *find = find_any;
+    size_t base = ctx->pos;
+    int state = ctx->state;
+    span_out_t out;
+    size_t i;
+    size_t j;
+    int rv;
+
+    if (state == S_EOF) {
+        return (0);
+    }
+
+    out.cur.len = 0;
+    out.fn = fn;
+    out.arg = arg;
+    rv = 0;
+    i = 0;
+    while (i < len && rv == 0) {
+        int chr;
+
+        switch (state) {
+        case S_START:
+            j = find(ubuf, i, len, '"', '\'', '/');
+            rv = span_add(&out, base + i, j - i, CC_CODE);
+            i = j;
+            if (i == len || rv != 0) {
+                break;
+            }
+            chr = ubuf[i];
+            if (chr == '"') {
+                rv = span_add(&out, base + i, 1, CC_OUTER_STRING);
+                state = S_START_DQUOTE;
+            }
+            else if (chr == '\'') {
+                rv = span_add(&out, base + i, 1, CC_OUTER_CHAR);
+                state = S_START_SQUOTE;
+            }
+            else {
+                // Could be the start of a comment, or a divide.
+                state = S_START_SLASH;
+            }
+            ++i;
+            break;
+
+        case S_START_SLASH:
+            // The '/' is the byte just before this one,
+            // possibly at the end of the previous block.
+            //
+            chr = ubuf[i];
+            if (chr == '/' || chr == '*') {
+                rv = span_add(&out, base + i - 1, 2, CC_OUTER_COMMENT);
+                state = chr == '/' ? S_COMMENT_EOL : S_SLASH_STAR;
+            }
+            else {
+                rv = span_add(&out, base + i - 1, 2, CC_CODE);
+                state = S_START;
+            }
+            ++i;
+            break;
+
+        case S_START_DQUOTE:
+            j = find(ubuf, i, len, '"', '\\', '\\');
+            rv = span_add(&out, base + i, j - i, CC_INNER_STRING);
+            i = j;
+            if (i == len || rv != 0) {
+                break;
+            }
+            if (ubuf[i] == '\\') {
+                rv = span_add(&out, base + i, 1, CC_INNER_STRING);
+                state = S_DQUOTE_ESCAPE;
+            }
+            else {
+                rv = span_add(&out, base + i, 1, CC_OUTER_STRING);
+                state = S_START;
+            }
+            ++i;
+            break;
+
+        case S_DQUOTE_ESCAPE:
+            rv = span_add(&out, base + i, 1, CC_INNER_STRING);
+            state = S_START_DQUOTE;
+            ++i;
+            break;
+
+        case S_START_SQUOTE:
+            j = find(ubuf, i, len, '\'', '\\', '\\');
+            rv = span_add(&out, base + i, j - i, CC_INNER_CHAR);
+            i = j;
+            if (i == len || rv != 0) {
+                break;
+            }
+            if (ubuf[i] == '\\') {
+                rv = span_add(&out, base + i, 1, CC_INNER_CHAR);
+                state = S_SQUOTE_ESCAPE;
+            }
+            else {
+                rv = span_add(&out, base + i, 1, CC_OUTER_CHAR);
+                state = S_START;
+            }
+            ++i;
+            break;
+
+        case S_SQUOTE_ESCAPE:
+            rv = span_add(&out, base + i, 1, CC_INNER_CHAR);
+            state = S_START_SQUOTE;
+            ++i;
+            break;
+
+        case S_SLASH_STAR:
+            j = find(ubuf, i, len, '*', '*', '*');
+            if (j < len) {
+                ++j;
+                state = S_SLASH_STAR_STAR;
+            }
+            rv = span_add(&out, base + i, j - i, CC_INNER_COMMENT);
+            i = j;
+            break;
+
+        case S_SLASH_STAR_STAR:
+            chr = ubuf[i];
+            rv = span_add(&out, base + i, 1, CC_INNER_COMMENT);
+            if (chr == '/') {
+                state = S_START;
+            }
+            else if (chr != '*') {
+                state = S_SLASH_STAR;
+            }
+            ++i;
+            break;
+
+        case S_COMMENT_EOL:
+            j = find(ubuf, i, len, '\n', '\n', '\n');
+            if (j < len) {
+                ++j;
+                state = S_START;
+            }
+            rv = span_add(&out, base + i, j - i, CC_INNER_COMMENT);
+            i = j;
+            break;
+
+        default:
+            ctx->err = ENOTRECOVERABLE;
+            return (-ctx->err);
+        }
+    }
+
+    if (rv == 0) {
+        rv = span_flush(&out);
+    }
+    ctx->state = state;
+    ctx->cclass = cf_state_cclass[state];
+    ctx->pos = base + len;
+    return (rv);
+}
+
+// ========== Section: the table engine ==========
+
+/*
+ * Classify each of the |len| bytes of |buf| by running the generated
+ * transition table, with no branches that depend on the bytes:
+ * classv[i + 1] gets the class of buf[i].  classv[0] gets the class
+ * of a '/' held from the block before, if there was one.
+ * A '/' still held at the end of this block is left CC_UNDEF.
+ * |classv| has room for |len| + 1 entries.
+ *
+ * Each step is two table lookups and two stores.  When a step settles
+ * a held '/', the first store goes to the entry before; otherwise
+ * both go to the same entry.
+ */
+void
+cf_classify(cf_t *ctx, const char *buf, size_t len, uint16_t *classv)
+{
+    const unsigned char *ubuf = (const unsigned char *)buf;
+    unsigned int state = ctx->state;
+    size_t i;
+
+    classv[0] = CC_UNDEF;
+    if (state == S_EOF) {
+        for (i = 0; i < len; ++i) {
+            classv[i + 1] = CC_EOF;
+        }
+        return;
+    }
+
+    for (i = 0; i < len; ++i) {
+        const cf_trans_t *t = &cf_trans[state][cf_byte_class[ubuf[i]]];
+
+        classv[i + 1 - (t->nemit >> 1)] = t->ccl;
+        classv[i + 1] = t->ccl;
+        state = t->next;
+    }
+    ctx->state = state;
+    ctx->cclass = cf_state_cclass[state];
+    ctx->pos += len;
+}
+
+/*
+ * cf_classify() on |n| streams at once, one block of |len| bytes each.
+ *
+ * Each step of one stream waits on the table lookup of the step
+ * before it.  Steps of different streams do not wait on each other,
+ * so interleaving up to CF_CLASSIFY_NSTREAM of them in one loop
+ * gives the CPU something to do while it waits.
+ */
+void
+cf_classify_multi(cf_t **ctxv, const char **bufv, size_t len,
+    uint16_t **classvv, size_t n)
+{
+    size_t first;
+
+    for (first = 0; first < n; first += CF_CLASSIFY_NSTREAM) {
+        const unsigned char *ubufv[CF_CLASSIFY_NSTREAM];
+        uint16_t *classv[CF_CLASSIFY_NSTREAM];
+        unsigned int statev[CF_CLASSIFY_NSTREAM];
+        cf_t *ctxk[CF_CLASSIFY_NSTREAM];
+        size_t nk;
+        size_t k;
+        size_t i;
+
+        // Streams already at EOF have nothing to interleave.
+        //
+        nk = 0;
+        for (k = first; k < n && k < first + CF_CLASSIFY_NSTREAM; ++k) {
+            if (ctxv[k]->state == S_EOF) {
+                cf_classify(ctxv[k], bufv[k], len, classvv[k]);
+                continue;
+            }
+            ctxk[nk] = ctxv[k];
+            ubufv[nk] = (const unsigned char *)bufv[k];
+            classv[nk] = classvv[k];
+            statev[nk] = ctxv[k]->state;
+            classv[nk][0] = CC_UNDEF;
+            ++nk;
+        }
+
+        for (i = 0; i < len; ++i) {
+            for (k = 0; k < nk; ++k) {
+                const cf_trans_t *t =
+                    &cf_trans[statev[k]][cf_byte_class[ubufv[k][i]]];
+
+                classv[k][i + 1 - (t->nemit >> 1)] = t->ccl;
+                classv[k][i + 1] = t->ccl;
+                statev[k] = t->next;
+            }
+        }
+
+        for (k = 0; k < nk; ++k) {
+            ctxk[k]->state = statev[k];
+            ctxk[k]->cclass = cf_state_cclass[statev[k]];
+            ctxk[k]->pos += len;
+        }
+    }
+}
+
+#define TABLE_CHUNK 4096
+
+/*
+ * cf_scan_block() by way of cf_classify(), a chunk at a time,
+ * turning runs of the same class into spans.  It looks at every byte,
+ * so it does not depend on how far apart the bytes of interest are.
+ */
+static int
+scan_block_table(cf_t *ctx, const char *buf, size_t len,
+    cf_span_fn_t *fn, void *arg)
+{
+    uint16_t classv[TABLE_CHUNK + 1];
+    span_out_t out;
+    size_t done;
+    size_t n;
+    int rv;
+
+    if (ctx->state == S_EOF) {
+        return (0);
+    }
+
+    out.cur.len = 0;
+    out.fn = fn;
+    out.arg = arg;
+    rv = 0;
+    for (done = 0; done < len && rv == 0; done += n) {
+        // classv[k] is the class of the byte at offset base + k.
+        size_t base = ctx->pos - 1;
+        size_t k;
+        size_t end;
+
+        n = len - done < TABLE_CHUNK ? len - done : TABLE_CHUNK;
+        k = ctx->state == S_START_SLASH ? 0 : 1;
+        cf_classify(ctx, buf + done, n, classv);
+        end = n + 1 - (ctx->state == S_START_SLASH ? 1 : 0);
+        while (k < end && rv == 0) {
+            size_t j = k + 1;
+
+            while (j < end && classv[j] == classv[k]) {
+                ++j;
+            }
+            rv = span_add(&out, base + k, j - k, classv[k]);
+            k = j;
+        }
+    }
+
+    if (rv == 0) {
+        rv = span_flush(&out);
+    }
+    return (rv);
+}
+
+// ========== Section: choosing a version ==========
+
+typedef int scan_fn_t(cf_t *ctx, const char *buf, size_t len,
+    cf_span_fn_t *fn, void *arg);
+
+struct scan_impl {
+    const char *name;
+    scan_fn_t *scan;
+    find_fn_t *find;        // For scan_block_find()
+};
+
+static const struct scan_impl scan_implv[] = {
+    [CF_SCAN_AUTO]   = { "auto",   NULL,             NULL },
+    [CF_SCAN_SCALAR] = { "scalar", scan_block_find,  find_scalar },
+#ifdef CF_SCAN_X86
+    [CF_SCAN_SSE2]   = { "sse2",   scan_block_find,  find_sse2 },
+    [CF_SCAN_AVX2]   = { "avx2",   scan_block_find,  find_avx2 },
+#else
+    [CF_SCAN_SSE2]   = { "sse2",   NULL,             NULL },
+    [CF_SCAN_AVX2]   = { "avx2",   NULL,             NULL },
+#endif
+    [CF_SCAN_TABLE]  = { "table",  scan_block_table, NULL },
+};
+
+#define NSCAN_IMPL (sizeof (scan_implv) / sizeof (scan_implv[0]))
+
+/*
+ * What CF_SCAN_AUTO tries, best first.
+ */
+static const int scan_auto_order[] = {
+    CF_SCAN_AVX2, CF_SCAN_SSE2, CF_SCAN_SCALAR,
+};
+
+static int scan_impl = CF_SCAN_AUTO;
+static scan_fn_t *scan_any;
+
+static bool
+scan_impl_supported(int impl)
+{
+    switch (impl) {
+    case CF_SCAN_AUTO:
+    case CF_SCAN_SCALAR:
+    case CF_SCAN_TABLE:
+        return (true);
+#ifdef CF_SCAN_X86
+    case CF_SCAN_SSE2:
+        __builtin_cpu_init();
+        return (__builtin_cpu_supports("sse2"));
+    case CF_SCAN_AVX2:
+        __builtin_cpu_init();
+        return (__builtin_cpu_supports("avx2"));
+#endif
+    }
+    return (false);
+}
+
+static void
+scan_impl_select(void)
+{
+    int impl = scan_impl;
+    size_t i;
+
+    if (impl == CF_SCAN_AUTO) {
+        for (i = 0; !scan_impl_supported(scan_auto_order[i]); ++i) {
+            continue;
+        }
+        impl = scan_auto_order[i];
+    }
+    scan_impl = impl;
+    find_any = scan_implv[impl].find;
+    scan_any = scan_implv[impl].scan;
+}
+
+/*
+ * Choose which version to use: CF_SCAN_AUTO (the best this CPU has),
+ * CF_SCAN_SCALAR, CF_SCAN_SSE2, CF_SCAN_AVX2, or CF_SCAN_TABLE.
+ * Return ENOTSUP if this CPU cannot run it.
+ */
+int
+cf_scan_set_impl(int impl)
+{
+    if (!scan_impl_supported(impl)) {
+        return (ENOTSUP);
+    }
+    scan_impl = impl;
+    scan_impl_select();
+    return (0);
+}
+
+/*
+ * Which version is in use; never CF_SCAN_AUTO.
+ */
+int
+cf_scan_get_impl(void)
+{
+    if (scan_any == NULL) {
+        scan_impl_select();
+    }
+    return (scan_impl);
+}
+
+const char *
+cf_scan_impl_name(int impl)
+{
+    if (impl < 0 || (size_t)impl >= NSCAN_IMPL) {
+        return ("unknown");
+    }
+    return (scan_implv[impl].name);
+}
+
+/*
+ * Return the implementation called |name|, or -1.
+ */
+int
+cf_scan_impl_by_name(const char *name)
+{
+    size_t impl;
+
+    for (impl = 0; impl < NSCAN_IMPL; ++impl) {
+        if (strcmp(name, scan_implv[impl].name) == 0) {
+            return ((int)impl);
+        }
+    }
+    return (-1);
+}
+
+// ========== Section: verification ==========
+
+static bool scan_verify;
+static cf_scan_verify_stats_t verify_stats;
+
+/*
+ * The spans of one block, kept for checking.
+ */
+static cf_span_t *verify_spanv;
+static size_t verify_span_len;
+static size_t verify_span_sz;
+
+static int
+keep_span(void *arg, const cf_span_t *span)
+{
+    (void)arg;
+    if (verify_span_len == verify_span_sz) {
+        verify_span_sz = verify_span_sz ? verify_span_sz * 2 : 256;
+        verify_spanv = (cf_span_t *)
+            guard_realloc(verify_spanv, verify_span_sz * sizeof (cf_span_t));
+    }
+    verify_spanv[verify_span_len++] = *span;
+    return (0);
+}
+
+static void
+verify_mismatch(size_t off, int want, int got)
+{
+    ++verify_stats.nmismatch;
+    if (verify_stats.nmismatch <= 10) {
+        fprintf(stderr, "cf-scan-verify: offset %zu: cf_next_ref() says %s, "
+            "%s scan says %s\n", off, decode_cclass(want),
+            cf_scan_impl_name(scan_impl), decode_cclass(got));
+    }
+}
+
+/*
+ * Scan the block, keeping the spans.  Then feed the same bytes,
+ * from the same starting state, through cf_next_ref(), and check
+ * that every super-character it returns has the class that
+ * the spans say it should.  Then pass the spans on to |fn|.
+ */
+static int
+scan_block_verify(cf_t *ctx, const char *buf, size_t len,
+    cf_span_fn_t *fn, void *arg)
+{
+    cf_t shadow = *ctx;
+    ccv_t *ccv;
+    size_t off;
+    size_t spannr;
+    size_t i;
+    int rv;
+
+    if (ctx->state == S_EOF) {
+        return (0);
+    }
+
+    verify_span_len = 0;
+    rv = scan_any(ctx, buf, len, keep_span, NULL);
+    if (rv != 0) {
+        return (rv);
+    }
+
+    ccv = ccv_new();
+    off = shadow.pos - (shadow.state == S_START_SLASH ? 1 : 0);
+    spannr = 0;
+    for (i = 0; i < len; ++i) {
+        size_t k;
+
+        ccv_clear(ccv);
+        cf_next_ref(&shadow, ccv, (unsigned char)buf[i]);
+        for (k = 0; k < ccv->len; ++k) {
+            const cf_span_t *span;
+            int got;
+
+            while (spannr < verify_span_len
+                   && verify_spanv[spannr].off + verify_spanv[spannr].len
+                      <= off) {
+                ++spannr;
+            }
+            span = verify_spanv + spannr;
+            got = spannr < verify_span_len && span->off <= off
+                ? span->ccl : CC_UNDEF;
+            if (got != ccv_at(ccv, k)->ccl) {
+                verify_mismatch(off, ccv_at(ccv, k)->ccl, got);
+            }
+            ++off;
+        }
+    }
+    ccv_delete(ccv);
+    verify_stats.nbyte += len;
+
+    // Anything that cf_next_ref() has not said anything about yet
+    // can only be a '/' that is being held, and then both
+    // must be holding it.
+    //
+    if (shadow.state != ctx->state
+        || off + (ctx->state == S_START_SLASH ? 1 : 0) != ctx->pos) {
+        verify_mismatch(off, shadow.cclass, ctx->cclass);
+    }
+
+    for (i = 0; i < verify_span_len; ++i) {
+        rv = fn(arg, verify_spanv + i);
+        if (rv != 0) {
+            return (rv);
+        }
+    }
+    return (0);
+}
+
+/*
+ * Turn verification against cf_next_ref() on or off.
+ */
+void
+cf_scan_set_verify(bool verify)
+{
+    scan_verify = verify;
+}
+
+void
+cf_scan_get_verify_stats(cf_scan_verify_stats_t *rstats)
+{
+    *rstats = verify_stats;
+}
+
+// ========== Section: interface ==========
+
+/*
+ * Run the state machine of |ctx| over the |len| bytes of |buf|,
+ * which follow the bytes of any earlier blocks, and call |fn|
+ * for each span found.  Span offsets count from the start of the
+ * first block.  A run that crosses from one block into the next
+ * is reported as two spans.
+ *
+ * Return 0, or whatever non-zero value |fn| returned, in which case
+ * the scan stopped early, and |ctx| is no longer of any use.
+ */
+int
+cf_scan_block(cf_t *ctx, const char *buf, size_t len,
+    cf_span_fn_t *fn, void *arg)
+{
+    if (scan_any == NULL) {
+        scan_impl_select();
+    }
+    if (scan_verify) {
+        return (scan_block_verify(ctx, buf, len, fn, arg));
+    }
+    return (scan_any(ctx, buf, len, fn, arg));
+}
+
+/*
+ * There are no more blocks.  Report the '/' that might still be held,
+ * as code, and put |ctx| in the EOF state.
+ *
+ * cf_next() drops a '/' at the very end of its input;
+ * there is no reason to do that here.
+ */
+int
+cf_scan_end(cf_t *ctx, cf_span_fn_t *fn, void *arg)
+{
+    int rv = 0;
+
+    if (ctx->state == S_START_SLASH) {
+        cf_span_t span;
+
+        span.off = ctx->pos - 1;
+        span.len = 1;
+        span.ccl = CC_CODE;
+        rv = fn(arg, &span);
+    }
+    ctx->state = S_EOF;
+    ctx->cclass = CC_EOF;
+    return (rv);
+}
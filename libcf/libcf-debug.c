@@ -23,9 +23,19 @@
 
 #include <stdarg.h>
     // Import sprintf()
+#include <stdbool.h>
+    // Import constant false
+    // Import constant true
 #include <stdio.h>
     // Import constant EOF
+    // Import fprintf()
     // Import sprintf()
+    // Import var stderr
+#include <stdlib.h>
+    // Import abort()
+
+#include <errno.h>
+    // Import constant ENOTRECOVERABLE
 
 #include <cf.h>
 #include <cf-impl.h>
@@ -76,3 +86,191 @@ decode_state(int state)
     }
     return (state_str);
 }
+
+/*
+ * The libcf state machine, written out by hand, one case at a time.
+ *
+ * This is what cf_next() was, before it ran off the tables that
+ * mk-cf-table-c generates.  It is kept, as an independent reference,
+ * so that the tables, and everything that runs off them, can be
+ * checked against something that is not derived from them:
+ * mk-cf-table-c checks every (state, byte) pair of the tables
+ * against it, and cf_scan_set_verify() checks cf_scan_block() against it.
+ * It is not meant to be fast.
+ */
+int
+cf_next_ref(cf_t *ctx, ccv_t *rccv, int chr)
+{
+    int next_state;
+    int next_cclass;
+    bool lookahead = false;
+
+    if (ctx->state == S_EOF || chr == EOF) {
+        int rv;
+        int chr;
+        int ccl;
+
+        if (ccv_empty(rccv)) {
+            ccl = CC_CODE;
+            chr = 0;
+        }
+        else {
+            rv = ccv_top(rccv, &chr, &ccl);
+            if (rv) {
+                fprintf(stderr, "Error: ccv_top() failed.\n");
+                ctx->err = ENOTRECOVERABLE;
+            }
+        }
+        if (ccl != CC_EOF) {
+            ccv_push(rccv, 0, CC_EOF);
+        }
+        if (chr == EOF && ctx->state != S_START) {
+            fprintf(stderr, "Error: EOF and state==%d (%s)\n",
+                ctx->state, decode_state(ctx->state));
+            ctx->err = ENOTRECOVERABLE;
+        }
+        ctx->state = S_EOF;
+        if (ctx->err) {
+            return (-ctx->err);
+        }
+        return (EOF);
+    }
+
+    next_state  = ctx->state;
+    next_cclass = ctx->cclass;
+    switch (ctx->state) {
+    case S_START:
+        ctx->cclass = CC_CODE;
+        switch (chr) {
+        case '"':
+            ctx->cclass = CC_OUTER_STRING;
+            next_cclass = CC_INNER_STRING;
+            next_state = S_START_DQUOTE;
+            break;
+        case '\'':
+            ctx->cclass = CC_OUTER_CHAR;
+            next_cclass = CC_INNER_CHAR;
+            next_state = S_START_SQUOTE;
+            break;
+        case '/':
+            // Could be start of comment, either /*...*/ or // ... EOL
+            // Or could be division
+            ctx->cclass = CC_UNDEF;
+            next_state = S_START_SLASH;
+            lookahead = true;
+            break;
+        default:
+            // No comment starter and no strings.
+            // So, keep looping in start state.
+            break;
+        }
+        break;
+
+    case S_START_DQUOTE:
+        switch (chr) {
+        case '\\':
+            // Escape character inside dquote-string
+            next_state = S_DQUOTE_ESCAPE;
+            break;
+        case '"':
+            // Close of double-quote string -- " ... "
+            ctx->cclass = CC_OUTER_STRING;
+            next_state = S_START;
+            break;
+        }
+        break;
+
+    case S_DQUOTE_ESCAPE:
+        next_state = S_START_DQUOTE;
+        break;
+
+    case S_START_SQUOTE:
+        // Start of squote-string, that is, a C character literal.
+        switch (chr) {
+        case '\\':
+            next_state = S_SQUOTE_ESCAPE;
+            break;
+        case '\'':
+            // End of squote-string
+            next_state = S_START;
+            if ((ctx->cclass & CC_INNER_CHAR) == 0) {
+                fprintf(stderr, "INTERNAL ERROR.\n");
+                ctx->err = ENOTRECOVERABLE;
+                abort();
+            }
+            ctx->cclass = CC_OUTER_CHAR;
+            break;
+        }
+        break;
+
+    case S_SQUOTE_ESCAPE:
+        next_state = S_START_SQUOTE;
+        break;
+
+    case S_START_SLASH:
+        // Could be start of comment, either /*...*/ or // ... EOL
+        switch (chr) {
+        case '/':
+            ctx->cclass = CC_OUTER_COMMENT;
+            next_cclass = CC_INNER_COMMENT;
+            next_state = S_COMMENT_EOL;
+            break;
+        case '*':
+            ctx->cclass = CC_OUTER_COMMENT;
+            next_cclass = CC_INNER_COMMENT;
+            next_state = S_SLASH_STAR;
+            break;
+        default:
+            ctx->cclass = CC_CODE;
+            next_state = S_START;
+        }
+        ccv_push(rccv, '/', ctx->cclass);
+        break;
+
+    case S_SLASH_STAR:
+        switch (chr) {
+        case '*':
+        // Could be end of comment of the form /* ... */
+        next_state = S_SLASH_STAR_STAR;
+        }
+        break;
+
+    case S_SLASH_STAR_STAR:
+        // Could be end of comment of the form /* ... */
+        switch (chr) {
+        case '/':
+            // Yes, it is the end of a comment.
+            next_state = S_START;
+            break;
+        case '*':
+            // Still can be at end of /* ... *  if we see another '*'
+            // So, stay in this state, until we see the next '/'.
+            break;
+        default:
+            // Not '/' and not '*', so go back to inside comment
+            next_state = S_SLASH_STAR;
+        }
+        break;
+
+    case S_COMMENT_EOL:
+        switch (chr) {
+        case '\n':
+            // End of //-comment
+            next_state = S_START;
+            break;
+        }
+        break;
+    }
+
+    if (!lookahead) {
+        ccv_push(rccv, chr, ctx->cclass);
+    }
+
+    ctx->cclass = next_cclass;
+    ctx->state  = next_state;
+    if (ctx->state == S_START) {
+        ctx->cclass = CC_CODE;
+    }
+
+    return (0);
+}
@@ -73,9 +73,6 @@
     // Import getchar()
     // Import var stderr
     // Import var stdout
-#include <stdlib.h>
-    // Import abort()
-    // Import exit()
 
 #include <errno.h>
     // Import constant ENOTRECOVERABLE
@@ -103,97 +100,6 @@ extern void *guard_malloc(size_t sz);
  */
 
 
-/*
- *
- * Below are the functions to manage character-class vectors.
- *
- * It has the usual suspects for poor-man's classes in C:
- *     *_new(), *_init(), *-delete().
- *
- * They array is treated like a stack.
- * super-characters are pushed.
- *
- * So, we have *_push(), *_top(), *_pop(), and *_empty() functions.
- *
- */
-
-#define NLOOKAHEAD 4
-#define CCV_SIZE(n) (sizeof (ccv_t) + (n) * sizeof (ccl_t))
-
-void
-ccv_init(ccv_t *ccv)
-{
-    ccv->sz  = NLOOKAHEAD;
-    ccv->len = 0;
-}
-
-ccv_t *
-ccv_new(void)
-{
-    ccv_t *ccv = guard_malloc(CCV_SIZE(NLOOKAHEAD));
-    ccv_init(ccv);
-    return (ccv);
-}
-
-void
-ccv_delete(ccv_t *ccv)
-{
-    free(ccv);
-}
-
-int
-ccv_push(ccv_t *ccv, int chr, int cclass)
-{
-    if (ccv->len >= ccv->sz) {
-        return (ENOSPC);
-    }
-
-    ccv->array[ccv->len].chr = chr;
-    ccv->array[ccv->len].ccl = cclass;
-    ++ccv->len;
-    return (0);
-}
-
-int
-ccv_top(ccv_t *ccv, int *rchr, int *rccl)
-{
-    size_t top;
-
-    if (ccv->len == 0) {
-        *rchr = 0;
-        *rccl = 0;
-        return (ENODATA);
-    }
-    top = ccv->len - 1;
-    *rchr = ccv->array[top].chr;
-    *rccl = ccv->array[top].ccl;
-    return (0);
-}
-
-int
-ccv_pop(ccv_t *ccv, int *rchr, int *rccl)
-{
-    size_t top;
-
-    if (ccv->len == 0) {
-        *rchr = 0;
-        *rccl = 0;
-        return (ENODATA);
-    }
-    --ccv->len;
-    top = ccv->len;
-    *rchr = ccv->array[top].chr;
-    *rccl = ccv->array[top].ccl;
-    return (0);
-}
-
-bool
-ccv_empty(ccv_t *ccv)
-{
-    return (ccv->len == 0);
-}
-
-
 /*
  * The context object used to keep track of a libcf state machine
  * is an opaque data type.  You only get to see what is inside
@@ -228,9 +134,7 @@ cf_new(int cclset)
 int
 cf_next(cf_t *ctx, ccv_t *rccv, int chr)
 {
-    int next_state;
-    int next_cclass;
-    bool lookahead = false;
+    const cf_trans_t *t;
 
     if (ctx->state == S_EOF || chr == EOF) {
         int rv;
@@ -263,141 +167,17 @@ cf_next(cf_t *ctx, ccv_t *rccv, int chr)
         return (EOF);
     }
 
-    next_state  = ctx->state;
-    next_cclass = ctx->cclass;
-    switch (ctx->state) {
-    case S_START:
-        ctx->cclass = CC_CODE;
-        switch (chr) {
-        case '"':
-            ctx->cclass = CC_OUTER_STRING;
-            next_cclass = CC_INNER_STRING;
-            next_state = S_START_DQUOTE;
-            break;
-        case '\'':
-            ctx->cclass = CC_OUTER_CHAR;
-            next_cclass = CC_INNER_CHAR;
-            next_state = S_START_SQUOTE;
-            break;
-        case '/':
-            // Could be start of comment, either /*...*/ or // ... EOL
-            // Or could be division
-            ctx->cclass = CC_UNDEF;
-            next_state = S_START_SLASH;
-            lookahead = true;
-            break;
-        default:
-            // No comment starter and no strings.
-            // So, keep looping in start state.
-            break;
-        }
-        break;
-
-    case S_START_DQUOTE:
-        switch (chr) {
-        case '\\':
-            // Escape character inside dquote-string
-            next_state = S_DQUOTE_ESCAPE;
-            break;
-        case '"':
-            // Close of double-quote string -- " ... "
-            ctx->cclass = CC_OUTER_STRING;
-            next_state = S_START;
-            break;
-        }
-        break;
-
-    case S_DQUOTE_ESCAPE:
-        next_state = S_START_DQUOTE;
-        break;
-
-    case S_START_SQUOTE:
-        // Start of squote-string, that is, a C character literal.
-        switch (chr) {
-        case '\\':
-            next_state = S_SQUOTE_ESCAPE;
-            break;
-        case '\'':
-            // End of squote-string
-            next_state = S_START;
-            if ((ctx->cclass & CC_INNER_CHAR) == 0) {
-                fprintf(stderr, "INTERNAL ERROR.\n");
-                ctx->err = ENOTRECOVERABLE;
-                abort();
-            }
-            ctx->cclass = CC_OUTER_CHAR;
-            break;
-        }
-        break;
-
-    case S_SQUOTE_ESCAPE:
-        next_state = S_START_SQUOTE;
-        break;
-
-    case S_START_SLASH:
-        // Could be start of comment, either /*...*/ or // ... EOL
-        switch (chr) {
-        case '/':
-            ctx->cclass = CC_OUTER_COMMENT;
-            next_cclass = CC_INNER_COMMENT;
-            next_state = S_COMMENT_EOL;
-            break;
-        case '*':
-            ctx->cclass = CC_OUTER_COMMENT;
-            next_cclass = CC_INNER_COMMENT;
-            next_state = S_SLASH_STAR;
-            break;
-        default:
-            ctx->cclass = CC_CODE;
-            next_state = S_START;
-        }
-        ccv_push(rccv, '/', ctx->cclass);
-        break;
-
-    case S_SLASH_STAR:
-        switch (chr) {
-        case '*':
-        // Could be end of comment of the form /* ... */
-        next_state = S_SLASH_STAR_STAR;
-        }
-        break;
-
-    case S_SLASH_STAR_STAR:
-        // Could be end of comment of the form /* ... */
-        switch (chr) {
-        case '/':
-            // Yes, it is the end of a comment.
-            next_state = S_START;
-            break;
-        case '*':
-            // Still can be at end of /* ... *  if we see another '*'
-            // So, stay in this state, until we see the next '/'.
-            break;
-        default:
-            // Not '/' and not '*', so go back to inside comment
-            next_state = S_SLASH_STAR;
-        }
-        break;
-
-    case S_COMMENT_EOL:
-        switch (chr) {
-        case '\n':
-            // End of //-comment
-            next_state = S_START;
-            break;
-        }
-        break;
-    }
-
-    if (!lookahead) {
-        ccv_push(rccv, chr, ctx->cclass);
+    // See mk-cf-table-c.c for the rules.
+    //
+    t = &cf_trans[ctx->state][cf_byte_class[(unsigned char)chr]];
+    if (t->nemit == 2) {
+        ccv_push(rccv, '/', t->ccl);
     }
-
-    ctx->cclass = next_cclass;
-    ctx->state  = next_state;
-    if (ctx->state == S_START) {
-        ctx->cclass = CC_CODE;
+    if (t->nemit != 0) {
+        ccv_push(rccv, chr, t->ccl);
     }
+    ctx->state  = t->next;
+    ctx->cclass = cf_state_cclass[t->next];
 
     return (0);
 }
@@ -0,0 +1,372 @@
+/*
+ * Filename: src/libcf/mk-cf-table-c.c
+ * Project: cf and incbot
+ * Library: libcf
+ * Brief: Build-time tool -- generate the libcf transition table
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * usage: mk-cf-table-c <output.c>
+ *
+ * The libcf state machine is described once, here, as a list of rules.
+ * This writes it out as C source code for three tables:
+ *
+ *   cf_byte_class[byte]        which of the few kinds of byte it is;
+ *                              all that the machine ever looks at.
+ *   cf_trans[state][bclass]    next state, class, and how many
+ *                              super-characters come out.
+ *   cf_state_cclass[state]     the class of what comes next, in a state,
+ *                              which is what cf_next() keeps in
+ *                              ctx->cclass.
+ *
+ * cf_next(), cf_scan_block(), and incbot's fused scanner all run
+ * off these tables.  Before writing anything, the rules are checked,
+ * for every state and every byte, against cf_next_ref(), the state
+ * machine written out by hand, which does not depend on them.
+ *
+ * This is not part of libcf.
+ *
+ */
+
+#include <errno.h>      // errno
+#include <stdbool.h>    // bool
+#include <stdio.h>      // FILE, fopen, fprintf, fclose, remove, stderr
+#include <stdlib.h>     // exit
+#include <string.h>     // memset
+
+#include <cf.h>
+#include <cf-impl.h>
+
+#define CF_BC_ANY CF_NBCLASS
+
+struct rule {
+    int state;
+    int bclass;         // CF_BC_ANY: all that have no rule of their own
+    int next;
+    int ccl;
+    int nemit;
+};
+
+typedef struct rule rule_t;
+
+/*
+ * The whole state machine.
+ *
+ * Emit counts:
+ *   0  Nothing yet.  This is the '/' that might start a comment;
+ *      the next byte says which class it is.
+ *   1  This byte, of the given class.
+ *   2  The '/' held from before, then this byte, both of the given class.
+ *
+ * A '/' that does not start a comment is code, and so is the byte
+ * after it, even if it is a quote.  The newline that ends a // comment
+ * is part of the comment.
+ */
+static const rule_t rulev[] = {
+    // state             byte          next               class             emit
+    { S_START,           CF_BC_ANY,    S_START,           CC_CODE,          1 },
+    { S_START,           CF_BC_DQUOTE, S_START_DQUOTE,    CC_OUTER_STRING,  1 },
+    { S_START,           CF_BC_SQUOTE, S_START_SQUOTE,    CC_OUTER_CHAR,    1 },
+    { S_START,           CF_BC_SLASH,  S_START_SLASH,     CC_UNDEF,         0 },
+
+    { S_START_DQUOTE,    CF_BC_ANY,    S_START_DQUOTE,    CC_INNER_STRING,  1 },
+    { S_START_DQUOTE,    CF_BC_BSLASH, S_DQUOTE_ESCAPE,   CC_INNER_STRING,  1 },
+    { S_START_DQUOTE,    CF_BC_DQUOTE, S_START,           CC_OUTER_STRING,  1 },
+    { S_DQUOTE_ESCAPE,   CF_BC_ANY,    S_START_DQUOTE,    CC_INNER_STRING,  1 },
+
+    { S_START_SQUOTE,    CF_BC_ANY,    S_START_SQUOTE,    CC_INNER_CHAR,    1 },
+    { S_START_SQUOTE,    CF_BC_BSLASH, S_SQUOTE_ESCAPE,   CC_INNER_CHAR,    1 },
+    { S_START_SQUOTE,    CF_BC_SQUOTE, S_START,           CC_OUTER_CHAR,    1 },
+    { S_SQUOTE_ESCAPE,   CF_BC_ANY,    S_START_SQUOTE,    CC_INNER_CHAR,    1 },
+
+    { S_START_SLASH,     CF_BC_ANY,    S_START,           CC_CODE,          2 },
+    { S_START_SLASH,     CF_BC_SLASH,  S_COMMENT_EOL,     CC_OUTER_COMMENT, 2 },
+    { S_START_SLASH,     CF_BC_STAR,   S_SLASH_STAR,      CC_OUTER_COMMENT, 2 },
+
+    { S_SLASH_STAR,      CF_BC_ANY,    S_SLASH_STAR,      CC_INNER_COMMENT, 1 },
+    { S_SLASH_STAR,      CF_BC_STAR,   S_SLASH_STAR_STAR, CC_INNER_COMMENT, 1 },
+    { S_SLASH_STAR_STAR, CF_BC_ANY,    S_SLASH_STAR,      CC_INNER_COMMENT, 1 },
+    { S_SLASH_STAR_STAR, CF_BC_STAR,   S_SLASH_STAR_STAR, CC_INNER_COMMENT, 1 },
+    { S_SLASH_STAR_STAR, CF_BC_SLASH,  S_START,           CC_INNER_COMMENT, 1 },
+
+    { S_COMMENT_EOL,     CF_BC_ANY,    S_COMMENT_EOL,     CC_INNER_COMMENT, 1 },
+    { S_COMMENT_EOL,     CF_BC_NL,     S_START,           CC_INNER_COMMENT, 1 },
+
+    // Nothing goes to S_INCHAR.  It behaves like the inside
+    // of a character literal, with no way out.
+    //
+    { S_INCHAR,          CF_BC_ANY,    S_INCHAR,          CC_INNER_CHAR,    1 },
+};
+
+#define NRULES (sizeof (rulev) / sizeof (rulev[0]))
+
+static const char *bclass_name[CF_NBCLASS] = {
+    [CF_BC_OTHER]  = "CF_BC_OTHER",
+    [CF_BC_DQUOTE] = "CF_BC_DQUOTE",
+    [CF_BC_SQUOTE] = "CF_BC_SQUOTE",
+    [CF_BC_SLASH]  = "CF_BC_SLASH",
+    [CF_BC_STAR]   = "CF_BC_STAR",
+    [CF_BC_BSLASH] = "CF_BC_BSLASH",
+    [CF_BC_NL]     = "CF_BC_NL",
+};
+
+static int
+byte_class(int chr)
+{
+    switch (chr) {
+    case '"':  return (CF_BC_DQUOTE);
+    case '\'': return (CF_BC_SQUOTE);
+    case '/':  return (CF_BC_SLASH);
+    case '*':  return (CF_BC_STAR);
+    case '\\': return (CF_BC_BSLASH);
+    case '\n': return (CF_BC_NL);
+    }
+    return (CF_BC_OTHER);
+}
+
+static const char *program_name = "mk-cf-table-c";
+
+// For guard_malloc(), from libcscript.
+FILE *errprint_fh = NULL;
+
+/*
+ * Find the rule for |state| and |bclass|.  Every state must have
+ * a CF_BC_ANY rule, and there must be no more than one rule for
+ * any pair.
+ */
+static const rule_t *
+find_rule(int state, int bclass)
+{
+    const rule_t *dflt = NULL;
+    const rule_t *found = NULL;
+    size_t i;
+
+    for (i = 0; i < NRULES; ++i) {
+        const rule_t *r = rulev + i;
+
+        if (r->state != state) {
+            continue;
+        }
+        if (r->bclass == CF_BC_ANY) {
+            if (dflt != NULL) {
+                fprintf(stderr, "%s: state %s has two default rules.\n",
+                    program_name, decode_state(state));
+                exit(2);
+            }
+            dflt = r;
+        }
+        else if (r->bclass == bclass) {
+            if (found != NULL) {
+                fprintf(stderr, "%s: state %s has two rules for %s.\n",
+                    program_name, decode_state(state), bclass_name[bclass]);
+                exit(2);
+            }
+            found = r;
+        }
+    }
+    if (dflt == NULL) {
+        fprintf(stderr, "%s: state %s has no default rule.\n",
+            program_name, decode_state(state));
+        exit(2);
+    }
+    return (found ? found : dflt);
+}
+
+static const char *
+cclass_name(int ccl)
+{
+    static char buf[32];
+
+    snprintf(buf, sizeof (buf), "CC_%s", decode_cclass(ccl));
+    return (buf);
+}
+
+/*
+ * The class that cf_next() leaves in ctx->cclass in |state|:
+ * what the default rule of |state| gives, if that gives anything
+ * at once.  If not, cf_next() leaves ctx->cclass as it was, so it is
+ * the class of the states that lead to |state|, which must agree.
+ */
+static int
+state_cclass(int state)
+{
+    const rule_t *r = find_rule(state, CF_BC_OTHER);
+    int ccl = CC_UNDEF;
+    size_t i;
+
+    if (r->nemit == 1) {
+        return (r->ccl);
+    }
+    for (i = 0; i < NRULES; ++i) {
+        int from;
+
+        if (rulev[i].next != state || rulev[i].state == state) {
+            continue;
+        }
+        r = find_rule(rulev[i].state, CF_BC_OTHER);
+        if (r->nemit != 1) {
+            fprintf(stderr, "%s: state %s is reached only by way of "
+                "another state that emits nothing.\n",
+                program_name, decode_state(state));
+            exit(2);
+        }
+        from = r->ccl;
+        if (ccl != CC_UNDEF && ccl != from) {
+            fprintf(stderr, "%s: states leading to %s disagree "
+                "about its class.\n", program_name, decode_state(state));
+            exit(2);
+        }
+        ccl = from;
+    }
+    return (ccl);
+}
+
+/*
+ * Check the rules against cf_next_ref(), for every state and every
+ * byte: the same next state, the same super-characters, of the same
+ * class, and the same class left in ctx->cclass.
+ * Return the number of (state, byte) pairs that differ.
+ */
+static size_t
+check_against_ref(void)
+{
+    ccv_t *ccv = ccv_new();
+    size_t nbad = 0;
+    int state;
+    int chr;
+
+    for (state = 0; state < CF_NSTATE; ++state) {
+        for (chr = 0; chr < 256; ++chr) {
+            const rule_t *r = find_rule(state, byte_class(chr));
+            cf_t ctx;
+            bool same;
+            size_t k;
+
+            memset(&ctx, 0, sizeof (ctx));
+            ctx.state = state;
+            ctx.cclass = state_cclass(state);
+            ccv_clear(ccv);
+            cf_next_ref(&ctx, ccv, chr);
+
+            same = ctx.err == 0
+                && ctx.state == r->next
+                && (int)ctx.cclass == state_cclass(r->next)
+                && ccv->len == (size_t)r->nemit;
+            for (k = 0; same && k < ccv->len; ++k) {
+                const ccl_t *cc = ccv_at(ccv, k);
+                int want = (r->nemit == 2 && k == 0) ? '/' : chr;
+
+                same = cc->ccl == r->ccl && cc->chr == want;
+            }
+            if (!same) {
+                fprintf(stderr, "%s: state %s, byte 0x%02x: "
+                    "the rules do not agree with cf_next_ref().\n",
+                    program_name, decode_state(state), chr);
+                ++nbad;
+            }
+        }
+    }
+    ccv_delete(ccv);
+    return (nbad);
+}
+
+static void
+emit_c_source(FILE *f)
+{
+    int state;
+    int bclass;
+    int chr;
+
+    fprintf(f, "/*\n");
+    fprintf(f, " * Generated by %s\n", program_name);
+    fprintf(f, " * Brief: Transition tables for the libcf state machine\n");
+    fprintf(f, " *\n");
+    fprintf(f, " * DO NOT EDIT.  Edit the rules in %s.c, and rebuild.\n",
+        program_name);
+    fprintf(f, " */\n\n");
+    fprintf(f, "#include <stdint.h>\n");
+    fprintf(f, "#include <cf.h>\n");
+    fprintf(f, "#include <cf-impl.h>\n\n");
+
+    fprintf(f, "const uint8_t cf_byte_class[256] = {\n");
+    for (chr = 0; chr < 256; ++chr) {
+        if (chr % 16 == 0) {
+            fputs("   ", f);
+        }
+        fprintf(f, " %d,", byte_class(chr));
+        if (chr % 16 == 15) {
+            fputc('\n', f);
+        }
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "const cf_trans_t cf_trans[CF_NSTATE][CF_NBCLASS] = {\n");
+    for (state = 0; state < CF_NSTATE; ++state) {
+        fprintf(f, "    [S_%s] = {\n", decode_state(state));
+        for (bclass = 0; bclass < CF_NBCLASS; ++bclass) {
+            const rule_t *r = find_rule(state, bclass);
+
+            fprintf(f, "        [%s] = { S_%s, %d, %s },\n",
+                bclass_name[bclass], decode_state(r->next), r->nemit,
+                cclass_name(r->ccl));
+        }
+        fprintf(f, "    },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "const uint16_t cf_state_cclass[CF_NSTATE + 1] = {\n");
+    for (state = 0; state < CF_NSTATE; ++state) {
+        fprintf(f, "    [S_%s] = %s,\n", decode_state(state),
+            cclass_name(state_cclass(state)));
+    }
+    fprintf(f, "    [S_EOF] = CC_EOF,\n");
+    fprintf(f, "};\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+    int rv;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output.c>\n", program_name);
+        exit(1);
+    }
+
+    errprint_fh = stderr;
+    if (check_against_ref() != 0) {
+        exit(2);
+    }
+
+    f = fopen(argv[1], "w");
+    if (f == NULL) {
+        rv = errno;
+        fprintf(stderr, "%s: open('%s', w) failed.\n", program_name, argv[1]);
+        exit(rv);
+    }
+    emit_c_source(f);
+    if (fclose(f) != 0) {
+        rv = errno;
+        fprintf(stderr, "%s: write('%s') failed.\n", program_name, argv[1]);
+        remove(argv[1]);
+        exit(rv);
+    }
+    exit(0);
+}
@@ -0,0 +1,123 @@
+/*
+ * Filename: src/libincbot/bloom.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Blocked Bloom filter over 64-bit hash values
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import free()
+
+#include <cscript.h>
+#include <bloom.h>
+
+/*
+ * Make a filter for about |nkey| keys, at |bits_per_key| bits per key.
+ * The number of bits set per key is the one that minimizes
+ * the false-positive rate, which is bits_per_key * ln(2).
+ */
+bloom_t *
+bloom_new(size_t nkey, unsigned int bits_per_key)
+{
+    bloom_t *bf;
+    size_t nbits;
+    unsigned int k;
+
+    nbits = nkey * bits_per_key;
+    k = (bits_per_key * 693 + 500) / 1000;
+    if (k < 1) {
+        k = 1;
+    }
+    if (k > BLOOM_MAX_K) {
+        k = BLOOM_MAX_K;
+    }
+
+    bf = (bloom_t *) guard_malloc(sizeof (bloom_t));
+    bf->nblock = (nbits + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    if (bf->nblock == 0) {
+        bf->nblock = 1;
+    }
+    bf->bits = (uint64_t *)
+        guard_calloc(bf->nblock * BLOOM_BLOCK_WORDS, sizeof (uint64_t));
+    bf->nkey = 0;
+    bf->k = k;
+    bf->bits_per_key = bits_per_key;
+    return (bf);
+}
+
+void
+bloom_delete(bloom_t *bf)
+{
+    if (bf == NULL) {
+        return;
+    }
+    free(bf->bits);
+    free(bf);
+}
+
+void
+bloom_add(bloom_t *bf, uint64_t h)
+{
+    uint64_t *blk = (uint64_t *)bloom_block(bf, h);
+    uint64_t g = bloom_remix(h);
+    unsigned int i;
+
+    for (i = 0; i < bf->k; ++i) {
+        unsigned int bit = (unsigned int)(g >> (64 - 9 * (i + 1))) & 511;
+
+        blk[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+    ++bf->nkey;
+}
+
+/*
+ * Return the probability that a key that was never added passes
+ * the filter.  That is just the chance that all k of its bits
+ * happen to be set, so it is computed from how full each block
+ * actually is, rather than from a formula for an ideal filter.
+ */
+double
+bloom_expected_fpr(const bloom_t *bf)
+{
+    double sum = 0.0;
+    size_t b;
+
+    for (b = 0; b < bf->nblock; ++b) {
+        const uint64_t *blk = bf->bits + b * BLOOM_BLOCK_WORDS;
+        unsigned int ones = 0;
+        double fill;
+        double p;
+        unsigned int i;
+
+        for (i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+            ones += (unsigned int)__builtin_popcountll(blk[i]);
+        }
+        fill = (double)ones / BLOOM_BLOCK_BITS;
+        p = 1.0;
+        for (i = 0; i < bf->k; ++i) {
+            p *= fill;
+        }
+        sum += p;
+    }
+    return (sum / (double)bf->nblock);
+}
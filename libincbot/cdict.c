@@ -0,0 +1,417 @@
+/*
+ * Filename: src/libincbot/cdict.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Implementation of data type, 'cdict_t', a concurrent dictionary
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See cdict.h for a description of the dictionary.
+ *
+ * Memory ordering:
+ *   Everything about an entry -- its string, its header, and its link
+ *   to the rest of the chain -- is written before the entry is linked
+ *   in, with a release compare-and-swap on the bucket.  Its slot in
+ *   the symbol vector is stored, with release, before its symbol number
+ *   is stored in the entry, with release.  So, a thread that loads
+ *   a bucket or a symbol number with acquire sees all that came before.
+ *
+ * Atomic operations are the GCC __atomic builtins, so that this
+ * compiles as C99, like the rest of the library.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdio.h>
+    // Import fprintf()
+    // Import var stderr
+#include <stdlib.h>
+    // Import abort()
+    // Import free()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+#include <sched.h>
+    // Import sched_yield()
+
+#include <cscript.h>
+#include <dict.h>
+#include <dict-impl.h>
+#include <cdict.h>
+
+#define CDICT_ARENA_SIZE (64 * 1024)
+#define CDICT_MIN_NBKT   1024
+
+/*
+ * A string pool entry is also the link in its hash chain.
+ * The header comes right before the string, as in a dict_t,
+ * so sym_hdr() works on the symbols of a cdict_t, too.
+ */
+struct cdict_entry {
+    struct cdict_entry *next;   // Next in the hash chain
+    uint32_t symnr;             // undef_symnr until finished
+    symhdr_t hdr;
+    char str[];
+};
+
+typedef struct cdict_entry cdict_entry_t;
+
+struct cdict_arena {
+    struct cdict_arena *prev;
+    size_t size;
+    size_t used;                // Can go past size; then the arena is full
+    char mem[];
+};
+
+typedef struct cdict_arena cdict_arena_t;
+
+static inline size_t
+cdict_entry_size(size_t len)
+{
+    size_t a = sizeof (cdict_entry_t *);
+    return ((sizeof (cdict_entry_t) + len + 1 + a - 1) & ~(a - 1));
+}
+
+/*
+ * Which segment holds |symnr|, and where in it.
+ */
+static inline size_t
+cdict_seg(size_t symnr, size_t *roff)
+{
+    size_t q = symnr / dict_segment_size;
+    size_t seg;
+
+    if (q == 0) {
+        *roff = symnr;
+        return (0);
+    }
+    seg = sizeof (unsigned long) * 8 - __builtin_clzl((unsigned long)q);
+    *roff = symnr - (dict_segment_size << (seg - 1));
+    return (seg);
+}
+
+static inline size_t
+cdict_seg_size(size_t seg)
+{
+    return (seg == 0 ? dict_segment_size : dict_segment_size << (seg - 1));
+}
+
+/*
+ * Make a dictionary for about |nsym| symbols.  The hash table never
+ * grows, so |nsym| sets its size for good; more symbols than that
+ * only make for longer chains.
+ */
+cdict_t *
+cdict_new(size_t nsym)
+{
+    cdict_t *cd;
+    size_t nbkt;
+    size_t seg;
+
+    nbkt = CDICT_MIN_NBKT;
+    while (nbkt < nsym) {
+        nbkt *= 2;
+    }
+
+    cd = (cdict_t *) guard_malloc(sizeof (cdict_t));
+    for (seg = 0; seg < CDICT_NSEG; ++seg) {
+        cd->seg[seg] = NULL;
+    }
+    cd->len = 1;                // symnr 0 is undef_symnr
+    cd->bkt = (cdict_entry_t **) guard_calloc(nbkt, sizeof (cdict_entry_t *));
+    cd->nbkt = nbkt;
+    cd->arena = NULL;
+    return (cd);
+}
+
+/*
+ * Free everything.  No other thread may be using |cd|.
+ */
+void
+cdict_delete(cdict_t *cd)
+{
+    cdict_arena_t *arena = (cdict_arena_t *)cd->arena;
+    size_t seg;
+
+    while (arena != NULL) {
+        cdict_arena_t *prev = arena->prev;
+        free(arena);
+        arena = prev;
+    }
+    for (seg = 0; seg < CDICT_NSEG; ++seg) {
+        free(cd->seg[seg]);
+    }
+    free(cd->bkt);
+    free(cd);
+}
+
+/*
+ * Allocate |sz| bytes from the string pool.  Every thread bumps
+ * the same arena.  A thread that finds it full makes a new one,
+ * and tries to install it; if some other thread got there first,
+ * it throws its own away, and tries again in that one.
+ */
+static void *
+cdict_alloc(cdict_t *cd, size_t sz)
+{
+    for (;;) {
+        cdict_arena_t *arena;
+        cdict_arena_t *new_arena;
+        size_t asz;
+        size_t off;
+
+        arena = __atomic_load_n((cdict_arena_t **)&cd->arena,
+                                __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            off = __atomic_fetch_add(&arena->used, sz, __ATOMIC_RELAXED);
+            if (off + sz <= arena->size) {
+                return (arena->mem + off);
+            }
+        }
+
+        asz = sz > CDICT_ARENA_SIZE ? sz : CDICT_ARENA_SIZE;
+        new_arena = (cdict_arena_t *)
+            guard_malloc(sizeof (cdict_arena_t) + asz);
+        new_arena->prev = arena;
+        new_arena->size = asz;
+        new_arena->used = sz;
+        if (__atomic_compare_exchange_n((cdict_arena_t **)&cd->arena,
+                                        &arena, new_arena, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return (new_arena->mem);
+        }
+        free(new_arena);
+    }
+}
+
+/*
+ * Return the slot for |symnr| in the symbol vector,
+ * first allocating its segment, if need be.
+ */
+static char **
+cdict_slot(cdict_t *cd, size_t symnr)
+{
+    char **segv;
+    char **new_segv;
+    size_t seg;
+    size_t off;
+
+    seg = cdict_seg(symnr, &off);
+    segv = __atomic_load_n(&cd->seg[seg], __ATOMIC_ACQUIRE);
+    if (segv != NULL) {
+        return (segv + off);
+    }
+
+    new_segv = (char **) guard_calloc(cdict_seg_size(seg), sizeof (char *));
+    if (__atomic_compare_exchange_n(&cd->seg[seg], &segv, new_segv, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return (new_segv + off);
+    }
+    free(new_segv);
+    return (segv + off);
+}
+
+static inline bool
+entry_match(const cdict_entry_t *e, const char *s, size_t len, uint64_t h)
+{
+    return (e->hdr.h == (uint32_t)h && e->hdr.len == len
+            && memcmp(e->str, s, len) == 0);
+}
+
+/*
+ * Wait for another thread to finish adding entry |e|.
+ * That is a few stores away, so this is rare, and short.
+ */
+static size_t
+entry_symnr_wait(const cdict_entry_t *e)
+{
+    uint32_t symnr;
+
+    while ((symnr = __atomic_load_n(&e->symnr, __ATOMIC_ACQUIRE))
+           == undef_symnr) {
+        sched_yield();
+    }
+    return (symnr);
+}
+
+/*
+ * Search the chain from |e| up to, but not including, |stop|.
+ */
+static const cdict_entry_t *
+chain_find(const cdict_entry_t *e, const cdict_entry_t *stop,
+    const char *s, size_t len, uint64_t h)
+{
+    for (; e != stop; e = e->next) {
+        if (entry_match(e, s, len, h)) {
+            return (e);
+        }
+    }
+    return (NULL);
+}
+
+static inline cdict_entry_t **
+cdict_bucket(cdict_t *cd, uint64_t h)
+{
+    return (cd->bkt + (hash_fold(h) & (cd->nbkt - 1)));
+}
+
+/*
+ * Look up the symbol, |s|, of length |len|, whose dict_hash() value,
+ * |h|, the caller has already computed.  A symbol that some other
+ * thread is still in the middle of adding is not found.
+ */
+size_t
+cdict_find_prehashed(cdict_t *cd, const char *s, size_t len, uint64_t h)
+{
+    const cdict_entry_t *e;
+
+    e = __atomic_load_n(cdict_bucket(cd, h), __ATOMIC_ACQUIRE);
+    e = chain_find(e, NULL, s, len, h);
+    if (e == NULL) {
+        return (undef_symnr);
+    }
+    return (__atomic_load_n(&e->symnr, __ATOMIC_ACQUIRE));
+}
+
+size_t
+cdict_find(cdict_t *cd, const char *s, size_t len)
+{
+    return (cdict_find_prehashed(cd, s, len, dict_hash(s, len)));
+}
+
+/*
+ * Find the symbol, |s|, of length |len|, or add it if it is not there.
+ * Set |*rinserted| to tell whether this call added it.
+ */
+size_t
+cdict_upsert(cdict_t *cd, const char *s, size_t len, bool *rinserted)
+{
+    uint64_t h = dict_hash(s, len);
+    cdict_entry_t **bkt = cdict_bucket(cd, h);
+    cdict_entry_t *head;
+    cdict_entry_t *e;
+    const cdict_entry_t *found;
+    size_t symnr;
+
+    *rinserted = false;
+    head = __atomic_load_n(bkt, __ATOMIC_ACQUIRE);
+    found = chain_find(head, NULL, s, len, h);
+    if (found != NULL) {
+        return (entry_symnr_wait(found));
+    }
+
+    e = (cdict_entry_t *) cdict_alloc(cd, cdict_entry_size(len));
+    e->symnr = undef_symnr;
+    e->hdr.h = (uint32_t)h;
+    e->hdr.len = (uint32_t)len;
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+
+    // If the bucket changed under us, only the entries in front of
+    // the old head are new, and only they need to be searched.
+    //
+    for (;;) {
+        cdict_entry_t *old_head = head;
+
+        e->next = head;
+        if (__atomic_compare_exchange_n(bkt, &head, e, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        found = chain_find(head, old_head, s, len, h);
+        if (found != NULL) {
+            // Our entry is left unused in the arena.
+            return (entry_symnr_wait(found));
+        }
+    }
+
+    symnr = __atomic_fetch_add(&cd->len, 1, __ATOMIC_RELAXED);
+    if (symnr >= dict_max_symbols) {
+        fprintf(stderr, "Too many symbols.  Limit is %zu.\n",
+            dict_max_symbols - 1);
+        abort();
+    }
+    __atomic_store_n(cdict_slot(cd, symnr), e->str, __ATOMIC_RELEASE);
+    __atomic_store_n(&e->symnr, (uint32_t)symnr, __ATOMIC_RELEASE);
+    *rinserted = true;
+    return (symnr);
+}
+
+/*
+ * Return the symbol numbered |symnr|, or NULL if there is none,
+ * or if it is not finished yet.
+ */
+char *
+cdict_getname_nr(cdict_t *cd, size_t symnr)
+{
+    char **segv;
+    size_t seg;
+    size_t off;
+
+    if (symnr == undef_symnr) {
+        return (NULL);
+    }
+    seg = cdict_seg(symnr, &off);
+    segv = __atomic_load_n(&cd->seg[seg], __ATOMIC_ACQUIRE);
+    if (segv == NULL) {
+        return (NULL);
+    }
+    return (__atomic_load_n(segv + off, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * One more than the highest symbol number given out so far.
+ * While other threads are adding symbols, some of those below it
+ * may not be finished yet.
+ */
+size_t
+cdict_len(cdict_t *cd)
+{
+    return (__atomic_load_n(&cd->len, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Copy every symbol of |cd| into |dict|, which must be empty,
+ * in order, so that each symbol has the same number in both.
+ * Then |dict| can be frozen, or compiled into an image, like any other.
+ * No other thread may be adding to |cd|.
+ */
+void
+cdict_export(cdict_t *cd, dict_t *dict)
+{
+    size_t len = cdict_len(cd);
+    size_t symnr;
+
+    dict_reserve(dict, len);
+    for (symnr = 1; symnr < len; ++symnr) {
+        const char *sym = cdict_getname_nr(cd, symnr);
+        bool inserted;
+
+        dict_upsert(dict, sym, sym_hdr(sym)->len, &inserted);
+    }
+}
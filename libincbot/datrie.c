@@ -0,0 +1,304 @@
+/*
+ * Filename: src/libincbot/datrie.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Double-array trie over C identifiers
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See datrie.h for a description of the trie.
+ *
+ * Build:
+ *   Sort the keys.  Then, all the keys below a node are a contiguous
+ *   run, and the keys that end at the node come first in the run.
+ *   For each node, top down, find the lowest base such that the cells
+ *   for all of its children are free, claim them, and go on to
+ *   the children.
+ *
+ * Character codes follow ASCII order, so strcmp() order is trie order.
+ *
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type int32_t
+    // Import type uint32_t
+#include <stdlib.h>
+    // Import free()
+    // Import qsort()
+#include <string.h>
+    // Import strcmp()
+
+#include <cscript.h>
+#include <datrie.h>
+
+#define C(n) [(unsigned char)(n)]
+
+const uint8_t datrie_code[256] = {
+    C('0') =  1, C('1') =  2, C('2') =  3, C('3') =  4, C('4') =  5,
+    C('5') =  6, C('6') =  7, C('7') =  8, C('8') =  9, C('9') = 10,
+    C('A') = 11, C('B') = 12, C('C') = 13, C('D') = 14, C('E') = 15,
+    C('F') = 16, C('G') = 17, C('H') = 18, C('I') = 19, C('J') = 20,
+    C('K') = 21, C('L') = 22, C('M') = 23, C('N') = 24, C('O') = 25,
+    C('P') = 26, C('Q') = 27, C('R') = 28, C('S') = 29, C('T') = 30,
+    C('U') = 31, C('V') = 32, C('W') = 33, C('X') = 34, C('Y') = 35,
+    C('Z') = 36, C('_') = 37,
+    C('a') = 38, C('b') = 39, C('c') = 40, C('d') = 41, C('e') = 42,
+    C('f') = 43, C('g') = 44, C('h') = 45, C('i') = 46, C('j') = 47,
+    C('k') = 48, C('l') = 49, C('m') = 50, C('n') = 51, C('o') = 52,
+    C('p') = 53, C('q') = 54, C('r') = 55, C('s') = 56, C('t') = 57,
+    C('u') = 58, C('v') = 59, C('w') = 60, C('x') = 61, C('y') = 62,
+    C('z') = 63,
+};
+
+#undef C
+
+struct dakey {
+    const char *s;
+    uint32_t val;
+};
+
+typedef struct dakey dakey_t;
+
+/*
+ * While the trie is built, the free cells are kept on a doubly linked
+ * list, in order, so that looking for a base only looks at free cells.
+ * The root, which is never free, is the head of the list.
+ */
+struct builder {
+    datrie_t *da;
+    const dakey_t *keyv;
+    size_t *nextv;              // [da->ncell]
+    size_t *prevv;              // [da->ncell]
+};
+
+typedef struct builder builder_t;
+
+static int
+keycmp(const void *v1, const void *v2)
+{
+    return (strcmp(((const dakey_t *)v1)->s, ((const dakey_t *)v2)->s));
+}
+
+static bool
+is_identifier_key(const char *s)
+{
+    if (*s == '\0' || datrie_code[(unsigned char)*s] <= 10) {
+        return (false);
+    }
+    for (; *s != '\0'; ++s) {
+        if (datrie_code[(unsigned char)*s] == 0) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+/*
+ * Make sure that cells up to |n| exist, and that there are
+ * DATRIE_NCODE more, past them.  New cells go on the end
+ * of the free list.
+ */
+static void
+datrie_reserve(builder_t *b, size_t n)
+{
+    datrie_t *da = b->da;
+    size_t ncell = da->ncell;
+    size_t i;
+
+    if (n + DATRIE_NCODE <= ncell) {
+        return;
+    }
+    while (n + DATRIE_NCODE > ncell) {
+        ncell *= 2;
+    }
+    da->cell = (datrie_cell_t *)
+        guard_realloc(da->cell, ncell * sizeof (datrie_cell_t));
+    da->value = (uint32_t *)
+        guard_realloc(da->value, ncell * sizeof (uint32_t));
+    b->nextv = (size_t *) guard_realloc(b->nextv, ncell * sizeof (size_t));
+    b->prevv = (size_t *) guard_realloc(b->prevv, ncell * sizeof (size_t));
+    for (i = da->ncell; i < ncell; ++i) {
+        da->cell[i].base = 0;
+        da->cell[i].check = -1;
+        da->value[i] = 0;
+        b->prevv[i] = b->prevv[DATRIE_ROOT];
+        b->nextv[i] = DATRIE_ROOT;
+        b->nextv[b->prevv[DATRIE_ROOT]] = i;
+        b->prevv[DATRIE_ROOT] = i;
+    }
+    da->ncell = ncell;
+}
+
+static void
+claim_cell(builder_t *b, size_t i, int32_t parent)
+{
+    b->nextv[b->prevv[i]] = b->nextv[i];
+    b->prevv[b->nextv[i]] = b->prevv[i];
+    b->da->cell[i].check = parent;
+    ++b->da->nnode;
+}
+
+/*
+ * Find the lowest base at which the cells for the |nc| character
+ * codes, codev[], are all free.  Each free cell, in turn, is tried
+ * as the place for the first of them.
+ */
+static int32_t
+find_base(builder_t *b, const uint8_t *codev, size_t nc)
+{
+    size_t f;
+    size_t base;
+    size_t i;
+
+    f = b->nextv[DATRIE_ROOT];
+    for (;;) {
+        if (f == DATRIE_ROOT) {
+            // No free cell fits; make more.
+            f = b->da->ncell;
+            datrie_reserve(b, f);
+        }
+        if (f > codev[0]) {
+            base = f - codev[0];
+            datrie_reserve(b, base + DATRIE_NCODE);
+            for (i = 1; i < nc; ++i) {
+                if (b->da->cell[base + codev[i]].check != -1) {
+                    break;
+                }
+            }
+            if (i == nc) {
+                return ((int32_t)base);
+            }
+        }
+        f = b->nextv[f];
+    }
+}
+
+/*
+ * Build the subtrie at |node| for keys [lo, hi), which all have
+ * the same first |depth| characters.
+ */
+static void
+build_node(builder_t *b, int32_t node, size_t lo, size_t hi, size_t depth)
+{
+    datrie_t *da = b->da;
+    const dakey_t *keyv = b->keyv;
+    uint8_t codev[DATRIE_NCODE];
+    size_t startv[DATRIE_NCODE + 1];
+    size_t nc;
+    size_t i;
+    int32_t base;
+
+    if (lo < hi && keyv[lo].s[depth] == '\0') {
+        da->value[node] = keyv[lo].val;
+        ++lo;
+    }
+    if (lo == hi) {
+        return;
+    }
+
+    nc = 0;
+    for (i = lo; i < hi; ++i) {
+        uint8_t c = datrie_code[(unsigned char)keyv[i].s[depth]];
+
+        if (nc == 0 || codev[nc - 1] != c) {
+            codev[nc] = c;
+            startv[nc] = i;
+            ++nc;
+        }
+    }
+    startv[nc] = hi;
+
+    base = find_base(b, codev, nc);
+    da->cell[node].base = base;
+    for (i = 0; i < nc; ++i) {
+        claim_cell(b, base + codev[i], node);
+    }
+    for (i = 0; i < nc; ++i) {
+        build_node(b, base + codev[i], startv[i], startv[i + 1], depth + 1);
+    }
+}
+
+/*
+ * Build a trie of the |n| strings, keyv[i], each with value valv[i],
+ * which must not be 0.  Strings that are not C identifiers can never
+ * be looked up, so they are left out.
+ */
+datrie_t *
+datrie_build(const char *const *keyv, const uint32_t *valv, size_t n)
+{
+    datrie_t *da;
+    dakey_t *kv;
+    builder_t b;
+    size_t nk;
+    size_t i;
+
+    kv = (dakey_t *) guard_malloc((n ? n : 1) * sizeof (dakey_t));
+    nk = 0;
+    for (i = 0; i < n; ++i) {
+        if (keyv[i] != NULL && is_identifier_key(keyv[i])) {
+            kv[nk].s = keyv[i];
+            kv[nk].val = valv[i];
+            ++nk;
+        }
+    }
+    qsort(kv, nk, sizeof (dakey_t), keycmp);
+
+    da = (datrie_t *) guard_malloc(sizeof (datrie_t));
+    da->ncell = 2 * DATRIE_NCODE;
+    da->cell = (datrie_cell_t *)
+        guard_malloc(da->ncell * sizeof (datrie_cell_t));
+    da->value = (uint32_t *) guard_malloc(da->ncell * sizeof (uint32_t));
+    for (i = 0; i < da->ncell; ++i) {
+        da->cell[i].base = 0;
+        da->cell[i].check = -1;
+        da->value[i] = 0;
+    }
+    da->cell[DATRIE_ROOT].check = -2;   // In use, but nobody's child
+    da->nnode = 1;
+
+    b.da = da;
+    b.keyv = kv;
+    b.nextv = (size_t *) guard_malloc(da->ncell * sizeof (size_t));
+    b.prevv = (size_t *) guard_malloc(da->ncell * sizeof (size_t));
+    for (i = 0; i < da->ncell; ++i) {
+        b.nextv[i] = (i + 1) % da->ncell;
+        b.prevv[i] = (i + da->ncell - 1) % da->ncell;
+    }
+    build_node(&b, DATRIE_ROOT, 0, nk, 0);
+
+    free(b.nextv);
+    free(b.prevv);
+    free(kv);
+    return (da);
+}
+
+void
+datrie_delete(datrie_t *da)
+{
+    if (da == NULL) {
+        return;
+    }
+    free(da->cell);
+    free(da->value);
+    free(da);
+}
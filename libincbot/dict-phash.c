@@ -0,0 +1,344 @@
+/*
+ * Filename: src/libincbot/dict-phash.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Minimal perfect hash index for frozen dictionaries
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See dict-impl.h for a description of the index.
+ *
+ * Build:
+ *   Hash every symbol.  Group symbols by bucket.  Place buckets,
+ *   largest first.  For each bucket, try displacement indices
+ *   d = 0, 1, 2, ..., where d encodes the pair (d0, d1) = (d / m, d % m),
+ *   and the slot of a symbol with hash values (f1, f2) is
+ *   (f1 + d0 * f2 + d1) mod m.  Keep the first d that puts every
+ *   symbol of the bucket into a free slot.  If some bucket cannot
+ *   be placed, start over with a different seed.
+ *
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import free()
+#include <string.h>
+    // Import memset()
+
+#include <cscript.h>
+#include <dict.h>
+#include <dict-impl.h>
+
+#define PHASH_BUCKET_LOAD 4         // Average number of symbols per bucket
+#define PHASH_MAX_SEEDS   32
+#define PHASH_MAX_DISP    (1U << 22)
+
+static const uint64_t phash_seed0 = 0x9e3779b97f4a7c15ULL;
+
+// MurmurHash3 64-bit finalizer
+static inline uint64_t
+mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (h);
+}
+
+// Re-key the dict_hash() value of a symbol with |seed|.
+// Trying another seed never needs to look at the symbols again.
+static inline uint64_t
+phash_hash(uint64_t h, uint64_t seed)
+{
+    return (mix64(h ^ seed));
+}
+
+struct phkey {
+    uint32_t bkt;
+    uint32_t f1;
+    uint32_t f2;
+};
+
+typedef struct phkey phkey_t;
+
+static inline void
+phash_split(uint64_t h, const phash_t *ph, phkey_t *k)
+{
+    uint64_t h2 = mix64(h ^ phash_seed0);
+
+    k->bkt = (uint32_t)((h & 0xffffffff) % ph->nbkt);
+    k->f1  = (uint32_t)((h >> 32) % ph->nslot);
+    k->f2  = (uint32_t)(h2 % ph->nslot);
+}
+
+static inline size_t
+phash_slot(const phkey_t *k, uint32_t d, size_t m)
+{
+    uint64_t d0 = d / m;
+    uint64_t d1 = d % m;
+
+    return ((size_t)((k->f1 + d0 * k->f2 + d1) % m));
+}
+
+/*
+ * Try to place all symbols using |seed|.
+ * On success, fill in |disp| and |slot| and return true.
+ */
+static bool
+phash_try(const uint64_t *hv, phash_t *ph, uint32_t *disp, uint32_t *slot)
+{
+    size_t n = ph->nslot;
+    size_t r = ph->nbkt;
+    phkey_t *keyv;
+    uint32_t *symv;         // Symbol numbers, grouped by bucket
+    size_t *bstart;         // [r + 1] Start of each bucket in symv
+    size_t *border;         // Buckets, largest first
+    size_t *fill;
+    bool *taken;
+    size_t posv[64];
+    size_t i;
+    size_t b;
+    bool ok;
+
+    keyv   = (phkey_t *) guard_malloc(n * sizeof (phkey_t));
+    symv   = (uint32_t *) guard_malloc(n * sizeof (uint32_t));
+    bstart = (size_t *) guard_calloc(r + 1, sizeof (size_t));
+    border = (size_t *) guard_malloc(r * sizeof (size_t));
+    fill   = (size_t *) guard_calloc(r, sizeof (size_t));
+    taken  = (bool *) guard_calloc(n, sizeof (bool));
+
+    for (i = 0; i < n; ++i) {
+        phash_split(phash_hash(hv[i], ph->seed), ph, keyv + i);
+        ++bstart[keyv[i].bkt + 1];
+    }
+    for (b = 0; b < r; ++b) {
+        bstart[b + 1] += bstart[b];
+    }
+    for (i = 0; i < n; ++i) {
+        b = keyv[i].bkt;
+        symv[bstart[b] + fill[b]] = (uint32_t)(i + 1);
+        ++fill[b];
+    }
+
+    // Order buckets by size, largest first -- a counting sort.
+    {
+        size_t maxsz = 0;
+        size_t sz;
+        size_t pos = 0;
+
+        for (b = 0; b < r; ++b) {
+            if (fill[b] > maxsz) {
+                maxsz = fill[b];
+            }
+        }
+        for (sz = maxsz; sz != 0; --sz) {
+            for (b = 0; b < r; ++b) {
+                if (fill[b] == sz) {
+                    border[pos++] = b;
+                }
+            }
+        }
+        for (; pos < r; ++pos) {
+            border[pos] = r;    // Empty buckets need no placement
+        }
+        ok = maxsz <= sizeof (posv) / sizeof (posv[0]);
+    }
+
+    for (i = 0; ok && i < r && border[i] != r; ++i) {
+        size_t bsz;
+        uint32_t d;
+        size_t j;
+        size_t k;
+
+        b = border[i];
+        bsz = bstart[b + 1] - bstart[b];
+        for (d = 0; d < PHASH_MAX_DISP; ++d) {
+            for (j = 0; j < bsz; ++j) {
+                uint32_t symnr = symv[bstart[b] + j];
+                posv[j] = phash_slot(keyv + symnr - 1, d, n);
+                if (taken[posv[j]]) {
+                    break;
+                }
+                for (k = 0; k < j; ++k) {
+                    if (posv[k] == posv[j]) {
+                        break;
+                    }
+                }
+                if (k < j) {
+                    break;
+                }
+            }
+            if (j == bsz) {
+                break;
+            }
+        }
+
+        if (d == PHASH_MAX_DISP) {
+            ok = false;
+            break;
+        }
+
+        disp[b] = d;
+        for (k = 0; k < bsz; ++k) {
+            taken[posv[k]] = true;
+            slot[posv[k]] = symv[bstart[b] + k];
+        }
+    }
+
+    free(keyv);
+    free(symv);
+    free(bstart);
+    free(border);
+    free(fill);
+    free(taken);
+    return (ok);
+}
+
+/*
+ * Build a minimal perfect hash index over all the symbols of |dict|.
+ * Return NULL if there is nothing to index, or if an index
+ * could not be built.  An index is only an accelerator, so failure
+ * is not an error.
+ */
+phash_t *
+phash_build(dict_t *dict)
+{
+    phash_t *ph;
+    uint32_t *disp;
+    uint32_t *slot;
+    uint64_t *hv;
+    size_t n;
+    size_t i;
+    size_t seednr;
+
+    n = dict->len - 1;
+    if (n == 0 || dict->len > UINT32_MAX) {
+        return (NULL);
+    }
+
+    ph = (phash_t *) guard_malloc(sizeof (phash_t));
+    ph->nslot = n;
+    ph->nbkt  = (n + PHASH_BUCKET_LOAD - 1) / PHASH_BUCKET_LOAD;
+    ph->mapped = false;
+    disp = (uint32_t *) guard_calloc(ph->nbkt, sizeof (uint32_t));
+    slot = (uint32_t *) guard_calloc(ph->nslot, sizeof (uint32_t));
+
+    // Hash every symbol once, up front.
+    hv = (uint64_t *) guard_malloc(n * sizeof (uint64_t));
+    for (i = 0; i < n; ++i) {
+        const char *sym = dict_getname_nr(dict, i + 1);
+        hv[i] = dict_hash(sym, sym_hdr(sym)->len);
+    }
+
+    for (seednr = 0; seednr < PHASH_MAX_SEEDS; ++seednr) {
+        ph->seed = mix64(phash_seed0 + seednr);
+        memset(disp, 0, ph->nbkt * sizeof (uint32_t));
+        if (phash_try(hv, ph, disp, slot)) {
+            ph->disp = disp;
+            ph->slot = slot;
+            free(hv);
+            return (ph);
+        }
+    }
+
+    free(hv);
+    free(disp);
+    free(slot);
+    free(ph);
+    return (NULL);
+}
+
+void
+phash_delete(phash_t *ph)
+{
+    if (ph == NULL) {
+        return;
+    }
+    if (!ph->mapped) {
+        free((void *)ph->disp);
+        free((void *)ph->slot);
+    }
+    free(ph);
+}
+
+/*
+ * Look up the symbol, |s|, of length |len|, whose dict_hash() value is |h|.
+ */
+size_t
+phash_find(dict_t *dict, const phash_t *ph, const char *s, size_t len,
+    uint64_t h)
+{
+    phkey_t k;
+    size_t symnr;
+
+    dict_count_probe(dict);
+    phash_split(phash_hash(h, ph->seed), ph, &k);
+    symnr = ph->slot[phash_slot(&k, ph->disp[k.bkt], ph->nslot)];
+    if (symbol_match(dict, dict_getname_nr(dict, symnr), s, len, h)) {
+        return (symnr);
+    }
+    return (undef_symnr);
+}
+
+/*
+ * Look up |n| symbols, at most DICT_BATCH, at once.
+ *
+ * Each step of a lookup -- displacement, slot, symbol -- depends
+ * on the one before, but lookups are independent of each other.
+ * So, take all of them through one step, prefetching what the next
+ * step needs, before going on to the next step.
+ */
+void
+phash_find_batch(dict_t *dict, const phash_t *ph, const dict_key_t *keyv,
+    size_t n, symnr_t *outv)
+{
+    phkey_t kv[DICT_BATCH];
+    size_t slotv[DICT_BATCH];
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        phash_split(phash_hash(keyv[i].h, ph->seed), ph, kv + i);
+        __builtin_prefetch(ph->disp + kv[i].bkt);
+    }
+
+    for (i = 0; i < n; ++i) {
+        slotv[i] = phash_slot(kv + i, ph->disp[kv[i].bkt], ph->nslot);
+        __builtin_prefetch(ph->slot + slotv[i]);
+    }
+
+    for (i = 0; i < n; ++i) {
+        outv[i] = ph->slot[slotv[i]];
+        __builtin_prefetch(sym_hdr(dict_getname_nr(dict, outv[i])));
+    }
+
+    for (i = 0; i < n; ++i) {
+        const dict_key_t *key = keyv + i;
+
+        if (!symbol_match(dict, dict_getname_nr(dict, outv[i]),
+                          key->s, key->len, key->h)) {
+            outv[i] = undef_symnr;
+        }
+    }
+}
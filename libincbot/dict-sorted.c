@@ -0,0 +1,273 @@
+/*
+ * Filename: src/libincbot/dict-sorted.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Sorted array dictionary index
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A sorted array of symbol numbers, searched by binary search.
+ * This is the "sorted" dict backend; see dict_backend_t.
+ *
+ * The hash value is of no use here.  Each entry carries the first
+ * 8 bytes of its symbol, as a big-endian number, so that most steps
+ * of a binary search compare two integers, and only the last few,
+ * among symbols with a common 8-byte prefix, look at the string pool.
+ *
+ * A new symbol is inserted in place, so an upsert costs a move
+ * of half the array, on average.  That is fine for loading tables
+ * of a few thousand symbols, which is what this is for.
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdio.h>
+    // Import fprintf()
+    // Import var stderr
+#include <stdlib.h>
+    // Import free()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+    // Import memmove()
+
+#include <cscript.h>
+#include <dict.h>
+#include <dict-impl.h>
+
+struct sorted_ent {
+    uint64_t prefix;        // First 8 bytes of the symbol, big-endian
+    symnr_t symnr;
+};
+
+typedef struct sorted_ent sorted_ent_t;
+
+struct sorted {
+    sorted_ent_t *ent;
+    size_t len;
+    size_t sz;
+};
+
+typedef struct sorted sorted_t;
+
+/*
+ * The first 8 bytes of |s|, padded with zero bytes, such that
+ * comparing prefixes as numbers is the same as comparing the bytes.
+ */
+static inline uint64_t
+sorted_prefix(const char *s, size_t len)
+{
+    uint64_t w = 0;
+
+    memcpy(&w, s, len < 8 ? len : 8);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return (w);
+}
+
+/*
+ * Compare the string, |s|, of length |len|, whose prefix is |prefix|,
+ * with the symbol of |ent|.  Symbols are ordered by bytes,
+ * then by length.
+ */
+static inline int
+sorted_cmp(dict_t *dict, const char *s, size_t len, uint64_t prefix,
+    const sorted_ent_t *ent)
+{
+    const char *sym;
+    size_t symlen;
+    int cmp;
+
+    dict_count_probe(dict);
+    if (prefix != ent->prefix) {
+        return (prefix < ent->prefix ? -1 : 1);
+    }
+    dict_count_strcmp(dict);
+    sym = dict_getname_nr(dict, ent->symnr);
+    symlen = sym_hdr(sym)->len;
+    cmp = memcmp(s, sym, len < symlen ? len : symlen);
+    if (cmp != 0) {
+        return (cmp);
+    }
+    return (len < symlen ? -1 : len > symlen ? 1 : 0);
+}
+
+/*
+ * Return the position of the first entry that is not less than |s|.
+ * Set |*rfound| if that entry is |s|.
+ */
+static size_t
+sorted_search(dict_t *dict, const sorted_t *sa, const char *s, size_t len,
+    uint64_t prefix, bool *rfound)
+{
+    size_t lo = 0;
+    size_t hi = sa->len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (sorted_cmp(dict, s, len, prefix, sa->ent + mid) > 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *rfound = lo < sa->len
+        && sorted_cmp(dict, s, len, prefix, sa->ent + lo) == 0;
+    return (lo);
+}
+
+static void
+sorted_reserve_ents(sorted_t *sa, size_t n)
+{
+    if (n <= sa->sz) {
+        return;
+    }
+    while (sa->sz < n) {
+        sa->sz = sa->sz ? sa->sz * 2 : 64;
+    }
+    sa->ent = (sorted_ent_t *)
+        guard_realloc(sa->ent, sa->sz * sizeof (sorted_ent_t));
+}
+
+static void
+sorted_insert_at(sorted_t *sa, size_t pos, uint64_t prefix, size_t symnr)
+{
+    sorted_reserve_ents(sa, sa->len + 1);
+    memmove(sa->ent + pos + 1, sa->ent + pos,
+            (sa->len - pos) * sizeof (sorted_ent_t));
+    sa->ent[pos].prefix = prefix;
+    sa->ent[pos].symnr = (symnr_t)symnr;
+    ++sa->len;
+}
+
+static void
+sorted_create(dict_t *dict, size_t n)
+{
+    sorted_t *sa;
+    size_t symnr;
+
+    sa = (sorted_t *) guard_malloc(sizeof (sorted_t));
+    sa->ent = NULL;
+    sa->len = 0;
+    sa->sz = 0;
+    sorted_reserve_ents(sa, n);
+    dict->hashtable = sa;
+
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
+        size_t len = sym_hdr(sym)->len;
+        uint64_t prefix = sorted_prefix(sym, len);
+        bool found;
+        size_t pos;
+
+        pos = sorted_search(dict, sa, sym, len, prefix, &found);
+        sorted_insert_at(sa, pos, prefix, symnr);
+    }
+}
+
+static void
+sorted_destroy(dict_t *dict)
+{
+    sorted_t *sa = (sorted_t *)dict->hashtable;
+
+    free(sa->ent);
+    free(sa);
+}
+
+static void
+sorted_reserve(dict_t *dict, size_t n)
+{
+    sorted_reserve_ents((sorted_t *)dict->hashtable, n);
+}
+
+static size_t
+sorted_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    sorted_t *sa = (sorted_t *)dict->hashtable;
+    uint64_t prefix = sorted_prefix(s, len);
+    size_t symnr;
+    size_t pos;
+    bool found;
+
+    pos = sorted_search(dict, sa, s, len, prefix, &found);
+    if (found) {
+        return (sa->ent[pos].symnr);
+    }
+    if (!upsert) {
+        return (undef_symnr);
+    }
+    symnr = dict_append_symbol(dict, s, len, h);
+    sorted_insert_at(sa, pos, prefix, symnr);
+    *rinserted = true;
+    return (symnr);
+}
+
+/*
+ * A search starts in the middle, so that is what is worth fetching.
+ */
+static void
+sorted_prefetch(dict_t *dict, uint64_t h)
+{
+    const sorted_t *sa = (const sorted_t *)dict->hashtable;
+
+    (void)h;
+    __builtin_prefetch(sa->ent + sa->len / 2);
+}
+
+static void
+sorted_stats(dict_t *dict, dict_stats_t *rstats)
+{
+    const sorted_t *sa = (const sorted_t *)dict->hashtable;
+
+    rstats->index_bytes = sizeof (sorted_t) + sa->sz * sizeof (sorted_ent_t);
+}
+
+static void
+sorted_dump(dict_t *dict)
+{
+    const sorted_t *sa = (const sorted_t *)dict->hashtable;
+    size_t i;
+
+    fprintf(stderr, "Sorted array: %zu entries\n", sa->len);
+    for (i = 0; i < sa->len; ++i) {
+        fprintf(stderr, "%7zu) %7u [%s]\n", i, sa->ent[i].symnr,
+            dict_getname_nr(dict, sa->ent[i].symnr));
+    }
+}
+
+const dict_backend_t dict_backend_sorted = {
+    .name     = "sorted",
+    .create   = sorted_create,
+    .destroy  = sorted_destroy,
+    .reserve  = sorted_reserve,
+    .find     = sorted_find,
+    .prefetch = sorted_prefetch,
+    .freeze   = NULL,
+    .stats    = sorted_stats,
+    .dump     = sorted_dump,
+};
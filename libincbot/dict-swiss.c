@@ -0,0 +1,402 @@
+/*
+ * Filename: src/libincbot/dict-swiss.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Open addressing index for dict_t, with SIMD matching of hash tags
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A "Swiss table" style hash index.
+ *
+ * There are no buckets and no overflow chains.  There is one flat
+ * array of slots, a power of 2 in size, and, in parallel with it,
+ * an array of one-byte control tags.  A control byte is either
+ * |ctrl_empty| or the top 7 bits of the hash value of the symbol
+ * in that slot.
+ *
+ * A probe loads a whole group of control bytes at once, and compares
+ * all of them against the tag of the symbol being looked up, using
+ * SSE2 (16 bytes) or AVX2 (32 bytes) if the compiler was told it can.
+ * Only slots whose tag matches are looked at; only 1 in 128 of those
+ * is a false match.  Each slot holds the full hash value right next
+ * to the symbol number, so even a false match is almost always
+ * rejected without touching the string pool.
+ *
+ * Symbols are never deleted, so there are no tombstones, and the first
+ * empty slot on the probe sequence is where a new symbol goes.
+ *
+ * The control array has SWISS_GROUP extra bytes at the end, which
+ * mirror the first SWISS_GROUP bytes, so that a group load starting
+ * anywhere never has to wrap around.
+ *
+ * This is the "swiss" dict backend; see dict_backend_t.
+ *
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stdint.h>
+    // Import type uint8_t
+    // Import type uint32_t
+#include <stdio.h>
+    // Import fprintf()
+    // Import var stderr
+#include <stdlib.h>
+    // Import free()
+#include <string.h>
+    // Import memset()
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SWISS_GROUP 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SWISS_GROUP 16
+#else
+#define SWISS_GROUP 16
+#endif
+
+#include <cscript.h>
+#include <dict.h>
+#include <dict-impl.h>
+
+// Maximum load factor, in eighths.  Open addressing degrades quickly
+// when nearly full, but group matching makes 7/8 affordable.
+//
+#define SWISS_MAX_LOAD 7
+
+static const uint8_t ctrl_empty = 0x80;
+
+struct swiss_slot {
+    uint32_t symnr;
+    uint32_t h;
+};
+
+typedef struct swiss_slot swiss_slot_t;
+
+struct swiss {
+    uint8_t *ctrl;          // [cap + SWISS_GROUP] Control bytes
+    swiss_slot_t *slot;     // [cap]
+    size_t cap;             // Number of slots, a power of 2
+    size_t nent;            // Number of occupied slots
+};
+
+typedef struct swiss swiss_t;
+
+typedef uint32_t group_mask_t;  // One bit per control byte of a group
+
+static inline uint8_t
+swiss_tag(size_t h)
+{
+    return ((uint8_t)((h >> 25) & 0x7f));
+}
+
+/*
+ * Return a mask of all the control bytes in the group at |ctrl|
+ * that are equal to |tag|.
+ */
+static inline group_mask_t
+group_match(const uint8_t *ctrl, uint8_t tag)
+{
+#if defined(__AVX2__)
+    __m256i g = _mm256_loadu_si256((const __m256i *)ctrl);
+    __m256i t = _mm256_set1_epi8((char)tag);
+    return ((group_mask_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, t)));
+#elif defined(__SSE2__)
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    __m128i t = _mm_set1_epi8((char)tag);
+    return ((group_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, t)));
+#else
+    group_mask_t m = 0;
+    size_t i;
+
+    for (i = 0; i < SWISS_GROUP; ++i) {
+        if (ctrl[i] == tag) {
+            m |= (group_mask_t)1 << i;
+        }
+    }
+    return (m);
+#endif
+}
+
+static inline size_t
+swiss_cap_for(size_t n)
+{
+    size_t cap = SWISS_GROUP;
+
+    while (cap * SWISS_MAX_LOAD / 8 < n + 1) {
+        cap *= 2;
+    }
+    return (cap);
+}
+
+static void
+swiss_alloc(swiss_t *sw, size_t cap)
+{
+    sw->cap = cap;
+    sw->nent = 0;
+    sw->ctrl = (uint8_t *) guard_malloc(cap + SWISS_GROUP);
+    memset(sw->ctrl, ctrl_empty, cap + SWISS_GROUP);
+    sw->slot = (swiss_slot_t *) guard_malloc(cap * sizeof (swiss_slot_t));
+}
+
+static inline void
+swiss_set(swiss_t *sw, size_t i, size_t h, size_t symnr)
+{
+    uint8_t tag = swiss_tag(h);
+
+    sw->ctrl[i] = tag;
+    if (i < SWISS_GROUP) {
+        sw->ctrl[sw->cap + i] = tag;
+    }
+    sw->slot[i].symnr = (uint32_t)symnr;
+    sw->slot[i].h = (uint32_t)h;
+    ++sw->nent;
+}
+
+/*
+ * Return the first empty slot on the probe sequence for |h|.
+ */
+static size_t
+swiss_free_slot(swiss_t *sw, size_t h)
+{
+    size_t mask = sw->cap - 1;
+    size_t pos = h & mask;
+    size_t stride = 0;
+    group_mask_t m;
+
+    for (;;) {
+        m = group_match(sw->ctrl + pos, ctrl_empty);
+        if (m != 0) {
+            return ((pos + __builtin_ctz(m)) & mask);
+        }
+        stride += SWISS_GROUP;
+        pos = (pos + stride) & mask;
+    }
+}
+
+/*
+ * Insert |symnr|, which is known not to be in |sw| already.
+ * There must be room for it.
+ */
+static void
+swiss_insert(swiss_t *sw, size_t h, size_t symnr)
+{
+    swiss_set(sw, swiss_free_slot(sw, h), h, symnr);
+}
+
+/*
+ * Start fetching the first group of control bytes, and the first slot,
+ * on the probe sequence for |h|, ahead of a swiss_find().
+ */
+static void
+swiss_prefetch(const swiss_t *sw, size_t h)
+{
+    size_t pos = h & (sw->cap - 1);
+
+    __builtin_prefetch(sw->ctrl + pos);
+    __builtin_prefetch(sw->slot + pos);
+}
+
+static swiss_t *
+swiss_new(size_t n)
+{
+    swiss_t *sw;
+
+    sw = (swiss_t *) guard_malloc(sizeof (swiss_t));
+    swiss_alloc(sw, swiss_cap_for(n));
+    return (sw);
+}
+
+static void
+swiss_delete(swiss_t *sw)
+{
+    if (sw == NULL) {
+        return;
+    }
+    free(sw->ctrl);
+    free(sw->slot);
+    free(sw);
+}
+
+/*
+ * Make room for a total of |n| entries.  Every slot records the full
+ * hash value, so moving to a larger table never looks at a symbol.
+ */
+static void
+swiss_reserve(swiss_t *sw, size_t n)
+{
+    swiss_t old;
+    size_t cap;
+    size_t i;
+
+    cap = swiss_cap_for(n);
+    if (cap <= sw->cap) {
+        return;
+    }
+
+    old = *sw;
+    swiss_alloc(sw, cap);
+    for (i = 0; i < old.cap; ++i) {
+        if (old.ctrl[i] != ctrl_empty) {
+            swiss_insert(sw, old.slot[i].h, old.slot[i].symnr);
+        }
+    }
+    free(old.ctrl);
+    free(old.slot);
+}
+
+/*
+ * Look up the symbol, |s|, of length |len|, whose hash value is |h|.
+ *
+ * If it is not there, and |upsert| is true, then append it
+ * to the dictionary and put it in the first empty slot that
+ * the search came across, and set |*rinserted|.
+ */
+static size_t
+swiss_find(dict_t *dict, swiss_t *sw, const char *s, size_t len, size_t h,
+    bool upsert, bool *rinserted)
+{
+    size_t mask = sw->cap - 1;
+    size_t pos = h & mask;
+    size_t stride = 0;
+    uint8_t tag = swiss_tag(h);
+    size_t symnr;
+
+    for (;;) {
+        group_mask_t m = group_match(sw->ctrl + pos, tag);
+        group_mask_t e;
+
+        dict_count_probe(dict);
+        while (m != 0) {
+            size_t i = (pos + __builtin_ctz(m)) & mask;
+            const swiss_slot_t *slot = sw->slot + i;
+
+            if (slot->h == (uint32_t)h
+                && symbol_match(dict, dict_getname_nr(dict, slot->symnr),
+                                s, len, h)) {
+                return (slot->symnr);
+            }
+            m &= m - 1;
+        }
+
+        e = group_match(sw->ctrl + pos, ctrl_empty);
+        if (e != 0) {
+            if (!upsert) {
+                return (undef_symnr);
+            }
+            symnr = dict_append_symbol(dict, s, len, h);
+            swiss_set(sw, (pos + __builtin_ctz(e)) & mask, h, symnr);
+            *rinserted = true;
+            if (sw->nent * 8 > sw->cap * SWISS_MAX_LOAD) {
+                swiss_reserve(sw, sw->nent * 2);
+            }
+            return (symnr);
+        }
+
+        stride += SWISS_GROUP;
+        pos = (pos + stride) & mask;
+    }
+}
+
+static void
+swiss_dump(const swiss_t *sw)
+{
+    size_t i;
+
+    fprintf(stderr, "Swiss table: %zu slots, %zu used, group=%d\n",
+        sw->cap, sw->nent, SWISS_GROUP);
+    for (i = 0; i < sw->cap; ++i) {
+        if (sw->ctrl[i] != ctrl_empty) {
+            fprintf(stderr, "%7zu) %02x %7u h=%08x\n", i,
+                sw->ctrl[i], sw->slot[i].symnr, sw->slot[i].h);
+        }
+    }
+}
+
+// ============== dict backend
+
+static void
+swiss_backend_create(dict_t *dict, size_t n)
+{
+    swiss_t *sw = swiss_new(n);
+    size_t symnr;
+
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        char *sym = dict_getname_nr(dict, symnr);
+        swiss_insert(sw, sym_hdr(sym)->h, symnr);
+    }
+    dict->hashtable = sw;
+}
+
+static void
+swiss_backend_destroy(dict_t *dict)
+{
+    swiss_delete((swiss_t *)dict->hashtable);
+}
+
+static void
+swiss_backend_reserve(dict_t *dict, size_t n)
+{
+    swiss_reserve((swiss_t *)dict->hashtable, n);
+}
+
+static size_t
+swiss_backend_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    return (swiss_find(dict, (swiss_t *)dict->hashtable, s, len,
+                       hash_fold(h), upsert, rinserted));
+}
+
+static void
+swiss_backend_prefetch(dict_t *dict, uint64_t h)
+{
+    swiss_prefetch((const swiss_t *)dict->hashtable, hash_fold(h));
+}
+
+static void
+swiss_backend_stats(dict_t *dict, dict_stats_t *rstats)
+{
+    const swiss_t *sw = (const swiss_t *)dict->hashtable;
+
+    rstats->tbl_bytes = sw->cap + SWISS_GROUP
+        + sw->cap * sizeof (swiss_slot_t);
+    rstats->index_bytes = sizeof (swiss_t) + rstats->tbl_bytes;
+    rstats->nbkt = sw->cap;
+    rstats->load_factor = (double)sw->nent / sw->cap;
+}
+
+static void
+swiss_backend_dump(dict_t *dict)
+{
+    swiss_dump((const swiss_t *)dict->hashtable);
+}
+
+const dict_backend_t dict_backend_swiss = {
+    .name     = "swiss",
+    .create   = swiss_backend_create,
+    .destroy  = swiss_backend_destroy,
+    .reserve  = swiss_backend_reserve,
+    .find     = swiss_backend_find,
+    .prefetch = swiss_backend_prefetch,
+    .freeze   = NULL,
+    .stats    = swiss_backend_stats,
+    .dump     = swiss_backend_dump,
+};
@@ -0,0 +1,283 @@
+/*
+ * Filename: src/libincbot/dict-trie.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Ternary search trie dictionary index
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A ternary search trie over the symbols of a dict_t.
+ * This is the "trie" dict backend; see dict_backend_t.
+ *
+ * Each node holds one byte, and three children: the subtries
+ * for bytes less than, equal to, and greater than its own.
+ * Following the "equal" child consumes a byte of the key.
+ * The node for the last byte of a symbol records its symbol number.
+ * Unlike the double-array trie of datrie.h, which is built all at once
+ * over C identifiers only, this one takes any bytes, and grows
+ * one symbol at a time.
+ *
+ * The hash value is of no use here.  A lookup of a string that is
+ * not there usually stops within its first few bytes.
+ *
+ * Nodes live in one growable array, and refer to each other by
+ * position.  Node 0 is not used, so that 0 can mean "no child".
+ * The empty string has no last byte, so it is recorded separately.
+ */
+
+#include <stdbool.h>
+    // Import type bool
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint8_t
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdio.h>
+    // Import fprintf()
+    // Import var stderr
+#include <stdlib.h>
+    // Import free()
+
+#include <cscript.h>
+#include <dict.h>
+#include <dict-impl.h>
+
+struct tst_node {
+    uint32_t lo;
+    uint32_t eq;
+    uint32_t hi;
+    symnr_t symnr;          // Symbol that ends here, or undef_symnr
+    uint8_t c;
+};
+
+typedef struct tst_node tst_node_t;
+
+struct tst {
+    tst_node_t *node;
+    size_t len;             // Nodes in use, including node 0
+    size_t sz;
+    uint32_t root;
+    symnr_t empty_symnr;    // Symbol number of "", if it is there
+};
+
+typedef struct tst tst_t;
+
+static void
+tst_reserve_nodes(tst_t *t, size_t n)
+{
+    if (n <= t->sz) {
+        return;
+    }
+    while (t->sz < n) {
+        t->sz *= 2;
+    }
+    t->node = (tst_node_t *)
+        guard_realloc(t->node, t->sz * sizeof (tst_node_t));
+}
+
+static uint32_t
+tst_new_node(tst_t *t, uint8_t c)
+{
+    tst_node_t *nd = t->node + t->len;
+
+    nd->lo = 0;
+    nd->eq = 0;
+    nd->hi = 0;
+    nd->symnr = undef_symnr;
+    nd->c = c;
+    return ((uint32_t)t->len++);
+}
+
+static size_t
+tst_search(dict_t *dict, const tst_t *t, const char *s, size_t len)
+{
+    const tst_node_t *nodev = t->node;
+    uint32_t p = t->root;
+    size_t i = 0;
+
+    if (len == 0) {
+        return (t->empty_symnr);
+    }
+    while (p != 0) {
+        const tst_node_t *nd = nodev + p;
+        uint8_t c = (uint8_t)s[i];
+
+        dict_count_probe(dict);
+        if (c < nd->c) {
+            p = nd->lo;
+        }
+        else if (c > nd->c) {
+            p = nd->hi;
+        }
+        else if (++i == len) {
+            return (nd->symnr);
+        }
+        else {
+            p = nd->eq;
+        }
+    }
+    return (undef_symnr);
+}
+
+/*
+ * Return the node for the whole of |s|, adding any nodes that are
+ * missing along the way.
+ */
+static uint32_t
+tst_path(tst_t *t, const char *s, size_t len)
+{
+    uint32_t *link;
+    size_t i;
+
+    // A path adds at most one node per byte.  Make room for them
+    // all, first, so that |link| stays valid.
+    //
+    tst_reserve_nodes(t, t->len + len);
+    link = &t->root;
+    i = 0;
+    for (;;) {
+        uint8_t c = (uint8_t)s[i];
+        tst_node_t *nd;
+
+        if (*link == 0) {
+            *link = tst_new_node(t, c);
+        }
+        nd = t->node + *link;
+        if (c < nd->c) {
+            link = &nd->lo;
+        }
+        else if (c > nd->c) {
+            link = &nd->hi;
+        }
+        else if (++i == len) {
+            return (*link);
+        }
+        else {
+            link = &nd->eq;
+        }
+    }
+}
+
+static void
+tst_insert(tst_t *t, const char *s, size_t len, size_t symnr)
+{
+    uint32_t p;
+
+    if (len == 0) {
+        t->empty_symnr = (symnr_t)symnr;
+        return;
+    }
+    p = tst_path(t, s, len);
+    t->node[p].symnr = (symnr_t)symnr;
+}
+
+static void
+trie_create(dict_t *dict, size_t n)
+{
+    tst_t *t;
+    size_t symnr;
+
+    (void)n;
+    t = (tst_t *) guard_malloc(sizeof (tst_t));
+    t->sz = 1024;
+    t->node = (tst_node_t *) guard_malloc(t->sz * sizeof (tst_node_t));
+    t->len = 1;
+    t->root = 0;
+    t->empty_symnr = undef_symnr;
+    dict->hashtable = t;
+
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
+
+        tst_insert(t, sym, sym_hdr(sym)->len, symnr);
+    }
+}
+
+static void
+trie_destroy(dict_t *dict)
+{
+    tst_t *t = (tst_t *)dict->hashtable;
+
+    free(t->node);
+    free(t);
+}
+
+/*
+ * How many nodes |n| symbols will need is anybody's guess.
+ */
+static void
+trie_reserve(dict_t *dict, size_t n)
+{
+    (void)dict;
+    (void)n;
+}
+
+static size_t
+trie_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    tst_t *t = (tst_t *)dict->hashtable;
+    size_t symnr;
+
+    symnr = tst_search(dict, t, s, len);
+    if (symnr != undef_symnr || !upsert) {
+        return (symnr);
+    }
+    symnr = dict_append_symbol(dict, s, len, h);
+    tst_insert(t, s, len, symnr);
+    *rinserted = true;
+    return (symnr);
+}
+
+static void
+trie_stats(dict_t *dict, dict_stats_t *rstats)
+{
+    const tst_t *t = (const tst_t *)dict->hashtable;
+
+    rstats->index_bytes = sizeof (tst_t) + t->sz * sizeof (tst_node_t);
+}
+
+static void
+trie_dump(dict_t *dict)
+{
+    const tst_t *t = (const tst_t *)dict->hashtable;
+    size_t i;
+
+    fprintf(stderr, "Ternary search trie: %zu nodes, root=%u, empty=%u\n",
+        t->len - 1, t->root, t->empty_symnr);
+    for (i = 1; i < t->len; ++i) {
+        const tst_node_t *nd = t->node + i;
+
+        fprintf(stderr, "%7zu) %02x lo=%u eq=%u hi=%u symnr=%u\n",
+            i, nd->c, nd->lo, nd->eq, nd->hi, nd->symnr);
+    }
+}
+
+const dict_backend_t dict_backend_trie = {
+    .name     = "trie",
+    .create   = trie_create,
+    .destroy  = trie_destroy,
+    .reserve  = trie_reserve,
+    .find     = trie_find,
+    .prefetch = NULL,
+    .freeze   = NULL,
+    .stats    = trie_stats,
+    .dump     = trie_dump,
+};
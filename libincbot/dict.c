@@ -25,14 +25,18 @@
 #define _GNU_SOURCE 1
 #endif
 
+#include <errno.h>
+    // Import constant EINVAL
 #include <stdio.h>
     // Import fprintf()
     // Import var stderr
 #include <stdlib.h>
     // Import exit()
 #include <string.h>
-    // Import strcmp()
-    // Import strdup()
+    // Import memcmp()
+    // Import memcpy()
+    // Import memset()
+    // Import strlen()
 #include <unistd.h>
     // Import exit()
     // Import type size_t
@@ -41,25 +45,68 @@
 
 #include <cscript.h>
 #include <dict.h>
+#include <dict-impl.h>
 
 #ifdef TEST_SMALL
 
 static size_t config_hashmap_init_size = 11;
 #define HASHMAP_SET_ASSOCIATIVITY 2
 #define OVFL_SEGMENT_SIZE 8
+#define STRPOOL_ARENA_SIZE 256
 
 #else
 
 static size_t config_hashmap_init_size = 11; // 10009
 #define HASHMAP_SET_ASSOCIATIVITY 2
 #define OVFL_SEGMENT_SIZE 256
+#define STRPOOL_ARENA_SIZE (64 * 1024)
 
 #endif
 
+// Maximum load factor, in entries per 100 buckets, before the
+// hash table is doubled in size.  With 2-way set associative buckets,
+// an average of one entry per bucket keeps overflow chains rare.
+//
+static size_t config_hashmap_max_load = 100;
+
 static const bool upsert_true  = true;
 static const bool upsert_false = false;
 
-static bool config_use_hashtable = true;
+// Which kind of index new dictionaries get.  See dict_set_backend().
+// The default can be changed at build time, for example, with
+//   make CONFIG='-DDEBUG -DDICT_DEFAULT_BACKEND=DICT_BACKEND_SWISS'
+//
+#ifndef DICT_DEFAULT_BACKEND
+#define DICT_DEFAULT_BACKEND DICT_BACKEND_CHAINED
+#endif
+
+static int config_hash_backend = DICT_DEFAULT_BACKEND;
+
+static const dict_backend_t *const dict_backends[DICT_NBACKEND] = {
+    [DICT_BACKEND_CHAINED] = &dict_backend_chained,
+    [DICT_BACKEND_SWISS]   = &dict_backend_swiss,
+    [DICT_BACKEND_SORTED]  = &dict_backend_sorted,
+    [DICT_BACKEND_TRIE]    = &dict_backend_trie,
+    [DICT_BACKEND_LINEAR]  = &dict_backend_linear,
+};
+
+static inline const dict_backend_t *
+dict_backend(dict_t *dict)
+{
+    return (dict_backends[dict->hash_backend]);
+}
+
+// Cross-checking of hash table lookups against a linear search.
+// See dict_set_verify().
+//
+static int    config_verify_mode = DICT_VERIFY_OFF;
+static size_t config_verify_sample_rate = 1;
+static dict_verify_stats_t verify_stats;
+
+// Whether new dictionaries count their lookups.
+// See dict_set_count_lookups().
+//
+static bool config_count_lookups = false;
 
 
 // sym_poison probably ought to be defined to be something
@@ -70,13 +117,6 @@ static const char *sym_poison = "*POISON*";
 
 static const size_t undef_ovflnr = 0;
 
-// START   dict-impl.h
-
-void dict_grow(dict_t *dict);
-size_t dict_append_symbol(dict_t *dict, const char *s);
-
-// END     dict-impl.h
-
 
 void
 dict_init(dict_t *dict)
@@ -88,7 +128,17 @@ dict_init(dict_t *dict)
     // Reserve symnr 0 so it can be used for the null value for symbol numbers.
     dict->sv[0][0] = (char *)sym_poison;
     dict->len = 1;
+    dict->strpool = NULL;
     dict->hashtable = NULL;
+    dict->hash_backend = config_hash_backend;
+    dict->phash = NULL;
+    dict->img_strs = NULL;
+    dict->img_offv = NULL;
+    dict->counts = NULL;
+    if (config_count_lookups) {
+        dict->counts = (struct dict_counts *)
+            guard_calloc(1, sizeof (struct dict_counts));
+    }
 }
 
 dict_t *
@@ -111,22 +161,22 @@ dict_new()
 
 
 struct hashent {
-    size_t h;
-    size_t symnr;
+    uint32_t h;
+    symnr_t  symnr;
 };
 
 typedef struct hashent hashent_t;
 
 struct ovfl {
-    size_t ov_symnr;
-    size_t ov_next;
+    symnr_t  ov_symnr;
+    uint32_t ov_next;
 };
 
 typedef struct ovfl ovfl_t;
 
 struct hashbkt {
     hashent_t ent[HASHMAP_SET_ASSOCIATIVITY];
-    size_t chain;
+    uint32_t chain;
 };
 
 typedef struct hashbkt hashbkt_t;
@@ -134,9 +184,11 @@ typedef struct hashbkt hashbkt_t;
 struct hashmap {
     hashbkt_t *tbl;
     size_t tbl_sz;
+    size_t nent;        // Number of symbols in the table, for load factor
     ovfl_t *ovfl;
     size_t ovfl_sz;
     size_t ovfl_len;
+    bool mapped;        // tbl and ovfl belong to an image
 };
 
 typedef struct hashmap hashmap_t;
@@ -144,6 +196,89 @@ typedef struct hashmap hashmap_t;
 
 // ==================== End hashmap.h
 
+/*
+ * String pool.
+ *
+ * Symbols are not strdup()-ed one at a time.  They are packed,
+ * one after another, into large arenas.  Each symbol is preceded
+ * by a small header that caches its hash value and its length,
+ * so that a probe can reject a candidate symbol on those alone,
+ * without comparing strings.  The string itself is still
+ * null-terminated, and a symbol is still just a (char *)
+ * to the string, as far as the rest of the world is concerned.
+ *
+ * Arenas are never reallocated, so symbols never move.
+ * The string pool of a dictionary image uses the same entry layout.
+ */
+
+struct arena {
+    struct arena *prev;
+    size_t size;
+    size_t used;
+    char mem[];
+};
+
+typedef struct arena arena_t;
+
+/*
+ * Size of a string pool entry for a string of length |len|,
+ * including its header and its null terminator, rounded up
+ * so that the next header is aligned.
+ */
+static inline size_t
+strpool_entry_size(size_t len)
+{
+    size_t a = sizeof (symhdr_t);
+    return ((sizeof (symhdr_t) + len + 1 + a - 1) & ~(a - 1));
+}
+
+/*
+ * Store the |len| bytes at |s|, whose hash value is |h|,
+ * in the string pool of |dict|.  Return the address of the string.
+ */
+static char *
+strpool_add(dict_t *dict, const char *s, size_t len, size_t h)
+{
+    arena_t *arena = (arena_t *)dict->strpool;
+    size_t sz = strpool_entry_size(len);
+    symhdr_t *hdr;
+    char *sym;
+
+    if (arena == NULL || arena->used + sz > arena->size) {
+        size_t asz = sz > STRPOOL_ARENA_SIZE ? sz : STRPOOL_ARENA_SIZE;
+        arena_t *new_arena;
+
+        new_arena = (arena_t *) guard_malloc(sizeof (arena_t) + asz);
+        new_arena->prev = arena;
+        new_arena->size = asz;
+        new_arena->used = 0;
+        arena = new_arena;
+        dict->strpool = arena;
+    }
+
+    hdr = (symhdr_t *)(arena->mem + arena->used);
+    arena->used += sz;
+    hdr->h   = (uint32_t)h;
+    hdr->len = (uint32_t)len;
+    sym = (char *)(hdr + 1);
+    memcpy(sym, s, len);
+    sym[len] = '\0';
+    return (sym);
+}
+
+static void
+strpool_delete(dict_t *dict)
+{
+    arena_t *arena = (arena_t *)dict->strpool;
+
+    while (arena != NULL) {
+        arena_t *prev = arena->prev;
+        free(arena);
+        arena = prev;
+    }
+    dict->strpool = NULL;
+}
+
 
 static hashmap_t *
 hashmap_new(size_t tbl_sz)
@@ -155,12 +290,35 @@ hashmap_new(size_t tbl_sz)
     map = (hashmap_t *) guard_malloc(sizeof (hashmap_t));
     map->tbl = (hashbkt_t *) guard_calloc(tbl_sz, sizeof (hashbkt_t));
     map->tbl_sz = tbl_sz;
+    map->nent = 0;
     map->ovfl = NULL;
     map->ovfl_sz = 0;
+    map->ovfl_len = 0;
+    map->mapped = false;
     return (map);
 }
 
-#ifdef USE_REHASH
+/*
+ * Number of buckets needed to hold |n| entries
+ * without exceeding the maximum load factor.
+ * Always odd, because the bucket number is the hash modulo the size.
+ */
+static size_t
+hashmap_size_for(size_t n)
+{
+    size_t sz = (n * 100) / config_hashmap_max_load + 1;
+
+    if (sz < config_hashmap_init_size) {
+        sz = config_hashmap_init_size;
+    }
+    return (sz | 1);
+}
+
+static inline bool
+hashmap_overloaded(hashmap_t *map)
+{
+    return (map->nent * 100 > map->tbl_sz * config_hashmap_max_load);
+}
 
 /*
  * A hashmap does not hold the strings themselves, only index numbers
@@ -185,27 +343,6 @@ hashmap_delete(hashmap_t *map)
     }
 }
 
-#endif /* USE_REHASH */
-
-/*
- * Jenkins one-at-a-time hash
- */
-static size_t
-hash_symbol(const char *s)
-{
-    uint32_t hash, i;
-
-    for(hash = i = 0; s[i]; ++i) {
-        hash += s[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-    }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
-}
-
 static size_t
 append_ovfl(hashmap_t *map, size_t symnr)
 {
@@ -232,17 +369,13 @@ append_ovfl(hashmap_t *map, size_t symnr)
     return (ovfl_entnr);
 }
 
+/*
+ * Insert |symnr|, whose symbol has hash value |h|, into |map|.
+ * If it is already there, do nothing.
+ */
 static void
-dict_symnr_add_hash(dict_t *dict, size_t symnr)
+hashmap_insert(hashmap_t *map, size_t h, size_t symnr)
 {
-    hashmap_t *map = (hashmap_t *)dict->hashtable;
-    if (map == NULL) {
-        fprintf(stderr, "null hashmap\n");
-        abort();
-    }
-
-    char *sym = dict_getname_nr(dict, symnr);
-    size_t h = hash_symbol(sym);
     size_t bktnr = h % map->tbl_sz;
     hashbkt_t *bkt = map->tbl + bktnr;
     hashent_t *entv = bkt->ent;
@@ -251,6 +384,7 @@ dict_symnr_add_hash(dict_t *dict, size_t symnr)
         if (entv[entnr].symnr == undef_symnr) {
             entv[entnr].h = h;
             entv[entnr].symnr = symnr;
+            ++map->nent;
             return;
         }
         if (entv[entnr].symnr == symnr) {
@@ -263,6 +397,7 @@ dict_symnr_add_hash(dict_t *dict, size_t symnr)
     if (bkt->chain == undef_ovflnr) {
         ovfl_entnr = append_ovfl(map, symnr);
         bkt->chain = ovfl_entnr;
+        ++map->nent;
         return;
     }
 
@@ -279,72 +414,173 @@ dict_symnr_add_hash(dict_t *dict, size_t symnr)
 
     size_t new_ovfl_entnr = append_ovfl(map, symnr);
     map->ovfl[ovfl_entnr].ov_next = new_ovfl_entnr;
-    return;
+    ++map->nent;
 }
 
-#ifdef USE_REHASH
-
+/*
+ * Move every entry of the hash table of |dict| into a new table
+ * of |sz| buckets, including the entries on overflow chains.
+ * Overflow entries do not record the hash value,
+ * so it is taken from the header of the symbol.
+ */
 static void
 dict_rehash_all(dict_t *dict, size_t sz)
 {
     hashmap_t *oldmap;
+    hashmap_t *newmap;
     size_t bktnr;
 
     oldmap = (hashmap_t *)dict->hashtable;
-    dict->hashtable = hashmap_new(sz);
+    newmap = hashmap_new(sz);
+    dict->hashtable = newmap;
 
     if (oldmap == NULL) {
         return;
     }
 
-    for (bktnr = 0; bktnr <= oldmap->tbl_sz; ++bktnr) {
+    for (bktnr = 0; bktnr < oldmap->tbl_sz; ++bktnr) {
         hashbkt_t *bkt = oldmap->tbl + bktnr;
         hashent_t *entv = bkt->ent;
         size_t entnr;
+        size_t ovfl_entnr;
+
         for (entnr = 0; entnr < HASHMAP_SET_ASSOCIATIVITY; ++entnr) {
-            dict_symnr_add_hash(dict, entv[entnr].symnr);
+            if (entv[entnr].symnr != undef_symnr) {
+                hashmap_insert(newmap, entv[entnr].h, entv[entnr].symnr);
+            }
+        }
+
+        for (ovfl_entnr = bkt->chain;
+             ovfl_entnr != undef_ovflnr;
+             ovfl_entnr = oldmap->ovfl[ovfl_entnr].ov_next) {
+            size_t symnr = oldmap->ovfl[ovfl_entnr].ov_symnr;
+            char *sym = dict_getname_nr(dict, symnr);
+            hashmap_insert(newmap, sym_hdr(sym)->h, symnr);
         }
     }
 
     hashmap_delete(oldmap);
+    free(oldmap);
+}
+
+/*
+ * Select the kind of index for dictionaries that do not have one yet.
+ * Dictionaries that already have an index keep it.
+ */
+void
+dict_set_backend(int backend)
+{
+    config_hash_backend = backend;
+}
+
+/*
+ * Return the kind of index called |name|, or -1 if there is none.
+ */
+int
+dict_backend_by_name(const char *name)
+{
+    int backend;
+
+    for (backend = 0; backend < DICT_NBACKEND; ++backend) {
+        if (strcmp(name, dict_backends[backend]->name) == 0) {
+            return (backend);
+        }
+    }
+    return (-1);
+}
+
+const char *
+dict_backend_name(int backend)
+{
+    if (backend < 0 || backend >= DICT_NBACKEND) {
+        return (NULL);
+    }
+    return (dict_backends[backend]->name);
+}
+
+/*
+ * Create the index of |dict|, of whichever kind is configured,
+ * with room for |n| symbols, and enter all the symbols that are
+ * already in the dictionary.
+ */
+static void
+dict_index_new(dict_t *dict, size_t n)
+{
+    if (n < dict->len) {
+        n = dict->len;
+    }
+
+    dict->hash_backend = config_hash_backend;
+    dict_backend(dict)->create(dict, n);
+}
+
+static void
+dict_index_delete(dict_t *dict)
+{
+    if (dict->hashtable == NULL) {
+        return;
+    }
+    dict_backend(dict)->destroy(dict);
+    dict->hashtable = NULL;
 }
 
-#endif /* USE_REHASH */
+/*
+ * Make room for a total of |n| symbols in |dict|, so that bulk loading
+ * does not have to grow the symbol vector, or rehash, along the way.
+ */
+void
+dict_reserve(dict_t *dict, size_t n)
+{
+    if (dict->img_offv != NULL) {
+        dict_thaw(dict);
+    }
+
+    while (dict->sz < n + 1) {
+        dict_grow(dict);
+    }
+
+    if (dict->hashtable == NULL) {
+        dict_index_new(dict, n);
+        return;
+    }
+    dict_backend(dict)->reserve(dict, n);
+}
 
+/*
+ * Look up the symbol, |s|, of length |len|, whose hash value is |h|.
+ *
+ * If it is not there, and |upsert| is true, then append it
+ * to the dictionary and link it into the hash table, in the same
+ * probe -- the first free entry in its bucket, or else the end
+ * of the overflow chain of its bucket -- and set |*rinserted|.
+ */
 static size_t
-dict_find_hash(dict_t *dict, const char *s, bool upsert)
+dict_find_hash(dict_t *dict, const char *s, size_t len, size_t h,
+    bool upsert, bool *rinserted)
 {
     size_t symnr;
-    size_t new_symnr;
-    char *sym;
     hashmap_t *map = (hashmap_t *)dict->hashtable;
-    if (map == NULL) {
-        map = hashmap_new(0);
-        dict->hashtable = map;
-    }
-    size_t h = hash_symbol(s);
     size_t bktnr = h % map->tbl_sz;
     hashbkt_t *bkt = map->tbl + bktnr;
     hashent_t *entv = bkt->ent;
     size_t entnr;
     for (entnr = 0; entnr < HASHMAP_SET_ASSOCIATIVITY; ++entnr) {
+        dict_count_probe(dict);
         symnr = entv[entnr].symnr;
         if (symnr == undef_symnr) {
-            if (upsert) {
-                new_symnr = dict_append_symbol(dict, s);
-                entv[entnr].h = h;
-                entv[entnr].symnr = new_symnr;
-                break;
-            }
-            else {
+            if (!upsert) {
                 return (undef_symnr);
             }
+            symnr = dict_append_symbol(dict, s, len, h);
+            entv[entnr].h = h;
+            entv[entnr].symnr = symnr;
+            goto inserted;
         }
 
         if (h == entv[entnr].h) {
-            sym = dict_getname_nr(dict, symnr);
-            if (sym != NULL && strcmp(s, sym) == 0) {
-                return (entv[entnr].symnr);
+            if (symbol_match(dict, dict_getname_nr(dict, symnr),
+                             s, len, h)) {
+                return (symnr);
             }
         }
     }
@@ -352,96 +588,157 @@ dict_find_hash(dict_t *dict, const char *s, bool upsert)
     // All entries in the hash bucket itself have been searched
     // and the given symbol was not found.
     //
-    // Start following the chain of overflow entries, if any.
-
-    if (bkt->chain == undef_ovflnr) {
-        // There are no overflows in this hash bucket.
-        //
-        if (upsert) {
-            // Create an overflow entry
-            // and initialize the chain for this hash bucket.
-            size_t new_ovfl_entnr = append_ovfl(map, new_symnr);
-            bkt->chain = new_ovfl_entnr;
-            return (new_symnr);
-        }
-        else {
-            return (undef_symnr);
-        }
-    }
+    // Follow the chain of overflow entries, if any,
+    // remembering the last one, in case we have to extend the chain.
 
-    // There is already a chain of overflow symbols for this hash bucket.
-    // Following the next links from one overflow entry to the next.
-    //
     size_t ovfl_entnr;
+    size_t last_ovfl_entnr = undef_ovflnr;
 
-    ovfl_entnr = bkt->chain;
-    symnr = map->ovfl[ovfl_entnr].ov_symnr;
-    sym = dict_getname_nr(dict, symnr);
-    if (sym != NULL && strcmp(s, sym) == 0) {
-        return (symnr);
-    }
-
-    while (map->ovfl[ovfl_entnr].ov_next != undef_ovflnr) {
-        ovfl_entnr = map->ovfl[ovfl_entnr].ov_next;
+    for (ovfl_entnr = bkt->chain;
+         ovfl_entnr != undef_ovflnr;
+         ovfl_entnr = map->ovfl[ovfl_entnr].ov_next) {
+        dict_count_probe(dict);
         symnr = map->ovfl[ovfl_entnr].ov_symnr;
-        sym = dict_getname_nr(dict, symnr);
-        if (sym != NULL && strcmp(s, sym) == 0) {
+        if (symbol_match(dict, dict_getname_nr(dict, symnr), s, len, h)) {
             return (symnr);
         }
+        last_ovfl_entnr = ovfl_entnr;
     }
 
-    // We got to the end of the overfow chain, and found no match.
+    // We got to the end of the overflow chain, and found no match.
     //
-    if (upsert) {
-        size_t new_ovfl_entnr = append_ovfl(map, new_symnr);
-        map->ovfl[ovfl_entnr].ov_symnr = new_ovfl_entnr;
-        return (new_symnr);
+    if (!upsert) {
+        return (undef_symnr);
     }
 
-    return (undef_symnr);
+    // append_ovfl() can move the overflow array, but not the buckets,
+    // so link the new entry by index, after it has been appended.
+    //
+    symnr = dict_append_symbol(dict, s, len, h);
+    ovfl_entnr = append_ovfl(map, symnr);
+    if (last_ovfl_entnr == undef_ovflnr) {
+        bkt->chain = ovfl_entnr;
+    }
+    else {
+        map->ovfl[last_ovfl_entnr].ov_next = ovfl_entnr;
+    }
+
+inserted:
+    ++map->nent;
+    *rinserted = true;
+    if (hashmap_overloaded(map)) {
+        dict_rehash_all(dict, map->tbl_sz * 2 + 1);
+    }
+    return (symnr);
 }
 
 
-void
-dump_symbols(dict_t *dict)
+// ============== chained hash table dict backend
+
+static void
+chained_create(dict_t *dict, size_t n)
 {
+    hashmap_t *map = hashmap_new(hashmap_size_for(n));
     size_t symnr;
 
     for (symnr = 1; symnr < dict->len; ++symnr) {
-        size_t sym_seg = symnr / dict_segment_size;
-        size_t sym_off = symnr - (sym_seg * dict_segment_size);
-        char **entv = dict->sv[sym_seg];
-        fprintf(stderr, "%7zu = [%s]\n", symnr, entv[sym_off]);
+        char *sym = dict_getname_nr(dict, symnr);
+        hashmap_insert(map, sym_hdr(sym)->h, symnr);
     }
+    dict->hashtable = map;
 }
 
-size_t
-dict_find_linear(dict_t *dict, const char *s)
+/*
+ * The buckets of a chained hash table that belongs to a mapped image
+ * are not ours to free.
+ */
+static void
+chained_destroy(dict_t *dict)
 {
-    size_t symnr;
+    hashmap_t *map = (hashmap_t *)dict->hashtable;
 
-    for (symnr = 1; symnr < dict->len; ++symnr) {
-        size_t sym_seg = symnr / dict_segment_size;
-        size_t sym_off = symnr - (sym_seg * dict_segment_size);
-        char **entv = dict->sv[sym_seg];
-        if (strcmp(s, entv[sym_off]) == 0) {
-            return (symnr);
-        }
+    if (!map->mapped) {
+        hashmap_delete(map);
     }
-    return (undef_symnr);
+    free(map);
 }
 
 static void
-dump_dict_hashtable(dict_t *dict)
+chained_reserve(dict_t *dict, size_t n)
+{
+    hashmap_t *map = (hashmap_t *)dict->hashtable;
+    size_t sz = hashmap_size_for(n);
+
+    if (map->tbl_sz < sz) {
+        dict_rehash_all(dict, sz);
+    }
+}
+
+static size_t
+chained_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    return (dict_find_hash(dict, s, len, hash_fold(h), upsert, rinserted));
+}
+
+static void
+chained_prefetch(dict_t *dict, uint64_t h)
+{
+    hashmap_t *map = (hashmap_t *)dict->hashtable;
+
+    __builtin_prefetch(map->tbl + hash_fold(h) % map->tbl_sz);
+}
+
+static inline size_t
+hist_bin(size_t n)
+{
+    return (n < DICT_STATS_NHIST ? n : DICT_STATS_NHIST - 1);
+}
+
+static void
+chained_stats(dict_t *dict, dict_stats_t *rstats)
 {
-    size_t symnr;
     hashmap_t *map = (hashmap_t *)dict->hashtable;
     size_t bktnr;
 
-    if (map == NULL) {
-        fprintf(stderr, "No hash table.\n");
-        return;
+    rstats->tbl_bytes = map->tbl_sz * sizeof (hashbkt_t);
+    rstats->ovfl_bytes = map->ovfl_sz * sizeof (ovfl_t);
+    rstats->index_bytes = sizeof (hashmap_t)
+        + rstats->tbl_bytes + rstats->ovfl_bytes;
+    rstats->nbkt = map->tbl_sz;
+    rstats->load_factor = (double)map->nent / map->tbl_sz;
+
+    for (bktnr = 0; bktnr < map->tbl_sz; ++bktnr) {
+        hashbkt_t *bkt = map->tbl + bktnr;
+        size_t nent = 0;
+        size_t chain = 0;
+        size_t entnr;
+        size_t ovfl_entnr;
+
+        for (entnr = 0; entnr < HASHMAP_SET_ASSOCIATIVITY; ++entnr) {
+            if (bkt->ent[entnr].symnr != undef_symnr) {
+                ++nent;
+            }
+        }
+        for (ovfl_entnr = bkt->chain;
+             ovfl_entnr != undef_ovflnr;
+             ovfl_entnr = map->ovfl[ovfl_entnr].ov_next) {
+            ++chain;
+        }
+        ++rstats->bkt_hist[hist_bin(nent + chain)];
+        ++rstats->chain_hist[hist_bin(chain)];
+        if (chain > rstats->max_chain) {
+            rstats->max_chain = chain;
+        }
     }
+}
+
+static void
+chained_dump(dict_t *dict)
+{
+    hashmap_t *map = (hashmap_t *)dict->hashtable;
+    size_t symnr;
+    size_t bktnr;
 
     for (bktnr = 0; bktnr < map->tbl_sz; ++bktnr) {
         hashbkt_t *bkt = map->tbl + bktnr;
@@ -461,11 +758,11 @@ dump_dict_hashtable(dict_t *dict)
 
             ovfl_entnr = bkt->chain;
             fprintf(stderr, "  => ");
-            fprintf(stderr, "[%zu]=%zu",
+            fprintf(stderr, "[%zu]=%u",
                     ovfl_entnr, map->ovfl[ovfl_entnr].ov_symnr);
             while (map->ovfl[ovfl_entnr].ov_next != undef_ovflnr) {
                 ovfl_entnr = map->ovfl[ovfl_entnr].ov_next;
-                fprintf(stderr, "->[%zu]=%zu",
+                fprintf(stderr, "->[%zu]=%u",
                         ovfl_entnr, map->ovfl[ovfl_entnr].ov_symnr);
             }
         }
@@ -473,99 +770,551 @@ dump_dict_hashtable(dict_t *dict)
     }
 }
 
-size_t
-dict_find(dict_t *dict, const char *s)
-{
-    (void) upsert_true;
+const dict_backend_t dict_backend_chained = {
+    .name     = "chained",
+    .create   = chained_create,
+    .destroy  = chained_destroy,
+    .reserve  = chained_reserve,
+    .find     = chained_find,
+    .prefetch = chained_prefetch,
+    .freeze   = dict_freeze_phash,
+    .stats    = chained_stats,
+    .dump     = chained_dump,
+};
 
-    if (config_use_hashtable) {
-        if (dict->hashtable == NULL) {
-            dict->hashtable = (hashmap_t *) hashmap_new(0);
-        }
-        size_t hsymnr = dict_find_hash(dict, s, upsert_false);
-        size_t lsymnr = dict_find_linear(dict, s);
-        if (hsymnr != lsymnr) {
-            fprintf(stderr, "Error: hsymnr=%zu, lsymnr=%zu, s=[%s]\n",
-                hsymnr, lsymnr, s);
-            dump_dict_hashtable(dict);
-            fprintf(stderr, "\nSymbols\n-------\n");
-            dump_symbols(dict);
-            abort();
-        }
-        return (hsymnr);
-        // XXX return (dict_find_hash(dict, s, upsert_false));
-    }
-    else {
-        return (dict_find_linear(dict, s));
-    }
-}
+// ============== linear search dict backend
 
-char *
-dict_getname_nr(dict_t *dict, size_t symnr)
-{
-    size_t sym_seg = symnr / dict_segment_size;
-    size_t sym_off = symnr - (sym_seg * dict_segment_size);
-    char **entv = dict->sv[sym_seg];
+/*
+ * No index at all.  Every lookup is a linear search of the symbols.
+ * There is nothing to allocate, but dict->hashtable must not be NULL,
+ * or the index would be created over and over; so it points here.
+ */
+static char linear_placeholder;
 
-    if (symnr == undef_symnr) {
-        return (NULL);
-    }
-    return (entv[sym_off]);
+static void
+linear_create(dict_t *dict, size_t n)
+{
+    (void)n;
+    dict->hashtable = &linear_placeholder;
 }
 
-char *
-dict_getname_str(dict_t *dict, const char *s)
+static void
+linear_destroy(dict_t *dict)
 {
-    size_t pos = dict_find(dict, s);
-    return (dict_getname_nr(dict, pos));
+    (void)dict;
 }
 
+static void
+linear_reserve(dict_t *dict, size_t n)
+{
+    (void)dict;
+    (void)n;
+}
 
 /*
- * We have already determined that the symbol, |s| is not in the dictionary.
- * It is to be added.  It is appended to the symbol table.
- * |dict_append_symbol()| does not do anything with the hash table,
- * it just adds the symnr and the string.
+ * The same search as dict_find_linear_len(), but counted.
  */
-
-size_t
-dict_append_symbol(dict_t *dict, const char *s)
+static size_t
+linear_search(dict_t *dict, const char *s, size_t len)
 {
     size_t symnr;
-    size_t sym_seg;
-    size_t sym_off;
-    char **entv;
 
-    symnr = dict->len;
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
 
-    if (symnr >= dict->sz) {
-        dict_grow(dict);
+        dict_count_probe(dict);
+        if (sym_hdr(sym)->len == len) {
+            dict_count_strcmp(dict);
+            if (memcmp(sym, s, len) == 0) {
+                return (symnr);
+            }
+        }
     }
-
+    return (undef_symnr);
+}
+
+static size_t
+linear_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    size_t symnr;
+
+    symnr = linear_search(dict, s, len);
+    if (symnr == undef_symnr && upsert) {
+        symnr = dict_append_symbol(dict, s, len, h);
+        *rinserted = true;
+    }
+    return (symnr);
+}
+
+static void
+linear_stats(dict_t *dict, dict_stats_t *rstats)
+{
+    (void)dict;
+    rstats->index_bytes = 0;
+}
+
+static void
+linear_dump(dict_t *dict)
+{
+    (void)dict;
+    fprintf(stderr, "No index; linear search.\n");
+}
+
+const dict_backend_t dict_backend_linear = {
+    .name     = "linear",
+    .create   = linear_create,
+    .destroy  = linear_destroy,
+    .reserve  = linear_reserve,
+    .find     = linear_find,
+    .prefetch = NULL,
+    .freeze   = NULL,
+    .stats    = linear_stats,
+    .dump     = linear_dump,
+};
+
+static void
+dict_count_start(dict_t *dict)
+{
+    dict->counts->probes = 0;
+    dict->counts->strcmps = 0;
+}
+
+static void
+dict_count_end(dict_t *dict, bool hit)
+{
+    struct dict_counts *counts = dict->counts;
+    dict_lookup_stats_t *total = &counts->total;
+
+    if (hit) {
+        ++total->nhit;
+        total->hit_probes += counts->probes;
+        total->hit_strcmps += counts->strcmps;
+        if (counts->probes > total->hit_max_probes) {
+            total->hit_max_probes = counts->probes;
+        }
+    }
+    else {
+        ++total->nmiss;
+        total->miss_probes += counts->probes;
+        total->miss_strcmps += counts->strcmps;
+        if (counts->probes > total->miss_max_probes) {
+            total->miss_max_probes = counts->probes;
+        }
+    }
+}
+
+/*
+ * Look up (or upsert) in whichever kind of index |dict| has,
+ * creating it first, if need be.
+ */
+static inline size_t
+dict_index_find(dict_t *dict, const char *s, size_t len, uint64_t h,
+    bool upsert, bool *rinserted)
+{
+    size_t symnr;
+
+    if (dict->hashtable == NULL) {
+        dict_index_new(dict, 0);
+    }
+    if (dict->counts == NULL) {
+        return (dict_backend(dict)->find(dict, s, len, h, upsert, rinserted));
+    }
+
+    dict_count_start(dict);
+    symnr = dict_backend(dict)->find(dict, s, len, h, upsert, rinserted);
+    dict_count_end(dict, upsert ? !*rinserted : symnr != undef_symnr);
+    return (symnr);
+}
+
+void
+dump_symbols(dict_t *dict)
+{
+    size_t symnr;
+
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        fprintf(stderr, "%7zu = [%s]\n", symnr, dict_getname_nr(dict, symnr));
+    }
+}
+
+size_t
+dict_find_linear_len(dict_t *dict, const char *s, size_t len)
+{
+    size_t symnr;
+
+    // Do not trust the cached hash value.  This is what hash lookups
+    // are checked against.
+    //
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
+        if (sym_hdr(sym)->len == len && memcmp(sym, s, len) == 0) {
+            return (symnr);
+        }
+    }
+    return (undef_symnr);
+}
+
+size_t
+dict_find_linear(dict_t *dict, const char *s)
+{
+    return (dict_find_linear_len(dict, s, strlen(s)));
+}
+
+static void
+dump_dict_hashtable(dict_t *dict)
+{
+    if (dict->hashtable == NULL) {
+        fprintf(stderr, "No hash table.\n");
+        return;
+    }
+    dict_backend(dict)->dump(dict);
+}
+
+/*
+ * Verification is for debugging changes to hashing.
+ * It costs a linear search of the whole dictionary, so it is off,
+ * by default.  In sampled mode, only 1 in |sample_rate| lookups
+ * is checked.
+ */
+void
+dict_set_verify(int mode, size_t sample_rate)
+{
+    config_verify_mode = mode;
+    config_verify_sample_rate = sample_rate ? sample_rate : 1;
+}
+
+void
+dict_get_verify_stats(dict_verify_stats_t *rstats)
+{
+    *rstats = verify_stats;
+}
+
+/*
+ * Cross-check the result of a hash lookup, |hsymnr|,
+ * against a linear search, if this lookup is due for a check.
+ * On a mismatch, complain, and believe the linear search.
+ * The whole hash table is dumped only for the first mismatch.
+ */
+static size_t
+dict_verify_find(dict_t *dict, const char *s, size_t len, size_t hsymnr)
+{
+    size_t lsymnr;
+
+    ++verify_stats.nlookup;
+    if (config_verify_mode == DICT_VERIFY_SAMPLED
+        && verify_stats.nlookup % config_verify_sample_rate != 0) {
+        return (hsymnr);
+    }
+
+    ++verify_stats.ncheck;
+    lsymnr = dict_find_linear_len(dict, s, len);
+    if (hsymnr == lsymnr) {
+        return (hsymnr);
+    }
+
+    fprintf(stderr, "Error: hsymnr=%zu, lsymnr=%zu, s=[%.*s]\n",
+        hsymnr, lsymnr, (int)len, s);
+    if (verify_stats.nmismatch == 0) {
+        dump_dict_hashtable(dict);
+        fprintf(stderr, "\nSymbols\n-------\n");
+        dump_symbols(dict);
+    }
+    ++verify_stats.nmismatch;
+    return (lsymnr);
+}
+
+/*
+ * Look up the symbol, |s|, of length |len|, whose dict_hash() value,
+ * |h|, the caller has already computed.  |s| need not be null-terminated.
+ */
+size_t
+dict_find_prehashed(dict_t *dict, const char *s, size_t len, uint64_t h)
+{
+    size_t hsymnr;
+
+    if (dict->phash != NULL && dict->counts != NULL) {
+        dict_count_start(dict);
+        hsymnr = phash_find(dict, (phash_t *)dict->phash, s, len, h);
+        dict_count_end(dict, hsymnr != undef_symnr);
+    }
+    else if (dict->phash != NULL) {
+        hsymnr = phash_find(dict, (phash_t *)dict->phash, s, len, h);
+    }
+    else {
+        hsymnr = dict_index_find(dict, s, len, h, upsert_false, NULL);
+    }
+    if (config_verify_mode != DICT_VERIFY_OFF) {
+        hsymnr = dict_verify_find(dict, s, len, hsymnr);
+    }
+    return (hsymnr);
+}
+
+void
+dict_find_batch(dict_t *dict, const dict_key_t *keyv, size_t n,
+    symnr_t *outv)
+{
+    void (*prefetch)(dict_t *, uint64_t);
+    size_t done;
+    size_t m;
+    size_t i;
+
+    // Verification and counting gain nothing from batching.
+    if (config_verify_mode != DICT_VERIFY_OFF || dict->counts != NULL
+        || (dict->phash == NULL && dict->hashtable == NULL)) {
+        for (i = 0; i < n; ++i) {
+            outv[i] = dict_find_prehashed(dict, keyv[i].s, keyv[i].len,
+                                          keyv[i].h);
+        }
+        return;
+    }
+
+    prefetch = dict_backend(dict)->prefetch;
+    for (done = 0; done < n; done += m) {
+        const dict_key_t *kv = keyv + done;
+
+        m = n - done < DICT_BATCH ? n - done : DICT_BATCH;
+        if (dict->phash != NULL) {
+            phash_find_batch(dict, (phash_t *)dict->phash, kv, m,
+                             outv + done);
+            continue;
+        }
+        for (i = 0; prefetch != NULL && i < m; ++i) {
+            prefetch(dict, kv[i].h);
+        }
+        for (i = 0; i < m; ++i) {
+            outv[done + i] = dict_index_find(dict, kv[i].s, kv[i].len,
+                                             kv[i].h, upsert_false, NULL);
+        }
+    }
+}
+
+size_t
+dict_find(dict_t *dict, const char *s)
+{
+    size_t len = strlen(s);
+
+    return (dict_find_prehashed(dict, s, len, dict_hash(s, len)));
+}
+
+char *
+dict_getname_nr(dict_t *dict, size_t symnr)
+{
+    size_t sym_seg = symnr / dict_segment_size;
+    size_t sym_off = symnr - (sym_seg * dict_segment_size);
+
+    if (symnr == undef_symnr) {
+        return (NULL);
+    }
+    if (dict->img_offv != NULL) {
+        return ((char *)(dict->img_strs + dict->img_offv[symnr]));
+    }
+    return (dict->sv[sym_seg][sym_off]);
+}
+
+char *
+dict_getname_str(dict_t *dict, const char *s)
+{
+    size_t pos = dict_find(dict, s);
+    return (dict_getname_nr(dict, pos));
+}
+
+
+/*
+ * We have already determined that the symbol, |s| is not in the dictionary.
+ * It is to be added.  It is appended to the symbol table.
+ * |dict_append_symbol()| does not do anything with the hash table,
+ * it just adds the symnr and a copy of the |len| bytes of the string,
+ * along with its hash value, |h|, to the string pool.
+ */
+
+size_t
+dict_append_symbol(dict_t *dict, const char *s, size_t len, size_t h)
+{
+    size_t symnr;
+    size_t sym_seg;
+    size_t sym_off;
+    char **entv;
+
+    symnr = dict->len;
+
+    if (symnr >= dict_max_symbols) {
+        fprintf(stderr, "Too many symbols.  Limit is %zu.\n",
+            dict_max_symbols - 1);
+        abort();
+    }
+    if (symnr >= dict->sz) {
+        dict_grow(dict);
+    }
+
     sym_seg = symnr / dict_segment_size;
     sym_off = symnr - (sym_seg * dict_segment_size);
     entv = dict->sv[sym_seg];
-    entv[sym_off] = strdup(s);
+    entv[sym_off] = strpool_add(dict, s, len, h);
     ++dict->len;
     return (symnr);
 }
 
+/*
+ * Find the symbol, |s|, of length |len|, or add it if it is not there.
+ * |s| need not be null-terminated.
+ *
+ * The symbol is hashed once, and the hash table is probed once;
+ * a new symbol is linked in at the place where the search for it ended.
+ * Set |*rinserted| to tell whether the symbol was added.
+ */
 size_t
-dict_add(dict_t *dict, const char *s)
+dict_upsert(dict_t *dict, const char *s, size_t len, bool *rinserted)
 {
     size_t symnr;
+    uint64_t h;
 
-    symnr = dict_find(dict, s);
-    if (symnr == undef_symnr) {
-        symnr = dict_append_symbol(dict, s);
+    *rinserted = false;
+    if (dict->img_offv != NULL) {
+        dict_thaw(dict);
+    }
+
+    h = dict_hash(s, len);
+    if (config_verify_mode != DICT_VERIFY_OFF) {
+        symnr = dict_index_find(dict, s, len, h, upsert_false, NULL);
+        symnr = dict_verify_find(dict, s, len, symnr);
+        if (symnr != undef_symnr) {
+            return (symnr);
+        }
     }
+    symnr = dict_index_find(dict, s, len, h, upsert_true, rinserted);
 
-    if (config_use_hashtable) {
-        dict_symnr_add_hash(dict, symnr);
+    // The perfect hash index of a frozen dictionary
+    // does not know about the new symbol.
+    //
+    if (*rinserted && dict->phash != NULL) {
+        phash_delete((phash_t *)dict->phash);
+        dict->phash = NULL;
     }
     return (symnr);
 }
 
+size_t
+dict_add(dict_t *dict, const char *s)
+{
+    bool inserted;
+
+    return (dict_upsert(dict, s, strlen(s), &inserted));
+}
+
+/*
+ * Free everything that belongs to |dict|, including |dict| itself,
+ * which must have come from dict_new().  The symbols themselves
+ * are freed a whole arena at a time.  Nothing that belongs
+ * to a mapped image is freed.
+ */
+void
+dict_delete(dict_t *dict)
+{
+    size_t nseg = dict->sz / dict_segment_size;
+    size_t segnr;
+
+    dict_index_delete(dict);
+    phash_delete((phash_t *)dict->phash);
+    strpool_delete(dict);
+    for (segnr = 0; segnr < nseg; ++segnr) {
+        free(dict->sv[segnr]);
+    }
+    free(dict->sv);
+    free(dict->counts);
+    free(dict);
+}
+
+/*
+ * What freezing does depends on the kind of index.
+ * The chained hash table hands lookups over to a perfect hash index.
+ * Either way, the index is complete, so that lookups
+ * in a frozen dictionary never have to write anything.
+ */
+void
+dict_freeze(dict_t *dict)
+{
+    const dict_backend_t *backend;
+
+    if (dict->hashtable == NULL && dict->phash == NULL) {
+        dict_index_new(dict, 0);
+    }
+    backend = dict_backend(dict);
+
+    if (backend->freeze != NULL) {
+        backend->freeze(dict);
+    }
+}
+
+void
+dict_freeze_phash(dict_t *dict)
+{
+    if (dict->phash == NULL) {
+        dict->phash = phash_build(dict);
+    }
+}
+
+/*
+ * Count lookups in dictionaries made from now on, or not.
+ * See dict_lookup_stats_t.  Counting is for measurement; it is off,
+ * by default, and it turns off batching, so lookups are a bit slower.
+ */
+void
+dict_set_count_lookups(bool on)
+{
+    config_count_lookups = on;
+}
+
+/*
+ * Describe |dict| and its index, as they are now.
+ * The symbols of a mapped image are located by an offset vector,
+ * instead of the segment vector; that is counted as part of sv_bytes.
+ */
+void
+dict_stats(dict_t *dict, dict_stats_t *rstats)
+{
+    phash_t *ph = (phash_t *)dict->phash;
+    const arena_t *arena;
+
+    memset(rstats, 0, sizeof (*rstats));
+    rstats->backend = dict_backend(dict)->name;
+    rstats->lookup_index = ph != NULL ? "phash" : rstats->backend;
+    rstats->nsym = dict->len - 1;
+    rstats->frozen = ph != NULL;
+    rstats->mapped = dict->img_offv != NULL;
+
+    rstats->sv_bytes = (dict->sz / dict_segment_size) * sizeof (char **)
+        + dict->sz * sizeof (char *);
+    for (arena = (const arena_t *)dict->strpool;
+         arena != NULL;
+         arena = arena->prev) {
+        rstats->strs_bytes += sizeof (arena_t) + arena->size;
+        rstats->strs_used += arena->used;
+    }
+    if (rstats->mapped) {
+        size_t symnr;
+
+        rstats->sv_bytes += dict->len * sizeof (uint32_t);
+        for (symnr = 1; symnr < dict->len; ++symnr) {
+            const char *sym = dict_getname_nr(dict, symnr);
+            rstats->strs_used += strpool_entry_size(sym_hdr(sym)->len);
+        }
+        rstats->strs_bytes = rstats->strs_used;
+    }
+    if (ph != NULL) {
+        rstats->phash_bytes = sizeof (phash_t)
+            + (ph->nbkt + ph->nslot) * sizeof (uint32_t);
+    }
+
+    if (dict->hashtable != NULL) {
+        dict_backend(dict)->stats(dict, rstats);
+    }
+
+    if (dict->counts != NULL) {
+        rstats->counted = true;
+        rstats->lookups = dict->counts->total;
+    }
+}
+
 void
 dict_grow(dict_t *dict)
 {
@@ -574,3 +1323,395 @@ dict_grow(dict_t *dict)
     dict->sv[nseg] = (char **)guard_malloc(dict_segment_size * sizeof (char *));
     dict->sz += dict_segment_size;
 }
+
+
+// ============== Start  dict image
+
+/*
+ * Layout of a compiled dictionary image.
+ *
+ * Everything is relative to the start of the image, so the image
+ * can be mapped at any address.  All sections are aligned to
+ * the size of a size_t.  The hash table buckets and overflow
+ * entries contain only symbol numbers and chain indices, no pointers,
+ * so they are stored exactly as they are in memory.
+ * Offsets of symbols are 32 bits, like symbol numbers,
+ * so the string pool of an image is limited to 4 GiB.
+ *
+ */
+
+struct dict_image {
+    size_t len;         // Number of symbols, including reserved symnr 0
+    size_t backend;     // Kind of index the image was made with
+    size_t tbl_sz;      // Number of hash buckets, 0 if no hash table
+    size_t ovfl_len;    // Number of overflow entries
+    size_t strs_size;   // Size, in bytes, of the string pool entries
+    size_t offv_off;    // Offset of symbol offset vector
+    size_t tbl_off;     // Offset of hash buckets
+    size_t ovfl_off;    // Offset of overflow entries
+    size_t strs_off;    // Offset of string pool
+    uint64_t ph_seed;   // Perfect hash index, if frozen
+    size_t ph_nbkt;     // 0 if not frozen
+    size_t ph_nslot;
+    size_t ph_disp_off;
+    size_t ph_slot_off;
+};
+
+typedef struct dict_image dict_image_t;
+
+static inline size_t
+image_align(size_t sz)
+{
+    size_t a = sizeof (size_t);
+    return ((sz + a - 1) & ~(a - 1));
+}
+
+/*
+ * Only a chained hash table is stored in an image.  A dictionary
+ * with some other kind of index records its kind, and gets it built
+ * again when the image is mapped; see dict_image_map().
+ */
+static inline hashmap_t *
+dict_image_hashmap(dict_t *dict)
+{
+    if (dict->hash_backend != DICT_BACKEND_CHAINED) {
+        return (NULL);
+    }
+    return ((hashmap_t *)dict->hashtable);
+}
+
+static void
+dict_image_layout(dict_t *dict, dict_image_t *hdr)
+{
+    hashmap_t *map = dict_image_hashmap(dict);
+    phash_t *ph = (phash_t *)dict->phash;
+    size_t symnr;
+    size_t off;
+
+    hdr->len = dict->len;
+    hdr->backend = dict->hash_backend;
+    hdr->tbl_sz   = map ? map->tbl_sz : 0;
+    hdr->ovfl_len = (map && map->ovfl) ? map->ovfl_len : 0;
+    hdr->strs_size = 0;
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
+        hdr->strs_size += strpool_entry_size(sym_hdr(sym)->len);
+    }
+
+    off = image_align(sizeof (dict_image_t));
+    hdr->offv_off = off;
+    off += image_align(hdr->len * sizeof (uint32_t));
+    hdr->tbl_off = off;
+    off += image_align(hdr->tbl_sz * sizeof (hashbkt_t));
+    hdr->ovfl_off = off;
+    off += image_align(hdr->ovfl_len * sizeof (ovfl_t));
+
+    hdr->ph_seed  = ph ? ph->seed  : 0;
+    hdr->ph_nbkt  = ph ? ph->nbkt  : 0;
+    hdr->ph_nslot = ph ? ph->nslot : 0;
+    hdr->ph_disp_off = off;
+    off += image_align(hdr->ph_nbkt * sizeof (uint32_t));
+    hdr->ph_slot_off = off;
+    off += image_align(hdr->ph_nslot * sizeof (uint32_t));
+
+    hdr->strs_off = off;
+}
+
+size_t
+dict_image_size(dict_t *dict)
+{
+    dict_image_t hdr;
+
+    dict_image_layout(dict, &hdr);
+    return (image_align(hdr.strs_off + hdr.strs_size));
+}
+
+/*
+ * Serialize |dict| into |img|, which must be at least
+ * dict_image_size(dict) bytes, and aligned for a size_t.
+ */
+void
+dict_image_store(dict_t *dict, void *img)
+{
+    hashmap_t *map = dict_image_hashmap(dict);
+    dict_image_t hdr;
+    char *base = (char *)img;
+    uint32_t *offv;
+    char *strs;
+    size_t symnr;
+    size_t soff;
+
+    dict_image_layout(dict, &hdr);
+    memset(img, 0, image_align(hdr.strs_off + hdr.strs_size));
+    memcpy(base, &hdr, sizeof (hdr));
+
+    offv = (uint32_t *)(base + hdr.offv_off);
+    strs = base + hdr.strs_off;
+    offv[undef_symnr] = 0;
+    soff = 0;
+    for (symnr = 1; symnr < dict->len; ++symnr) {
+        const char *sym = dict_getname_nr(dict, symnr);
+        size_t sz = strpool_entry_size(sym_hdr(sym)->len);
+
+        // Copy the header along with the string.
+        // offv refers to the string, just past the header.
+        //
+        memcpy(strs + soff, sym_hdr(sym), sz);
+        offv[symnr] = soff + sizeof (symhdr_t);
+        soff += sz;
+    }
+
+    if (hdr.tbl_sz) {
+        memcpy(base + hdr.tbl_off, map->tbl, hdr.tbl_sz * sizeof (hashbkt_t));
+    }
+    if (hdr.ovfl_len) {
+        memcpy(base + hdr.ovfl_off, map->ovfl, hdr.ovfl_len * sizeof (ovfl_t));
+    }
+    if (hdr.ph_nbkt) {
+        phash_t *ph = (phash_t *)dict->phash;
+        memcpy(base + hdr.ph_disp_off, ph->disp,
+               hdr.ph_nbkt * sizeof (uint32_t));
+        memcpy(base + hdr.ph_slot_off, ph->slot,
+               hdr.ph_nslot * sizeof (uint32_t));
+    }
+}
+
+/*
+ * Does a section of |n| elements of |elsz| bytes, at offset |off|,
+ * fit in an image of |sz| bytes, and is it aligned?
+ * Written so that nothing can wrap around.
+ */
+static inline bool
+image_section_ok(size_t off, size_t n, size_t elsz, size_t sz)
+{
+    return (off % sizeof (size_t) == 0
+            && off <= sz
+            && n <= (sz - off) / elsz);
+}
+
+/*
+ * Check everything in the image |img| of size |sz| that a lookup
+ * would use as an index: section bounds, symbol offsets and lengths,
+ * and the symbol numbers and chain links in the hash table and
+ * in the perfect hash index.  A corrupt or truncated image is caught
+ * here, instead of being read out of bounds later.
+ *
+ * Return 0, and the number of symbols, including the reserved
+ * symbol number 0, in |*rlen|, or EINVAL.
+ */
+int
+dict_image_check(const void *img, size_t sz, size_t *rlen)
+{
+    const char *base = (const char *)img;
+    const uint32_t *offv;
+    const hashbkt_t *tbl;
+    const ovfl_t *ovfl;
+    const uint32_t *slot;
+    const char *strs;
+    dict_image_t hdr;
+    size_t symnr;
+    size_t i;
+    size_t k;
+
+    if (sz < sizeof (hdr)) {
+        return (EINVAL);
+    }
+    memcpy(&hdr, base, sizeof (hdr));
+    if (hdr.len == 0
+        || hdr.len > (size_t)UINT32_MAX
+        || hdr.backend >= DICT_NBACKEND
+        || (hdr.backend != DICT_BACKEND_CHAINED
+            && (hdr.tbl_sz != 0 || hdr.ph_nbkt != 0))
+        || hdr.strs_size > UINT32_MAX
+        || !image_section_ok(hdr.offv_off, hdr.len, sizeof (uint32_t), sz)
+        || !image_section_ok(hdr.tbl_off, hdr.tbl_sz, sizeof (hashbkt_t), sz)
+        || !image_section_ok(hdr.ovfl_off, hdr.ovfl_len, sizeof (ovfl_t), sz)
+        || !image_section_ok(hdr.ph_disp_off, hdr.ph_nbkt,
+                             sizeof (uint32_t), sz)
+        || !image_section_ok(hdr.ph_slot_off, hdr.ph_nslot,
+                             sizeof (uint32_t), sz)
+        || !image_section_ok(hdr.strs_off, hdr.strs_size, 1, sz)
+        || (hdr.ph_nbkt != 0
+            && (hdr.ph_nslot == 0 || hdr.ph_nslot != hdr.len - 1))) {
+        return (EINVAL);
+    }
+
+    // Each symbol is a whole string pool entry, header and all,
+    // and ends with a null byte.
+    //
+    offv = (const uint32_t *)(base + hdr.offv_off);
+    strs = base + hdr.strs_off;
+    for (symnr = 1; symnr < hdr.len; ++symnr) {
+        size_t off = offv[symnr];
+        size_t len;
+
+        if (off < sizeof (symhdr_t) || off % sizeof (symhdr_t) != 0
+            || off > hdr.strs_size) {
+            return (EINVAL);
+        }
+        len = sym_hdr(strs + off)->len;
+        if (len >= hdr.strs_size - off || strs[off + len] != '\0') {
+            return (EINVAL);
+        }
+    }
+
+    // Overflow entries are only ever appended to the end of a chain,
+    // so each link points further on; that also rules out cycles.
+    //
+    tbl = (const hashbkt_t *)(base + hdr.tbl_off);
+    ovfl = (const ovfl_t *)(base + hdr.ovfl_off);
+    for (i = 0; i < hdr.tbl_sz; ++i) {
+        for (k = 0; k < HASHMAP_SET_ASSOCIATIVITY; ++k) {
+            if (tbl[i].ent[k].symnr >= hdr.len) {
+                return (EINVAL);
+            }
+        }
+        if (tbl[i].chain != undef_ovflnr && tbl[i].chain >= hdr.ovfl_len) {
+            return (EINVAL);
+        }
+    }
+    for (i = 0; i < hdr.ovfl_len; ++i) {
+        if (ovfl[i].ov_symnr >= hdr.len
+            || (ovfl[i].ov_next != undef_ovflnr
+                && (ovfl[i].ov_next <= i || ovfl[i].ov_next >= hdr.ovfl_len))) {
+            return (EINVAL);
+        }
+    }
+
+    slot = (const uint32_t *)(base + hdr.ph_slot_off);
+    for (i = 0; i < hdr.ph_nslot; ++i) {
+        if (slot[i] >= hdr.len) {
+            return (EINVAL);
+        }
+    }
+
+    *rlen = hdr.len;
+    return (0);
+}
+
+/*
+ * Use the image |img| of size |sz| in place, as the contents of |dict|.
+ * Nothing in the image is modified.  The image must stay mapped
+ * for as long as |dict| is in use.
+ *
+ * The index stored in the image is used in place, too, if it is
+ * of the kind that is selected now; see dict_set_backend().
+ * Otherwise, an index of the selected kind is built, over the mapped
+ * symbols, and frozen, so that lookups never have to write anything.
+ *
+ * The image is not checked here.  An image that could be corrupt
+ * must first pass dict_image_check(), which costs time linear in
+ * its size; an image that was compiled into incbot need not.
+ *
+ * Return 0 on success, or EINVAL if |sz| is too small to hold
+ * an image, in which case |dict| is left as it was.
+ */
+int
+dict_image_map(dict_t *dict, const void *img, size_t sz)
+{
+    const char *base = (const char *)img;
+    dict_image_t hdr;
+    hashmap_t *map;
+
+    if (sz < sizeof (hdr)) {
+        return (EINVAL);
+    }
+    memcpy(&hdr, base, sizeof (hdr));
+
+    dict->len = hdr.len;
+    dict->img_offv = (const uint32_t *)(base + hdr.offv_off);
+    dict->img_strs = base + hdr.strs_off;
+    dict->hashtable = NULL;
+    dict->hash_backend = hdr.backend;
+    dict->phash = NULL;
+    if (hdr.backend != (size_t)config_hash_backend) {
+        dict_index_new(dict, 0);
+        dict_freeze(dict);
+        return (0);
+    }
+
+    if (hdr.tbl_sz) {
+        map = (hashmap_t *) guard_malloc(sizeof (hashmap_t));
+        map->tbl = (hashbkt_t *)(base + hdr.tbl_off);
+        map->tbl_sz = hdr.tbl_sz;
+        map->nent = hdr.len - 1;    // Every symbol is in the hash table
+        map->ovfl = hdr.ovfl_len ? (ovfl_t *)(base + hdr.ovfl_off) : NULL;
+        map->ovfl_sz = hdr.ovfl_len;
+        map->ovfl_len = hdr.ovfl_len;
+        map->mapped = true;
+        dict->hashtable = map;
+    }
+    if (hdr.ph_nbkt) {
+        phash_t *ph = (phash_t *) guard_malloc(sizeof (phash_t));
+        ph->seed  = hdr.ph_seed;
+        ph->nbkt  = hdr.ph_nbkt;
+        ph->nslot = hdr.ph_nslot;
+        ph->disp  = (const uint32_t *)(base + hdr.ph_disp_off);
+        ph->slot  = (const uint32_t *)(base + hdr.ph_slot_off);
+        ph->mapped = true;
+        dict->phash = ph;
+    }
+    if (dict->hashtable == NULL && dict->phash == NULL) {
+        dict_index_new(dict, 0);
+        dict_freeze(dict);
+    }
+    return (0);
+}
+
+/*
+ * Let go of a dictionary that was mapped by dict_image_map(),
+ * but not thawed.  Only what was built for it is freed;
+ * the image itself, and |dict|, are left to the caller.
+ */
+void
+dict_image_unmap(dict_t *dict)
+{
+    dict_index_delete(dict);
+    phash_delete((phash_t *)dict->phash);
+    dict->phash = NULL;
+}
+
+/*
+ * Copy a mapped dictionary to the heap, so that it can be modified.
+ * Symbols are appended in order, so all symbol numbers are preserved,
+ * and the index still holds; only a hash table that is part of
+ * the image has to be copied.
+ */
+void
+dict_thaw(dict_t *dict)
+{
+    hashmap_t *map = (hashmap_t *)dict->hashtable;
+    const char *strs = dict->img_strs;
+    const uint32_t *offv = dict->img_offv;
+    size_t len = dict->len;
+    size_t symnr;
+
+    dict->img_strs = NULL;
+    dict->img_offv = NULL;
+    dict->len = 1;
+    for (symnr = 1; symnr < len; ++symnr) {
+        const char *sym = strs + offv[symnr];
+        const symhdr_t *hdr = sym_hdr(sym);
+        dict_append_symbol(dict, sym, hdr->len, hdr->h);
+    }
+
+    if (map != NULL && dict->hash_backend == DICT_BACKEND_CHAINED
+        && map->mapped) {
+        hashbkt_t *tbl;
+        size_t sz;
+
+        sz = map->tbl_sz * sizeof (hashbkt_t);
+        tbl = (hashbkt_t *) guard_malloc(sz);
+        memcpy(tbl, map->tbl, sz);
+        map->tbl = tbl;
+        if (map->ovfl != NULL) {
+            ovfl_t *ovfl;
+
+            sz = map->ovfl_len * sizeof (ovfl_t);
+            ovfl = (ovfl_t *) guard_malloc(sz);
+            memcpy(ovfl, map->ovfl, sz);
+            map->ovfl = ovfl;
+        }
+        map->mapped = false;
+    }
+}
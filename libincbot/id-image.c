@@ -0,0 +1,598 @@
+/*
+ * Filename: src/libincbot/id-image.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Compiled, position-independent, mmap-able identifier tables
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parsing the text form of an id-table costs time proportional
+ * to the size of the table, every time incbot runs.
+ *
+ * A compiled image holds id_hot, id_cold, id_symtable and strtable
+ * exactly as they are in memory, except that everything that
+ * would be a pointer is an offset or a symbol number.  So, an image
+ * can be mmap()-ed read-only and used in place, at any address.
+ * The built-in image is trusted, so its startup cost does not depend
+ * on the size of the table.  An image given with -t could be corrupt,
+ * so every symbol number in it is checked before it is used, which
+ * costs time linear in its size, but much less than parsing text.
+ *
+ * An image is specific to the byte order and word size of the
+ * machine, and to the layout of idhot_t and idcold_t.  It is a cache, not
+ * an interchange format.  The text id-table is the source.
+ *
+ * Layout:
+ *   struct id_image_hdr
+ *   id_table hot records       (idhot_t[id_table_len])
+ *   id_table cold records      (idcold_t[id_table_len])
+ *   id_symtable image          (see dict_image_store()),
+ *                              including its perfect hash index
+ *   strtable image
+ *
+ * Each section starts on a cache-line boundary.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <errno.h>      // errno, EINVAL
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t, NULL
+#include <stdint.h>     // uint32_t, uint64_t
+#include <stdio.h>      // FILE, fopen, fwrite, fclose, fread, fileno
+#include <stdlib.h>     // free, exit
+#include <string.h>     // memcmp, memcpy, memset
+#include <sys/mman.h>   // mmap, munmap, mprotect, PROT_READ, PROT_WRITE,
+                        // MAP_PRIVATE, MAP_ANONYMOUS
+#include <sys/stat.h>   // fstat, struct stat
+#include <cscript.h>    // eprintf, guard_calloc
+#include <dict.h>       // dict_t, dict_add, dict_image_*
+#include <incbot.h>
+#include <incbot-impl.h>
+
+#define ID_IMAGE_VERSION 7
+#define ID_IMAGE_ALIGN 64
+
+static const char id_image_magic[8] = "\177incbot";
+static const uint32_t id_image_byte_order = 0x01020304;
+
+struct id_image_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t sizeof_word;
+    uint16_t sizeof_idhot;
+    uint16_t sizeof_idcold;
+    uint64_t file_size;
+    uint64_t id_table_len;
+    uint64_t id_hot_off;
+    uint64_t id_cold_off;
+    uint64_t id_symtable_off;
+    uint64_t id_symtable_size;
+    uint64_t strtable_off;
+    uint64_t strtable_size;
+};
+
+typedef struct id_image_hdr id_image_hdr_t;
+
+static inline size_t
+section_align(size_t sz)
+{
+    return ((sz + ID_IMAGE_ALIGN - 1) & ~((size_t)ID_IMAGE_ALIGN - 1));
+}
+
+/*
+ * Copy an id_table entry, field by field, so that no padding bytes
+ * of uninitialized memory find their way into the image.
+ */
+static void
+idinfo_export(idhot_t *dst_hot, idcold_t *dst_cold, size_t pos)
+{
+    const idhot_t *hot = id_hot + pos;
+    const idcold_t *cold = id_cold + pos;
+
+    memset(dst_hot, 0, sizeof (*dst_hot));
+    dst_hot->src1  = hot->src1;
+    dst_hot->type  = hot->type;
+
+    memset(dst_cold, 0, sizeof (*dst_cold));
+    dst_cold->sym       = cold->sym;
+    dst_cold->standard1 = cold->standard1;
+    dst_cold->standard2 = cold->standard2;
+    dst_cold->man_sect  = cold->man_sect;
+    dst_cold->man_path  = cold->man_path;
+    dst_cold->declare   = cold->declare;
+}
+
+/*
+ * Build a compiled image of all currently loaded identifier tables,
+ * in memory allocated on the heap.  Its size is stored in |*rsz|.
+ * The image is aligned suitably to be used in place.
+ */
+char *
+build_id_table_image(size_t *rsz)
+{
+    id_image_hdr_t hdr;
+    char *img;
+    idhot_t *hotv;
+    idcold_t *coldv;
+    size_t pos;
+
+    if (id_table_sz == 0) {
+        init_tables();
+    }
+    freeze_id_tables();
+
+    memset(&hdr, 0, sizeof (hdr));
+    memcpy(hdr.magic, id_image_magic, sizeof (hdr.magic));
+    hdr.version       = ID_IMAGE_VERSION;
+    hdr.byte_order    = id_image_byte_order;
+    hdr.sizeof_word   = sizeof (size_t);
+    hdr.sizeof_idhot  = sizeof (idhot_t);
+    hdr.sizeof_idcold = sizeof (idcold_t);
+
+    hdr.id_table_len     = id_table_len;
+    hdr.id_hot_off       = section_align(sizeof (hdr));
+    hdr.id_cold_off      = section_align(hdr.id_hot_off
+                           + id_table_len * sizeof (idhot_t));
+    hdr.id_symtable_off  = section_align(hdr.id_cold_off
+                           + id_table_len * sizeof (idcold_t));
+    hdr.id_symtable_size = dict_image_size(id_symtable);
+    hdr.strtable_off     = section_align(hdr.id_symtable_off
+                           + hdr.id_symtable_size);
+    hdr.strtable_size    = dict_image_size(strtable);
+    hdr.file_size        = section_align(hdr.strtable_off
+                           + hdr.strtable_size);
+
+    img = (char *) guard_calloc(1, hdr.file_size);
+    memcpy(img, &hdr, sizeof (hdr));
+    hotv  = (idhot_t *)(img + hdr.id_hot_off);
+    coldv = (idcold_t *)(img + hdr.id_cold_off);
+    for (pos = 0; pos < id_table_len; ++pos) {
+        idinfo_export(hotv + pos, coldv + pos, pos);
+    }
+    dict_image_store(id_symtable, img + hdr.id_symtable_off);
+    dict_image_store(strtable, img + hdr.strtable_off);
+    *rsz = hdr.file_size;
+    return (img);
+}
+
+/*
+ * Write all currently loaded identifier tables to |fname|
+ * as a compiled image.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+write_id_table_image(const char *fname)
+{
+    char *img;
+    size_t sz;
+    FILE *f;
+    int err;
+
+    img = build_id_table_image(&sz);
+    f = fopen(fname, "w");
+    if (f == NULL) {
+        err = errno;
+        eprintf("open('%s', w) failed.\n", fname);
+        free(img);
+        return (err);
+    }
+
+    err = 0;
+    if (fwrite(img, sz, 1, f) != 1) {
+        err = errno;
+        eprintf("write('%s') failed.\n", fname);
+    }
+    if (fclose(f) != 0 && err == 0) {
+        err = errno;
+        eprintf("close('%s') failed.\n", fname);
+    }
+    free(img);
+    return (err);
+}
+
+/*
+ * Is the open stream |f| a compiled image, rather than a text id-table?
+ * The stream is left positioned at the start of the file.
+ */
+bool
+id_table_image_probe(FILE *f)
+{
+    char magic[sizeof (id_image_magic)];
+    size_t n;
+
+    n = fread(magic, 1, sizeof (magic), f);
+    rewind(f);
+    return (n == sizeof (magic)
+            && memcmp(magic, id_image_magic, sizeof (magic)) == 0);
+}
+
+/*
+ * Does a section of |n| elements of |elsz| bytes, at offset |off|,
+ * fit in a file of |sz| bytes?  Written so that nothing can wrap around.
+ */
+static inline bool
+id_image_section_ok(uint64_t off, uint64_t n, size_t elsz, size_t sz)
+{
+    return (off % ID_IMAGE_ALIGN == 0
+            && off <= sz
+            && n <= (sz - off) / elsz);
+}
+
+/*
+ * Check the header of an image: that it was made by this build,
+ * and that every section fits in the file.  This costs the same
+ * however big the image is.
+ */
+static bool
+id_image_hdr_valid(const id_image_hdr_t *hdr, size_t file_size)
+{
+    if (memcmp(hdr->magic, id_image_magic, sizeof (hdr->magic)) != 0
+        || hdr->version       != ID_IMAGE_VERSION
+        || hdr->byte_order    != id_image_byte_order
+        || hdr->sizeof_word   != sizeof (size_t)
+        || hdr->sizeof_idhot  != sizeof (idhot_t)
+        || hdr->sizeof_idcold != sizeof (idcold_t)
+        || hdr->file_size     != file_size) {
+        return (false);
+    }
+
+    if (!id_image_section_ok(hdr->id_hot_off, hdr->id_table_len,
+                             sizeof (idhot_t), file_size)
+        || !id_image_section_ok(hdr->id_cold_off, hdr->id_table_len,
+                                sizeof (idcold_t), file_size)
+        || !id_image_section_ok(hdr->id_symtable_off, hdr->id_symtable_size,
+                                1, file_size)
+        || !id_image_section_ok(hdr->strtable_off, hdr->strtable_size,
+                                1, file_size)) {
+        return (false);
+    }
+    return (true);
+}
+
+/*
+ * Check the header of an image, and everything in it that is used
+ * as an index: the dictionary images, and every symbol number in
+ * id_hot and id_cold.  Nothing is mapped or merged until all of it
+ * has been checked.
+ */
+static bool
+id_image_valid(const char *img, const id_image_hdr_t *hdr, size_t file_size)
+{
+    const idhot_t *hotv;
+    const idcold_t *coldv;
+    size_t symtable_len;
+    size_t strtable_len;
+    size_t pos;
+
+    if (!id_image_hdr_valid(hdr, file_size)) {
+        return (false);
+    }
+
+    if (dict_image_check(img + hdr->id_symtable_off, hdr->id_symtable_size,
+                         &symtable_len) != 0
+        || dict_image_check(img + hdr->strtable_off, hdr->strtable_size,
+                            &strtable_len) != 0) {
+        return (false);
+    }
+
+    // Identifier number symnr - 1 is the entry for symbol symnr.
+    if (symtable_len - 1 > hdr->id_table_len) {
+        return (false);
+    }
+    hotv  = (const idhot_t *)(img + hdr->id_hot_off);
+    coldv = (const idcold_t *)(img + hdr->id_cold_off);
+    for (pos = 0; pos < hdr->id_table_len; ++pos) {
+        const idhot_t *hot = hotv + pos;
+        const idcold_t *cold = coldv + pos;
+
+        if (hot->src1 >= strtable_len
+            || cold->sym >= symtable_len
+            || cold->standard1 >= strtable_len
+            || cold->standard2 >= strtable_len
+            || cold->man_sect >= strtable_len
+            || cold->man_path >= strtable_len
+            || cold->declare >= strtable_len) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static inline size_t
+import_sym(dict_t *dst, dict_t *src, size_t symnr)
+{
+    if (symnr == undef_symnr) {
+        return (undef_symnr);
+    }
+    return (dict_add(dst, dict_getname_nr(src, symnr)));
+}
+
+/*
+ * Tables have already been loaded.  Append the entries of the image
+ * to them, the same as if they had been read from a text id-table.
+ */
+static int
+merge_id_table_image(const char *img, const id_image_hdr_t *hdr)
+{
+    const idhot_t *hotv;
+    const idcold_t *coldv;
+    dict_t img_symtable;
+    dict_t img_strtable;
+    size_t pos;
+
+    memset(&img_symtable, 0, sizeof (img_symtable));
+    memset(&img_strtable, 0, sizeof (img_strtable));
+    if (dict_image_map(&img_symtable, img + hdr->id_symtable_off,
+                       hdr->id_symtable_size) != 0
+        || dict_image_map(&img_strtable, img + hdr->strtable_off,
+                          hdr->strtable_size) != 0) {
+        dict_image_unmap(&img_symtable);
+        dict_image_unmap(&img_strtable);
+        return (EINVAL);
+    }
+
+    id_table_thaw();
+    hotv  = (const idhot_t *)(img + hdr->id_hot_off);
+    coldv = (const idcold_t *)(img + hdr->id_cold_off);
+    for (pos = 0; pos < hdr->id_table_len; ++pos) {
+        const idhot_t *hot = hotv + pos;
+        const idcold_t *cold = coldv + pos;
+        idinfo_t ent;
+
+        memset(&ent, 0, sizeof (ent));
+        ent.type      = hot->type;
+        ent.src1      = import_sym(strtable, &img_strtable, hot->src1);
+        ent.sym       = import_sym(id_symtable, &img_symtable, cold->sym);
+        ent.standard1 = import_sym(strtable, &img_strtable, cold->standard1);
+        ent.standard2 = import_sym(strtable, &img_strtable, cold->standard2);
+        ent.man_sect  = import_sym(strtable, &img_strtable, cold->man_sect);
+        ent.man_path  = import_sym(strtable, &img_strtable, cold->man_path);
+        ent.declare   = import_sym(strtable, &img_strtable, cold->declare);
+        id_table_commit(&ent);
+    }
+
+    dict_image_unmap(&img_symtable);
+    dict_image_unmap(&img_strtable);
+    return (0);
+}
+
+/*
+ * Load the compiled image |img| of size |sz|, which came from |fname|.
+ *
+ * If no identifiers have been loaded yet, then the image is used
+ * in place, read-only, and |*rin_place| is set to true.  The image
+ * must then stay mapped for the rest of the run.  Otherwise, it is
+ * merged into the tables that are already loaded, and the caller
+ * is free to discard it.
+ *
+ * Unless it is |trusted|, as the built-in image and snapshots made
+ * by this very run are, every symbol number in the image is checked
+ * before anything is loaded.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+load_id_table_image(const char *img, size_t sz, const char *fname,
+    bool trusted, bool *rin_place)
+{
+    id_image_hdr_t hdr;
+    int err;
+
+    *rin_place = false;
+    if (sz < sizeof (hdr)) {
+        eprintf("'%s' is truncated.\n", fname);
+        return (EINVAL);
+    }
+
+    memcpy(&hdr, img, sizeof (hdr));
+    if (trusted ? !id_image_hdr_valid(&hdr, sz)
+                : !id_image_valid(img, &hdr, sz)) {
+        eprintf("'%s' is not a compiled id-table for this build.\n", fname);
+        eprintf("Recompile it from the text id-table.\n");
+        return (EINVAL);
+    }
+
+    if (id_table_sz == 0) {
+        init_tables();
+    }
+
+    if (id_table_len != 0 || id_symtable->len != 1 || strtable->len != 1) {
+        err = merge_id_table_image(img, &hdr);
+        if (err) {
+            eprintf("'%s' is corrupt.\n", fname);
+        }
+        return (err);
+    }
+
+    if (hdr.id_table_len == 0) {
+        return (0);
+    }
+
+    if (dict_image_map(id_symtable, img + hdr.id_symtable_off,
+                       hdr.id_symtable_size) != 0
+        || dict_image_map(strtable, img + hdr.strtable_off,
+                          hdr.strtable_size) != 0) {
+        eprintf("'%s' is corrupt.\n", fname);
+        exit(2);
+    }
+
+    free(id_hot);
+    free(id_cold);
+    id_hot  = (idhot_t *)(img + hdr.id_hot_off);
+    id_cold = (idcold_t *)(img + hdr.id_cold_off);
+    id_table_len = hdr.id_table_len;
+    id_table_sz  = hdr.id_table_len;
+    id_table_mapped = true;
+    *rin_place = true;
+    return (0);
+}
+
+/*
+ * Load the compiled image open on stream |f|.
+ * See load_id_table_image().
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+read_id_table_image(FILE *f, const char *fname)
+{
+    struct stat statbuf;
+    char *img;
+    size_t sz;
+    bool in_place;
+    int err;
+
+    if (fstat(fileno(f), &statbuf) != 0) {
+        err = errno;
+        eprintf("stat('%s') failed.\n", fname);
+        return (err);
+    }
+    sz = (size_t)statbuf.st_size;
+    if (sz < sizeof (id_image_hdr_t)) {
+        eprintf("'%s' is truncated.\n", fname);
+        return (EINVAL);
+    }
+
+    img = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (img == MAP_FAILED) {
+        err = errno;
+        eprintf("mmap('%s') failed.\n", fname);
+        return (err);
+    }
+
+    err = load_id_table_image(img, sz, fname, false, &in_place);
+    if (!in_place) {
+        munmap(img, sz);
+    }
+    return (err);
+}
+
+/*
+ * The snapshot made by incbot_tables_freeze(), if any.
+ */
+static void *id_snapshot;
+static size_t id_snapshot_sz;
+
+/*
+ * All tables have been loaded.  Compact id_hot, id_cold, id_symtable
+ * and strtable, with their indexes, into one contiguous, read-only
+ * snapshot -- a compiled image, made in memory -- and use it in place,
+ * just as if it had been read from a file.  All the structures that
+ * were built up while loading are freed.
+ *
+ * Nothing writes to the snapshot; the pages are made read-only
+ * to be sure of that.  So any number of threads can share it,
+ * without synchronization.  Symbol numbers, and positions in
+ * the id_table, are the same as before.
+ *
+ * Tables that are already an image used in place, such as
+ * the built-in id-table, are a snapshot already, and are left as they are.
+ * Adding to the tables afterwards thaws them, as for any image.
+ * Empty tables, as from an empty id-table file, need no snapshot;
+ * they are only frozen where they are.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+incbot_tables_freeze(void)
+{
+    void *old_snapshot = id_snapshot;
+    size_t old_snapshot_sz = id_snapshot_sz;
+    char *img;
+    void *snap;
+    size_t sz;
+    bool in_place;
+    int err;
+
+    if (id_table_sz == 0) {
+        init_tables();
+    }
+    if (id_table_mapped && id_symtable->img_offv != NULL
+        && strtable->img_offv != NULL) {
+        freeze_id_tables();
+        return (0);
+    }
+    if (id_table_len == 0) {
+        freeze_id_tables();
+        dict_freeze(strtable);
+        return (0);
+    }
+
+    dict_freeze(strtable);
+    img = build_id_table_image(&sz);
+    snap = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (snap == MAP_FAILED) {
+        err = errno;
+        eprintf("mmap(%zu) of id-table snapshot failed.\n", sz);
+        free(img);
+        return (err);
+    }
+    memcpy(snap, img, sz);
+    free(img);
+    if (mprotect(snap, sz, PROT_READ) != 0) {
+        err = errno;
+        eprintf("mprotect() of id-table snapshot failed.\n");
+        munmap(snap, sz);
+        return (err);
+    }
+
+    id_table_release();
+    err = load_id_table_image(snap, sz, "<id-table snapshot>", true,
+                              &in_place);
+    if (err != 0 || !in_place) {
+        // The image was just made by this very build.
+        eprintf("INTERNAL ERROR: id-table snapshot cannot be used.\n");
+        exit(2);
+    }
+    id_snapshot = snap;
+    id_snapshot_sz = sz;
+
+    // A snapshot of a snapshot that had been thawed replaces it.
+    if (old_snapshot != NULL) {
+        munmap(old_snapshot, old_snapshot_sz);
+    }
+
+    freeze_id_tables();
+    dict_freeze(strtable);
+    return (0);
+}
+
+/*
+ * Drop the tables, and the snapshot made by incbot_tables_freeze(),
+ * if there is one, with one munmap().  Nothing that refers into
+ * the tables may be used afterwards.  The tables are empty, as they
+ * were before init_tables(), and can be loaded again.
+ */
+void
+incbot_tables_release(void)
+{
+    id_table_release();
+    if (id_snapshot != NULL) {
+        munmap(id_snapshot, id_snapshot_sz);
+        id_snapshot = NULL;
+        id_snapshot_sz = 0;
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * Filename: src/libincbot/idset.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Set of the distinct identifiers seen in one source file
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A source file mentions the same few hundred identifiers over and
+ * over.  The scanner keeps them in an idset_t, so that each distinct
+ * identifier is resolved against the id-table only once per file.
+ *
+ * Entries are appended to a growable array, in order of arrival,
+ * and are known by their position in it.  The hash table is plain
+ * open addressing, with linear probing, at most half full, of entry
+ * numbers.  The identifiers themselves are copied, null-terminated,
+ * into one growable buffer, and entries refer to them by offset.
+ * Everything is kept from one file to the next; idset_reset()
+ * just empties it.
+ *
+ * Keys are dict_hash() values, which the scanner has already computed.
+ */
+
+#include <stddef.h>
+    // Import type size_t
+#include <stdint.h>
+    // Import type uint32_t
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import free()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+    // Import memset()
+
+#include <cscript.h>
+#include <incbot.h>
+#include <incbot-impl.h>
+
+#define IDSET_MIN_CAP  256
+#define IDSET_MIN_STRS (4 * 1024)
+
+void
+idset_init(idset_t *set)
+{
+    set->cap = IDSET_MIN_CAP;
+    set->tbl = (uint32_t *) guard_calloc(set->cap, sizeof (uint32_t));
+    set->ents_sz = set->cap / 2;
+    set->ents = (idset_ent_t *)
+        guard_malloc(set->ents_sz * sizeof (idset_ent_t));
+    set->len = 0;
+    set->strs_sz  = IDSET_MIN_STRS;
+    set->strs_len = 0;
+    set->strs = (char *) guard_malloc(set->strs_sz);
+}
+
+void
+idset_free(idset_t *set)
+{
+    free(set->tbl);
+    free(set->ents);
+    free(set->strs);
+    set->tbl = NULL;
+    set->ents = NULL;
+    set->strs = NULL;
+}
+
+void
+idset_reset(idset_t *set)
+{
+    memset(set->tbl, 0, set->cap * sizeof (uint32_t));
+    set->len = 0;
+    set->strs_len = 0;
+}
+
+/*
+ * Double the hash table, and the array of entries along with it.
+ * Entry numbers do not change.
+ */
+static void
+idset_grow(idset_t *set)
+{
+    size_t mask;
+    size_t entnr;
+
+    free(set->tbl);
+    set->cap *= 2;
+    set->tbl = (uint32_t *) guard_calloc(set->cap, sizeof (uint32_t));
+    set->ents_sz = set->cap / 2;
+    set->ents = (idset_ent_t *)
+        guard_realloc(set->ents, set->ents_sz * sizeof (idset_ent_t));
+
+    mask = set->cap - 1;
+    for (entnr = 0; entnr < set->len; ++entnr) {
+        size_t pos = set->ents[entnr].h & mask;
+
+        while (set->tbl[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        set->tbl[pos] = (uint32_t)(entnr + 1);
+    }
+}
+
+static uint32_t
+idset_save_str(idset_t *set, const char *s, size_t len)
+{
+    uint32_t off;
+
+    while (set->strs_len + len + 1 > set->strs_sz) {
+        set->strs_sz *= 2;
+        set->strs = (char *) guard_realloc(set->strs, set->strs_sz);
+    }
+    off = (uint32_t)set->strs_len;
+    memcpy(set->strs + off, s, len);
+    set->strs[off + len] = '\0';
+    set->strs_len += len + 1;
+    return (off);
+}
+
+/*
+ * Find the identifier, |s|, of length |len|, whose dict_hash()
+ * value is |h|.  If it is not in |set|, add it, with nothing resolved.
+ * Return its entry number.
+ */
+size_t
+idset_upsert(idset_t *set, const char *s, size_t len, uint64_t h)
+{
+    size_t mask;
+    size_t pos;
+    size_t entnr;
+    idset_ent_t *ent;
+
+    if (set->len + 1 > set->ents_sz) {
+        idset_grow(set);
+    }
+
+    mask = set->cap - 1;
+    for (pos = h & mask; set->tbl[pos] != 0; pos = (pos + 1) & mask) {
+        ent = set->ents + set->tbl[pos] - 1;
+        if (ent->h == h && ent->len == len
+            && memcmp(set->strs + ent->str, s, len) == 0) {
+            return (set->tbl[pos] - 1);
+        }
+    }
+
+    entnr = set->len++;
+    set->tbl[pos] = (uint32_t)(entnr + 1);
+    ent = set->ents + entnr;
+    ent->h = h;
+    ent->str = idset_save_str(set, s, len);
+    ent->len = (uint32_t)len;
+    ent->resolved = 0;
+    return (entnr);
+}
@@ -21,20 +21,36 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cf.h>         // ccv_t, ccl_t, cclass_set::CC_CODE,
-                        // cclass_set::CC_EOF, ccv_new, cf_new, cf_next, cf_t,
-                        // cclass_set::CC_ERR
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <bloom.h>      // bloom_t, bloom_new, bloom_add, bloom_delete,
+                        // bloom_maybe_contains, bloom_expected_fpr
+#include <cf.h>         // ccv_t, cclass_set::CC_CODE, ccv_new, ccv_delete,
+                        // ccv_pop_front, ccv_push_front, cf_t, cf_init,
+                        // cf_span_t, cf_scan_block, cf_scan_end
+#include <cf-impl.h>    // struct cf, state::S_START, state::S_EOF, cf_trans,
+                        // cf_byte_class, ...
 #include <cscript.h>    // guard_malloc, guard_realloc
+#include <datrie.h>     // datrie_t, datrie_build, datrie_delete, datrie_step,
+                        // datrie_value, datrie_code, DATRIE_ROOT, DATRIE_DEAD
 #include <ctype.h>      // isalpha, isdigit, isspace
-#include <errno.h>      // errno, ENOBUFS
+#include <errno.h>      // errno, EIO
 #include <stdbool.h>    // bool
 #include <stddef.h>     // size_t, NULL
 #include <stdio.h>      // fprintf, stderr, printf, EOF, fgetc, FILE, fclose,
-                        // fopen, fputc, getc, stdin
+                        // fopen, fputc, getc, stdin, fread, ferror, fwrite,
+                        // fileno
 #include <stdlib.h>     // exit, qsort
-#include <string.h>     // strcmp
-#include "dict.h"       // dict_getname_nr, dict_add, undef_symnr, dict_new,
-                        // dict_t
+#include <string.h>     // strcmp, memcpy, memchr, memset
+#include <sys/mman.h>   // mmap, munmap, madvise, PROT_READ, MAP_PRIVATE,
+                        // MADV_SEQUENTIAL
+#include <sys/stat.h>   // fstat, struct stat, S_ISREG
+#include "dict.h"       // dict_getname_nr, dict_upsert, undef_symnr, dict_new,
+                        // dict_t, dict_stats, dict_stats_t
+#include <incbot.h>
+#include <incbot-impl.h> // idinfo_t, id_hot, id_cold, id_symtable, strtable
 
 
 struct ioresult {
@@ -114,60 +130,34 @@ write_strl(str1, ...)
 #endif
 
 
-typedef size_t index_t;
-
 extern bool verbose;
 extern bool debug;
 
 extern FILE *errprint_fh;
 extern FILE *dbgprint_fh;
 
-enum sym_type {
-    TYPE_UNKNOWN  = 0x01,
-    TYPE_FUNCTION = 0x02,
-    TYPE_TYPEDEF  = 0x04,
-    TYPE_KEYWORD  = 0x08,
-    TYPE_CONSTANT = 0x10,
-    TYPE_VAR      = 0x20,
-    TYPE_STRUCT   = 0x40,
-};
-
-#define TYPE_ALL (TYPE_UNKNOWN|TYPE_FUNCTION|TYPE_TYPEDEF|TYPE_KEYWORD|TYPE_CONSTANT|TYPE_VAR|TYPE_STRUCT)
-
-struct idinfo {
-    size_t sym;
-    int    type;
-    size_t src1;
-    size_t standard1;
-    size_t standard2;
-    size_t man_sect;
-    size_t man_path;
-    size_t declare;
-    bool   trace;
-};
-
-typedef struct idinfo idinfo_t;
-
-
 struct incref {
-    size_t ref_sym;
-    size_t inc_sym;
-    size_t ref_idnr;
-    size_t ref_lnr;
+    symnr_t  ref_sym;
+    symnr_t  inc_sym;
+    index_t  ref_idnr;
+    uint32_t ref_lnr;
 };
 
 typedef struct incref incref_t;
 
-static const size_t undef_idnr = (size_t)(-1);
+static const index_t undef_idnr = (index_t)(-1);
 
-static dict_t *id_symtable;	// Symbol table for identifiers
-static dict_t *strtable;	// SYmbol table for all other strings
+dict_t *id_symtable;		// Symbol table for identifiers
+dict_t *strtable;		// SYmbol table for all other strings
 
 static idinfo_t virgin_idinfo;
+static idinfo_t id_staged;     // The id-table line being read
 static const size_t id_table_segment_size = 64; // 8 * 1024;
-static idinfo_t *id_table;
-static size_t id_table_sz;
-static size_t id_table_len;
+idhot_t  *id_hot;
+idcold_t *id_cold;
+size_t id_table_sz;
+size_t id_table_len;
+bool id_table_mapped;
 
 static const size_t ref_inc_table_segment_size = 64; //8 * 1024;
 static incref_t *ref_inc_table;
@@ -176,6 +166,72 @@ static size_t ref_inc_table_len;
 
 static int fsep = ';';
 
+/*
+ * Most identifiers in real source are local variables, members,
+ * and project functions, none of which are in the id-table.
+ * A Bloom filter over id_symtable, built by freeze_id_tables(),
+ * rejects most of those with one cache-line read, before
+ * they cost a full dictionary lookup.
+ */
+static bloom_t *id_filter;
+static unsigned int id_filter_bits_per_key = 10;
+
+// Lookups are counted only if asked for, and then per thread,
+// so that threads sharing frozen tables write nothing in common.
+//
+static bool id_filter_counting;
+static __thread id_filter_stats_t id_filter_stats;
+
+// Identifiers in the file being scanned, and what they resolved to.
+static idset_t file_idset;
+static bool file_idset_ready;
+
+// Number of identifiers being traced.  Tracing reports every lookup,
+// so, while it is on, repeated identifiers are looked up every time.
+// Tracing is a property of a run, not of a table, so which entries
+// are traced is kept here, not in id_hot, which may be read-only.
+static size_t id_ntraced;
+static bool *id_traced;         // [id_traced_sz]
+static size_t id_traced_sz;
+
+/*
+ * Identifiers waiting to be looked up, as a batch -- see id_find_batch().
+ * The scanner queues the first occurrence of each identifier,
+ * in each context, and resolves the whole queue when it is full,
+ * and at the end of the file.
+ */
+#define ID_BATCH 32
+
+struct id_pending {
+    uint32_t entnr;         // Entry in file_idset
+    uint32_t lnr;
+    uint8_t  ctx;           // enum idset_context
+    bool     first;         // First occurrence, in this context
+};
+
+typedef struct id_pending id_pending_t;
+
+static id_pending_t id_pendv[ID_BATCH];
+static size_t id_pend_len;
+
+/*
+ * Keywords, and a few library identifiers, such as size_t and NULL,
+ * make up most identifier occurrences in C.  If there is a recognizer
+ * (see set_id_recognizer()), the scanner tries it first, and so never
+ * looks these up at all.  What each recognized name resolves to,
+ * in each context, is worked out once, by freeze_id_tables().
+ */
+static id_recognizer_t id_recognizer;
+static const char *const *id_recognized_namev;
+static size_t id_nrecognized;
+static index_t (*id_recognized_idnrv)[2];   // [n][enum idset_context]
+static uint8_t *id_recognized_seen;         // Contexts seen, in this file
+static bool id_recognizer_ready;
+
+// Trie of id_symtable, for the fused scanner; see incbot_src_buf_fused().
+static datrie_t *id_trie;
+static uint8_t *id_trie_seen;   // [id_table_len] Contexts seen, in this file
+
 void
 init_tables(void)
 {
@@ -183,26 +239,161 @@ init_tables(void)
 
     id_table_sz  = id_table_segment_size;
     id_table_len = 0;
-    sz = id_table_sz * sizeof (idinfo_t);
-    id_table = (idinfo_t *) guard_malloc(sz);
-
-    ref_inc_table_sz  = ref_inc_table_segment_size;
-    ref_inc_table_len = 0;
-    sz = ref_inc_table_sz * sizeof (incref_t);
-    ref_inc_table = (incref_t *) guard_malloc(sz);
+    id_hot  = (idhot_t *) guard_malloc(id_table_sz * sizeof (idhot_t));
+    id_cold = (idcold_t *) guard_malloc(id_table_sz * sizeof (idcold_t));
+
+    // References found so far are about the source, not the tables,
+    // so they outlive id_table_release().
+    //
+    if (ref_inc_table == NULL) {
+        ref_inc_table_sz  = ref_inc_table_segment_size;
+        ref_inc_table_len = 0;
+        sz = ref_inc_table_sz * sizeof (incref_t);
+        ref_inc_table = (incref_t *) guard_malloc(sz);
+    }
 
     id_symtable = dict_new();
     strtable = dict_new();
 }
 
+static void
+id_table_resize(size_t n)
+{
+    id_table_sz = n;
+    id_hot  = (idhot_t *) guard_realloc(id_hot, n * sizeof (idhot_t));
+    id_cold = (idcold_t *) guard_realloc(id_cold, n * sizeof (idcold_t));
+}
+
 void
 id_table_grow(void)
 {
-    size_t sz;
+    id_table_resize(id_table_sz + id_table_segment_size);
+}
 
-    id_table_sz += id_table_segment_size;
-    sz = id_table_sz * sizeof (idinfo_t);
-    id_table = (idinfo_t *) guard_realloc(id_table, sz);
+/*
+ * Make room for |n| more entries in id_table.
+ */
+static void
+id_table_reserve(size_t n)
+{
+    if (id_table_len + n < id_table_sz) {
+        return;
+    }
+    id_table_resize(id_table_len + n + id_table_segment_size);
+}
+
+/*
+ * The set of identifiers may be about to change.  Drop everything
+ * that was built from it; freeze_id_tables() builds it again.
+ */
+static void
+id_table_changed(void)
+{
+    if (id_filter != NULL) {
+        bloom_delete(id_filter);
+        id_filter = NULL;
+    }
+    id_recognizer_ready = false;
+    datrie_delete(id_trie);
+    id_trie = NULL;
+}
+
+/*
+ * Enter the description of an identifier, |ent|, into the id_table,
+ * split into its hot and cold parts.
+ *
+ * If it describes a new identifier, then it becomes part of the table.
+ * If it describes an identifier that is already in the table,
+ * then it replaces the earlier description.  That way, id-tables
+ * can be layered, one on top of another.
+ */
+void
+id_table_commit(const idinfo_t *ent)
+{
+    size_t symnr = ent->sym;
+    size_t pos;
+    idhot_t *hot;
+    idcold_t *cold;
+    const char *src1;
+
+    id_table_changed();
+
+    if (symnr == undef_symnr || symnr > id_table_len) {
+        if (id_table_len >= id_table_sz) {
+            id_table_grow();
+        }
+        pos = id_table_len++;
+    }
+    else {
+        pos = symnr - 1;
+    }
+
+    hot = id_hot + pos;
+    src1 = dict_getname_nr(strtable, ent->src1);
+    hot->src1 = (src1 && *src1) ? ent->src1 : undef_symnr;
+    hot->type = ent->type;
+    hot->reserved1 = 0;
+    hot->reserved = 0;
+
+    cold = id_cold + pos;
+    cold->sym       = ent->sym;
+    cold->standard1 = ent->standard1;
+    cold->standard2 = ent->standard2;
+    cold->man_sect  = ent->man_sect;
+    cold->man_path  = ent->man_path;
+    cold->declare   = ent->declare;
+}
+
+/*
+ * Copy an id_table that is mapped from a compiled image
+ * to the heap, so that entries can be modified or added.
+ * The symbol tables take care of themselves.
+ */
+void
+id_table_thaw(void)
+{
+    const idhot_t *mapped_hot;
+    const idcold_t *mapped_cold;
+
+    if (!id_table_mapped) {
+        return;
+    }
+
+    mapped_hot  = id_hot;
+    mapped_cold = id_cold;
+    id_hot  = NULL;
+    id_cold = NULL;
+    id_table_resize(id_table_len + id_table_segment_size);
+    memcpy(id_hot, mapped_hot, id_table_len * sizeof (idhot_t));
+    memcpy(id_cold, mapped_cold, id_table_len * sizeof (idcold_t));
+    id_table_mapped = false;
+}
+
+/*
+ * Let go of the id_table and the symbol tables, and everything built
+ * from them.  Nothing that belongs to a mapped image is freed.
+ * Afterwards, it is as if no table had been loaded yet.
+ */
+void
+id_table_release(void)
+{
+    id_table_changed();
+    if (id_table_sz == 0) {
+        return;
+    }
+    if (!id_table_mapped) {
+        free(id_hot);
+        free(id_cold);
+    }
+    id_hot  = NULL;
+    id_cold = NULL;
+    id_table_sz  = 0;
+    id_table_len = 0;
+    id_table_mapped = false;
+    dict_delete(id_symtable);
+    dict_delete(strtable);
+    id_symtable = NULL;
+    strtable = NULL;
 }
 
 void
@@ -285,17 +476,17 @@ annotate_type(int t)
     }
 }
 
-static void
+void
 verify_idtable(void)
 {
-    index_t pos;
+    size_t pos;
     size_t err_count;
 
     err_count = 0;
     for (pos = 0; pos < id_table_len; ++pos) {
-        index_t symnr = id_table[pos].sym;
+        size_t symnr = id_cold[pos].sym;
         if (symnr != pos + 1) {
-            eprintf("id_table[pos==%zu].sym == %zu.\n", pos, symnr);
+            eprintf("id_cold[pos==%zu].sym == %zu.\n", pos, symnr);
             ++err_count;
             if (err_count >= 10) {
                 break;
@@ -310,6 +501,137 @@ verify_idtable(void)
     }
 }
 
+/*
+ * All tables have been loaded.  From now on, the set of identifiers
+ * does not change, so build the fastest index we can for lookup.
+ * A compiled image carries its index with it, so this costs nothing
+ * for tables that come from an image.
+ */
+static void
+build_id_filter(void)
+{
+    size_t symnr;
+
+    bloom_delete(id_filter);
+    id_filter = NULL;
+    if (id_filter_bits_per_key == 0) {
+        return;
+    }
+    id_filter = bloom_new(id_symtable->len - 1, id_filter_bits_per_key);
+    for (symnr = 1; symnr < id_symtable->len; ++symnr) {
+        const char *sym = dict_getname_nr(id_symtable, symnr);
+
+        bloom_add(id_filter, dict_hash(sym, strlen(sym)));
+    }
+}
+
+/*
+ * Work out what each name known to the recognizer resolves to,
+ * in each context, in the tables as they are now.
+ * This is what id_resolve() would say, without the tracing.
+ */
+static void
+resolve_recognized_ids(void)
+{
+    static const int type_maskv[2] = {
+        [IDSET_OTHER] = TYPE_ALL & ~TYPE_FUNCTION,
+        [IDSET_CALL]  = TYPE_FUNCTION | TYPE_KEYWORD,
+    };
+    size_t i;
+    int ctx;
+
+    if (id_recognizer == NULL) {
+        return;
+    }
+
+    free(id_recognized_idnrv);
+    free(id_recognized_seen);
+    id_recognized_idnrv = guard_malloc(id_nrecognized * sizeof (index_t [2]));
+    id_recognized_seen  = (uint8_t *) guard_calloc(id_nrecognized, 1);
+    for (i = 0; i < id_nrecognized; ++i) {
+        size_t symnr = dict_find(id_symtable, id_recognized_namev[i]);
+
+        for (ctx = IDSET_OTHER; ctx <= IDSET_CALL; ++ctx) {
+            id_recognized_idnrv[i][ctx] = undef_idnr;
+            if (symnr != undef_symnr
+                && (id_hot[symnr - 1].type & type_maskv[ctx]) != 0) {
+                id_recognized_idnrv[i][ctx] = (index_t)(symnr - 1);
+            }
+        }
+    }
+    id_recognizer_ready = true;
+}
+
+void
+freeze_id_tables(void)
+{
+    if (id_table_sz == 0) {
+        return;
+    }
+    dict_freeze(id_symtable);
+    build_id_filter();
+    resolve_recognized_ids();
+}
+
+void
+set_id_recognizer(id_recognizer_t fn, const char *const *namev, size_t n)
+{
+    id_recognizer = fn;
+    id_recognized_namev = namev;
+    id_nrecognized = n;
+    id_recognizer_ready = false;
+}
+
+/*
+ * Set the size of the identifier filter, in bits per identifier.
+ * Zero means no filter.  Takes effect at the next freeze_id_tables().
+ */
+void
+set_id_filter_bits(unsigned int bits_per_key)
+{
+    id_filter_bits_per_key = bits_per_key;
+}
+
+/*
+ * Count what the identifier filter does, or stop counting.
+ */
+void
+set_id_filter_counting(bool counting)
+{
+    id_filter_counting = counting;
+}
+
+/*
+ * How the identifier filter is made, and, if counting is on,
+ * how it has done for lookups by the calling thread.
+ */
+void
+get_id_filter_stats(id_filter_stats_t *stats)
+{
+    *stats = id_filter_stats;
+    if (id_filter != NULL) {
+        stats->nkey = id_filter->nkey;
+        stats->nbytes = id_filter->nblock * BLOOM_BLOCK_BITS / 8;
+        stats->k = id_filter->k;
+        stats->bits_per_key = id_filter->bits_per_key;
+        stats->expected_fpr = bloom_expected_fpr(id_filter);
+    }
+}
+
+/*
+ * How the symbol tables for identifiers and for all other strings
+ * are doing.  See dict_stats().
+ */
+void
+get_table_dict_stats(dict_stats_t *id_stats, dict_stats_t *str_stats)
+{
+    if (id_table_sz == 0) {
+        init_tables();
+    }
+    dict_stats(id_symtable, id_stats);
+    dict_stats(strtable, str_stats);
+}
+
 // XXX OBSOLETE
 
 size_t
@@ -318,9 +640,9 @@ id_find_linear_search(const char *s, int type_mask)
     size_t pos;
 
     for (pos = 0; pos < id_table_len; ++pos) {
-        size_t symnr = id_table[pos].sym;
+        size_t symnr = id_cold[pos].sym;
         const char *sym = dict_getname_nr(id_symtable, symnr);
-        int types = id_table[pos].type;
+        int types = id_hot[pos].type;
 
         if (sym != NULL && strcmp(s, sym) == 0 && (types & type_mask) != 0) {
             return (pos);
@@ -362,22 +684,47 @@ fshow_typemask(FILE *f, int type_mask)
     }
 }
 
+/*
+ * Is the identifier whose dict_hash() value is |h| possibly
+ * in id_symtable?  Only if there is no filter, or the filter says so.
+ */
+static inline bool
+id_filter_pass(uint64_t h)
+{
+    bool pass;
+
+    if (id_filter == NULL) {
+        return (true);
+    }
+    pass = bloom_maybe_contains(id_filter, h);
+    if (id_filter_counting) {
+        ++id_filter_stats.nlookup;
+        id_filter_stats.nreject += !pass;
+    }
+    return (pass);
+}
+
+/*
+ * Finish the lookup of the identifier, |s|, given what
+ * looking it up in id_symtable found, |symnr|.
+ */
 static index_t
-id_find(const char *s, int type_mask)
+id_resolve(const char *s, size_t symnr, int type_mask)
 {
-    index_t symnr;
     index_t id_pos;
     int t;
 
-    symnr = dict_find(id_symtable, s);
     if (symnr == undef_symnr) {
+        if (id_filter != NULL && id_filter_counting) {
+            ++id_filter_stats.nfalse_pos;
+        }
         return (undef_idnr);
     }
 
     id_pos = symnr - 1;
-    t = id_table[id_pos].type;
+    t = id_hot[id_pos].type;
 
-    if (id_table[id_pos].trace) {
+    if (id_ntraced != 0 && id_pos < id_traced_sz && id_traced[id_pos]) {
         fprintf(stderr, "id_find:\n  id=[%s]\n  type_mask=%x=", s, type_mask);
         fshow_typemask(stderr, type_mask);
         fprintf(stderr, "\n  type(%s)=%x=%s\n", s, t, annotate_type(t));
@@ -390,15 +737,84 @@ id_find(const char *s, int type_mask)
     return (id_pos);
 }
 
-int
-add_id_field(const char *fld_str, size_t fidx)
+/*
+ * Look up the identifier, |s|, of length |len|, whose dict_hash() value,
+ * |h|, has already been computed, by the scanner.
+ */
+static index_t
+id_find_prehashed(const char *s, size_t len, uint64_t h, int type_mask)
 {
-    idinfo_t *id_ent;
+    if (!id_filter_pass(h)) {
+        return (undef_idnr);
+    }
+    return (id_resolve(s, dict_find_prehashed(id_symtable, s, len, h),
+                       type_mask));
+}
+
+/*
+ * Look up |n| identifiers, keyv[i], each with its own type mask,
+ * type_maskv[i].  Those that get past the filter are looked up
+ * in id_symtable together, so that their cache misses overlap.
+ * Each key must be null-terminated, for the sake of trace output.
+ */
+static void
+id_find_batch(const dict_key_t *keyv, const int *type_maskv, size_t n,
+    index_t *outv)
+{
+    dict_key_t passv[ID_BATCH];
+    size_t posv[ID_BATCH];
+    symnr_t symv[ID_BATCH];
+    size_t done;
+    size_t m;
+    size_t npass;
+    size_t i;
+
+    for (done = 0; done < n; done += m) {
+        m = n - done < ID_BATCH ? n - done : ID_BATCH;
+        npass = 0;
+        for (i = done; i < done + m; ++i) {
+            outv[i] = undef_idnr;
+            if (id_filter_pass(keyv[i].h)) {
+                passv[npass] = keyv[i];
+                posv[npass] = i;
+                ++npass;
+            }
+        }
 
-    if (id_table_len >= id_table_sz) {
-        id_table_grow();
+        dict_find_batch(id_symtable, passv, npass, symv);
+        for (i = 0; i < npass; ++i) {
+            size_t pos = posv[i];
+
+            outv[pos] = id_resolve(keyv[pos].s, symv[i], type_maskv[pos]);
+        }
     }
-    id_ent = id_table + id_table_len;
+}
+
+static index_t
+id_find(const char *s, int type_mask)
+{
+    size_t len = strlen(s);
+
+    return (id_find_prehashed(s, len, dict_hash(s, len), type_mask));
+}
+
+/*
+ * Intern a field of |len| bytes in |dict|.
+ * The length is already known, so the field is hashed and looked up
+ * only once, whether or not it is new.
+ */
+static inline size_t
+intern_field(dict_t *dict, const char *fld_str, size_t len)
+{
+    bool inserted;
+
+    return (dict_upsert(dict, fld_str, len, &inserted));
+}
+
+int
+add_id_field(const char *fld_str, size_t len, size_t fidx)
+{
+    idinfo_t *id_ent = &id_staged;
 
     dbg_printf("%s: @%zu: field[%zu] = '%s'\n",
         __FUNCTION__, id_table_len, fidx, fld_str);
@@ -409,26 +825,26 @@ add_id_field(const char *fld_str, size_t fidx)
         id_ent->type = encode_id_type(fld_str);
         break;
     case 1:
-        id_ent->man_sect = dict_add(strtable, fld_str);
+        id_ent->man_sect = intern_field(strtable, fld_str, len);
         break;
     case 2:
-        id_ent->sym = dict_add(id_symtable, fld_str);
+        id_ent->sym = intern_field(id_symtable, fld_str, len);
         break;
     case 3:
-        id_ent->src1 = dict_add(strtable, fld_str);
+        id_ent->src1 = intern_field(strtable, fld_str, len);
         break;
     case 4:
-        id_ent->standard1 = dict_add(strtable, fld_str);
+        id_ent->standard1 = intern_field(strtable, fld_str, len);
         break;
     case 5:
-        id_ent->standard2 = dict_add(strtable, fld_str);
+        id_ent->standard2 = intern_field(strtable, fld_str, len);
         break;
     case 6:
-        id_ent->man_path = dict_add(strtable, fld_str);
+        id_ent->man_path = intern_field(strtable, fld_str, len);
         break;
     case 7:
         if (fld_str && fld_str[0]) {
-            id_ent->declare = dict_add(strtable, fld_str);
+            id_ent->declare = intern_field(strtable, fld_str, len);
         }
         break;
     }
@@ -452,6 +868,43 @@ add_ref_inc_pair(size_t inc_symnr, size_t ref_symnr, size_t id_ent, size_t lnr)
 #define ERR_LIMIT 10
 #define NFLD 8
 
+/*
+ * Count the lines in the rest of the stream, |f|, if it is seekable,
+ * then go back to where we were.  Return 0 if the stream is not seekable.
+ * This is much cheaper than parsing, and it tells us roughly how many
+ * identifiers there are going to be, so that tables can be sized up front.
+ */
+static size_t
+count_lines(FILE *f)
+{
+    char buf[64 * 1024];
+    size_t nl;
+    size_t n;
+    long pos;
+
+    pos = ftell(f);
+    if (pos < 0) {
+        return (0);
+    }
+
+    nl = 0;
+    while ((n = fread(buf, 1, sizeof (buf), f)) != 0) {
+        const char *p = buf;
+        const char *end = buf + n;
+
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            ++nl;
+            ++p;
+        }
+    }
+
+    if (fseek(f, pos, SEEK_SET) != 0) {
+        eprintf("Cannot seek back after counting lines.\n");
+        exit(2);
+    }
+    return (nl);
+}
+
 int
 read_id_table_stream(FILE *f, const char *fname)
 {
@@ -467,6 +920,13 @@ read_id_table_stream(FILE *f, const char *fname)
     if (id_table_sz == 0) {
         init_tables();
     }
+    id_table_thaw();
+
+    lnr = count_lines(f);
+    if (lnr != 0) {
+        id_table_reserve(lnr);
+        dict_reserve(id_symtable, id_symtable->len + lnr);
+    }
 
     fbuf_sz  = sizeof (fbuf);
     fbuf_len = 0;
@@ -483,7 +943,7 @@ read_id_table_stream(FILE *f, const char *fname)
 
         if ((c == '\n' && lcol != 0) || c == fsep) {
             fbuf[fbuf_len] = '\0';
-            add_id_field(fbuf, fidx);
+            add_id_field(fbuf, fbuf_len, fidx);
             fbuf_len = 0;
             if (c == '\n') {
                 if (fidx >= NFLD) {
@@ -498,10 +958,7 @@ read_id_table_stream(FILE *f, const char *fname)
                     }
                 }
 
-                if (id_table_len >= id_table_sz) {
-                    id_table_grow();
-                }
-                ++id_table_len;
+                id_table_commit(&id_staged);
             }
             else {
                 ++fidx;
@@ -620,10 +1077,21 @@ read_id_table_file(const char *fname)
         return (err);
     }
 
-    rv = read_id_table_stream(srcf, fname);
+    if (id_table_image_probe(srcf)) {
+        rv = read_id_table_image(srcf, fname);
+    }
+    else {
+        rv = read_id_table_stream(srcf, fname);
+    }
     fclose(srcf);
 
-    verify_idtable();
+    // A compiled image that is used in place was verified
+    // when it was compiled.  Loading it only checked that every
+    // symbol number in it is in range; do not verify it all again.
+    //
+    if (!id_table_mapped) {
+        verify_idtable();
+    }
 
     return (rv);
 }
@@ -643,100 +1111,284 @@ is_identifier(int chr)
 size_t necho = 0;
 size_t count_getc = 0;
 
-int
-cf_getc(FILE *f, cf_t *cf, ccv_t *ccv)
+/*
+ * Debug: echo the source, up to the first |necho| bytes of the run,
+ * to errprint_fh.  This is done once for each file, for the whole
+ * buffer, before it is scanned, rather than byte by byte.
+ */
+static void
+echo_src(const char *buf, size_t len)
 {
-    size_t len;
-    size_t pos;
-    int rv;
+    size_t n;
 
-    while (true) {
-        while (ccv->len == 0) {
-            int c;
+    if (necho == 0 || count_getc >= necho) {
+        return;
+    }
+    n = necho - 1 - count_getc;
+    if (n > len) {
+        n = len;
+    }
+    fwrite(buf, 1, n, errprint_fh);
+    count_getc += n;
+    if (count_getc == necho - 1) {
+        fputc('\n', errprint_fh);
+        count_getc = necho;
+    }
+}
 
-            c = fgetc(f);
-            if (necho) {
-                ++count_getc;
-                if (count_getc < necho) {
-                    fputc(c, errprint_fh);
-                }
-                else if (count_getc == necho) {
-                    fputc('\n', errprint_fh);
-                }
-            }
+/*
+ * The code in a source file.  cf_scan_block() finds the code spans
+ * in the buffer, all at once, and the scanner goes through them
+ * a byte at a time.  Comments and literals are never looked at again.
+ */
+struct src_in {
+    const unsigned char *buf;
+    const cf_span_t *spanv;
+    size_t nspan;
+    size_t spannr;              // Next span
+    const unsigned char *p;     // What is left of the current span
+    const unsigned char *end;
+};
 
-            rv = cf_next(cf, ccv, c);
-            if (rv != 0 && rv != EOF) {
-                // XXX Maybe libcf should push { CC_ERR, errno } onto ccv
-                eprintf("cf_next() failed; err=%d\n", rv);
-                exit(rv);
-            }
-        }
+typedef struct src_in src_in_t;
 
-        len = ccv->len;
-        for (pos = 0; pos < len; ++pos) {
-            int ccl = ccv->array[pos].ccl;
-            int chr = ccv->array[pos].chr;
+/*
+ * The code spans of the file being scanned.
+ * The vector is kept from one file to the next.
+ */
+static cf_span_t *code_spanv;
+static size_t code_span_len;
+static size_t code_span_sz;
 
-            if (ccl == CC_EOF) {
-                chr = EOF;
-            }
+static int
+add_code_span(void *arg, const cf_span_t *span)
+{
+    (void)arg;
+    if (span->ccl != CC_CODE) {
+        return (0);
+    }
+    if (code_span_len == code_span_sz) {
+        code_span_sz = code_span_sz ? code_span_sz * 2 : 1024;
+        code_spanv = (cf_span_t *)
+            guard_realloc(code_spanv, code_span_sz * sizeof (cf_span_t));
+    }
+    code_spanv[code_span_len++] = *span;
+    return (0);
+}
 
-            if (ccl == CC_ERR || ccl == CC_EOF || (ccl & CC_CODE) != 0) {
-                size_t dst;
+/*
+ * Find the code in the |len| bytes of |buf|, and get ready to scan it.
+ */
+static int
+src_in_init(src_in_t *in, const char *buf, size_t len)
+{
+    cf_t cf;
+    int rv;
 
-                ++pos;
-                for (dst = 0; pos < len; ++pos) {
-                    ccv->array[dst] = ccv->array[pos];
-                    ++dst;
-                }
-                ccv->len = dst;
-                return (chr);
-            }
+    cf_init(&cf, CC_CODE);
+    code_span_len = 0;
+    rv = cf_scan_block(&cf, buf, len, add_code_span, NULL);
+    if (rv == 0) {
+        rv = cf_scan_end(&cf, add_code_span, NULL);
+    }
+    if (rv != 0) {
+        eprintf("cf_scan_block() failed; err=%d\n", rv);
+        return (rv < 0 ? -rv : rv);
+    }
+
+    in->buf = (const unsigned char *)buf;
+    in->spanv = code_spanv;
+    in->nspan = code_span_len;
+    in->spannr = 0;
+    in->p = in->buf;
+    in->end = in->buf;
+    return (0);
+}
+
+/*
+ * Return the next byte of code, or EOF.
+ * Bytes pushed back by cf_ungetc() come first, last pushed first.
+ */
+static inline int
+cf_getc(src_in_t *in, ccv_t *ccv)
+{
+    while (in->p == in->end) {
+        const cf_span_t *span;
+
+        if (ccv->len != 0) {
+            break;
         }
+        if (in->spannr == in->nspan) {
+            return (EOF);
+        }
+        span = in->spanv + in->spannr++;
+        in->p = in->buf + span->off;
+        in->end = in->p + span->len;
+    }
 
-        ccv->len = 0;
+    if (ccv->len != 0) {
+        int chr;
+        int ccl;
+
+        ccv_pop_front(ccv, &chr, &ccl);
+        return (chr);
     }
+    return (*in->p++);
 }
 
+/*
+ * Push |c| back, to be the next byte cf_getc() returns.
+ * There is no limit on how many bytes can be pushed back.
+ */
 static void
 cf_ungetc(int c, ccv_t *ccv)
 {
-    size_t sz;
-    size_t len;
-    size_t pos;
+    ccv_push_front(ccv, c, CC_CODE);
+}
+
+/*
+ * Record what the scanner found, at line |lnr| of |fname|:
+ * the identifier, |id|, which resolved to |idnr|.
+ * Only the first occurrence, in each context, is a new reference.
+ */
+static void
+note_identifier(const char *id, index_t idnr, size_t lnr, const char *fname,
+    bool first)
+{
+    const idhot_t *id_ent;
+    size_t ref_symnr;
+    size_t inc_symnr;
+
+    if (idnr == undef_idnr) {
+#ifdef CSCRIPT_DEBUG
+        dbg_printf("lnr=%zu, id=[%s] => NULL\n", lnr, id);
+#else
+        (void)id;
+#endif
+        return;
+    }
+
+    // Only the hot part of the description is needed here.
+    // The symbol number follows from the position.
+    //
+    id_ent = id_hot + idnr;
+    ref_symnr = idnr + 1;
+    inc_symnr = id_ent->src1;
+    if (first && inc_symnr != undef_symnr && id_ent->type != TYPE_KEYWORD) {
+        add_ref_inc_pair(inc_symnr, ref_symnr, idnr, lnr);
+    }
+
+    if (debug) {
+        const idcold_t *id_info = id_cold + idnr;
+        char *ref_sym;
+
+        ref_sym = dict_getname_nr(id_symtable, ref_symnr);
+        dbg_printf("File: %s\n", fname);
+        dbg_printf("lnr=%zu, id=%zu=[%s], type=%s",
+            lnr, ref_symnr, ref_sym, decode_id_type(id_ent->type));
+
+        if (id_ent->type == TYPE_TYPEDEF && id_info->declare) {
+            size_t decl_symnr;
+            char *decl_sym;
+
+            decl_symnr = id_info->declare;
+            decl_sym = dict_getname_nr(strtable, decl_symnr);
+            dbg_printf(", %s", decl_sym);
+        }
+        dbg_printf("\n");
+    }
+}
+
+/*
+ * Look up all the queued identifiers, at once, and record the results.
+ */
+static void
+id_flush(const char *fname)
+{
+    dict_key_t keyv[ID_BATCH];
+    int type_maskv[ID_BATCH];
+    index_t idnrv[ID_BATCH];
+    size_t i;
+
+    for (i = 0; i < id_pend_len; ++i) {
+        const id_pending_t *pend = id_pendv + i;
+        const idset_ent_t *ent = idset_ent(&file_idset, pend->entnr);
+
+        keyv[i].s   = idset_str(&file_idset, ent);
+        keyv[i].len = ent->len;
+        keyv[i].h   = ent->h;
+        type_maskv[i] = pend->ctx == IDSET_CALL
+            ? TYPE_FUNCTION | TYPE_KEYWORD
+            : TYPE_ALL & ~TYPE_FUNCTION;
+    }
+
+    id_find_batch(keyv, type_maskv, id_pend_len, idnrv);
 
-    sz  = ccv->sz;
-    len = ccv->len;
-    if (len >= sz) {
-        eprintf("Out of space in cf character class buffer.\n");
-        eprintf("Capacity is %zu, which ought to be enough.\n", sz);
-        exit(ENOBUFS);
+    for (i = 0; i < id_pend_len; ++i) {
+        const id_pending_t *pend = id_pendv + i;
+        idset_ent_t *ent = idset_ent(&file_idset, pend->entnr);
+
+        ent->idnr[pend->ctx] = idnrv[i];
+        note_identifier(idset_str(&file_idset, ent), idnrv[i], pend->lnr,
+            fname, pend->first);
     }
+    id_pend_len = 0;
+}
 
-    for (pos = len; pos != 0; --pos) {
-        ccv->array[pos] = ccv->array[pos - 1];
+/*
+ * Queue a lookup of entry |entnr| of file_idset, in context |ctx|.
+ * Debug and trace output are reported in the order that identifiers
+ * appear, so then each lookup is done right away.
+ */
+static void
+id_queue(size_t entnr, int ctx, size_t lnr, bool first, const char *fname)
+{
+    id_pending_t *pend = id_pendv + id_pend_len++;
+
+    pend->entnr = (uint32_t)entnr;
+    pend->lnr   = (uint32_t)lnr;
+    pend->ctx   = (uint8_t)ctx;
+    pend->first = first;
+    if (id_pend_len == ID_BATCH || debug || id_ntraced != 0) {
+        id_flush(fname);
     }
-    ++ccv->len;
-    ccv->array[0].chr = c;
-    ccv->array[0].ccl = CC_CODE;
 }
 
+/*
+ * Scan the |len| bytes of |buf|, the contents of |fname|.
+ */
 static int
-incbot_src_stream(FILE *f, const char *fname)
+incbot_src_buf(const char *buf, size_t len, const char *fname)
 {
     ccv_t *ccv = ccv_new();
-    cf_t *cf = cf_new(CC_CODE);
+    src_in_t in;
+    int err;
     size_t lnr;
     size_t col;
     char idbuf[1024];
+    char *idend = idbuf + sizeof (idbuf) - 1;
     int c;
     bool in_preprocessor;
 
+    if (!file_idset_ready) {
+        idset_init(&file_idset);
+        file_idset_ready = true;
+    }
+    idset_reset(&file_idset);
+    if (id_recognizer_ready) {
+        memset(id_recognized_seen, 0, id_nrecognized);
+    }
+
+    err = src_in_init(&in, buf, len);
+    if (err != 0) {
+        ccv_delete(ccv);
+        return (err);
+    }
+
     lnr = 0;
     col = 0;
     in_preprocessor = false;
-    while ((c = cf_getc(f, cf, ccv)) != EOF) {
+    while ((c = cf_getc(&in, ccv)) != EOF) {
         if (c == '\n') {
             ++lnr;
             col = 0;
@@ -751,23 +1403,39 @@ incbot_src_stream(FILE *f, const char *fname)
         }
 
         if (is_identifier_start(c)) {
-            size_t idnr;
             char *dstp;
-            int find_type = TYPE_ALL & ~TYPE_FUNCTION;
-
+            int ctx = IDSET_OTHER;
+            dict_hash_state_t hs;
+            uint64_t h;
+            size_t entnr;
+            idset_ent_t *seen;
+            bool first;
+            int hotnr;
+
+            // Hash the identifier as it is copied,
+            // so that it does not have to be read again to hash it.
+            // A name too long for idbuf is cut short, as in the fused
+            // scanner, but all of it is hashed, so two long names
+            // that differ only past the cut are still told apart.
+            //
+            dict_hash_start(&hs);
             dstp = idbuf;
             *dstp++ = c;
-            while ((c = cf_getc(f, cf, ccv)) != EOF && is_identifier(c)) {
-                *dstp++ = c;
+            dict_hash_byte(&hs, c);
+            while ((c = cf_getc(&in, ccv)) != EOF && is_identifier(c)) {
+                if (dstp < idend) {
+                    *dstp++ = c;
+                }
+                dict_hash_byte(&hs, c);
                 ++col;
             }
             *dstp = '\0';
             while (c != EOF && isspace(c)) {
-                c = cf_getc(f, cf, ccv);
+                c = cf_getc(&in, ccv);
                 ++col;
             }
             if (c == '(') {
-                find_type = TYPE_FUNCTION | TYPE_KEYWORD;
+                ctx = IDSET_CALL;
             }
             else if (is_identifier_start(c)) {
                 cf_ungetc(c, ccv);
@@ -780,7 +1448,7 @@ incbot_src_stream(FILE *f, const char *fname)
             // preprocessor directives.
             //
             if (in_preprocessor && strcmp(idbuf, "include") == 0) {
-                while ((c = cf_getc(f, cf, ccv)) != EOF && c != '\n') {
+                while ((c = cf_getc(&in, ccv)) != EOF && c != '\n') {
                     ///
                 }
 
@@ -797,44 +1465,288 @@ incbot_src_stream(FILE *f, const char *fname)
                 }
             }
 
-            idnr = id_find(idbuf, find_type);
-            if (idnr != undef_idnr) {
-                idinfo_t *id_ent;
-                size_t ref_symnr;
-                size_t inc_symnr;
-                char *ref_sym;
-                char *inc_sym;
-
-                id_ent = id_table + idnr;
-                ref_symnr = id_ent->sym;
-                ref_sym = dict_getname_nr(id_symtable, ref_symnr);
-                inc_symnr = id_ent->src1;
-                if (inc_symnr != undef_symnr) {
-                    inc_sym = dict_getname_nr(strtable, inc_symnr);
-                    if (inc_sym && *inc_sym && id_ent->type != TYPE_KEYWORD) {
-                        add_ref_inc_pair(inc_symnr, ref_symnr, idnr, lnr);
-                    }
+            // Keywords and the most common identifiers are recognized
+            // without any lookup.  Tracing wants to see every lookup.
+            //
+            hotnr = -1;
+            if (id_recognizer_ready && id_ntraced == 0) {
+                hotnr = id_recognizer(idbuf, dstp - idbuf);
+            }
+            if (hotnr >= 0) {
+                first = (id_recognized_seen[hotnr] & (1 << ctx)) == 0;
+                id_recognized_seen[hotnr] |= 1 << ctx;
+                if (first || debug) {
+                    note_identifier(idbuf, id_recognized_idnrv[hotnr][ctx],
+                        lnr, fname, first);
                 }
+            }
+            else {
+                // Resolve each distinct identifier, in each context,
+                // only once per file.  Later occurrences add nothing
+                // that show_includes() would not discard as a duplicate.
+                //
+                h = dict_hash_end(&hs);
+                entnr = idset_upsert(&file_idset, idbuf, dstp - idbuf, h);
+                seen = idset_ent(&file_idset, entnr);
+                first = (seen->resolved & (1 << ctx)) == 0;
+                if (first || id_ntraced != 0) {
+                    seen->resolved |= 1 << ctx;
+                    id_queue(entnr, ctx, lnr, first, fname);
+                }
+                else if (debug) {
+                    note_identifier(idbuf, seen->idnr[ctx], lnr, fname,
+                        false);
+                }
+            }
+            if (c == '\n') {
+                ++lnr;
+            }
+            if (c == EOF) {
+                break;
+            }
+        }
+    }
 
-                dbg_printf("File: %s\n", fname);
-                dbg_printf("lnr=%zu, id=%zu=[%s], type=%s",
-                    lnr, ref_symnr, ref_sym, decode_id_type(id_ent->type));
+    id_flush(fname);
+    ccv_delete(ccv);
+    return (0);
+}
 
-                if (id_ent->type == TYPE_TYPEDEF && id_ent->declare) {
-                    size_t decl_symnr;
-                    char *decl_sym;
+// ========== Section: fused scanner ==========
 
-                    decl_symnr = id_ent->declare;
-                    decl_sym = dict_getname_nr(id_symtable, decl_symnr);
-                    dbg_printf(", %s", decl_sym);
+/*
+ * The fused scanner does the work of libcf, cf_getc(), the ctype tests,
+ * and the id_symtable lookup, in one pass over a file that has been
+ * read in whole.
+ *
+ * libcf's state machine is compiled into a table, fused_cf[][],
+ * with one entry per state per byte, that gives the next state,
+ * and whether the byte is code.  Identifiers are followed, byte by byte,
+ * in a double-array trie of all the names in id_symtable (see datrie.h),
+ * so an identifier is resolved as soon as it ends, and one that is
+ * not in the table falls off the trie, usually within a byte or two,
+ * and is never hashed.
+ *
+ * What it reports is exactly what incbot_src_buf() reports,
+ * including the line counting.
+ */
+
+#define FUSED_STATE      0x0F
+#define FUSED_EMIT       0x10   // The byte is code
+#define FUSED_EMIT_SLASH 0x20   // ... and so is the '/' before it
+
+static uint8_t fused_cf[S_EOF][256];
+static bool fused_cf_ready;
+
+static int incbot_lexer = LEXER_STANDARD;
+
+/*
+ * Fill in fused_cf[][] from libcf's own transition table,
+ * cf_trans[][], so that it does just what cf_next() does.
+ * That includes two things that matter to the scanner: a '/' that
+ * does not start a comment makes the next byte code, even if it
+ * is a quote; and the newline that ends a // comment is not code.
+ */
+static void
+init_fused_cf(void)
+{
+    int state;
+    int chr;
+
+    for (state = S_START; state < S_EOF; ++state) {
+        for (chr = 0; chr < 256; ++chr) {
+            const cf_trans_t *t = &cf_trans[state][cf_byte_class[chr]];
+            int flags = 0;
+
+            if (t->nemit != 0 && t->ccl == CC_CODE) {
+                flags = FUSED_EMIT;
+                if (t->nemit == 2) {
+                    flags |= FUSED_EMIT_SLASH;
                 }
-                dbg_printf("\n");
             }
-#ifdef CSCRIPT_DEBUG
-            else {
-                dbg_printf("lnr=%zu, id=[%s] => NULL\n", lnr, idbuf);
+            fused_cf[state][chr] = (uint8_t)(t->next | flags);
+        }
+    }
+    fused_cf_ready = true;
+}
+
+/*
+ * Build the trie of everything in id_symtable.
+ * The value of each name is its symbol number.
+ */
+static void
+build_id_trie(void)
+{
+    const char **keyv;
+    uint32_t *valv;
+    size_t n;
+    size_t i;
+
+    n = id_symtable->len - 1;
+    keyv = (const char **) guard_malloc((n ? n : 1) * sizeof (char *));
+    valv = (uint32_t *) guard_malloc((n ? n : 1) * sizeof (uint32_t));
+    for (i = 0; i < n; ++i) {
+        keyv[i] = dict_getname_nr(id_symtable, i + 1);
+        valv[i] = (uint32_t)(i + 1);
+    }
+    datrie_delete(id_trie);
+    id_trie = datrie_build(keyv, valv, n);
+    free(keyv);
+    free(valv);
+
+    free(id_trie_seen);
+    id_trie_seen = (uint8_t *) guard_calloc(id_table_len ? id_table_len : 1, 1);
+}
+
+/*
+ * Pull one byte of code out of the buffer, as cf_getc() would.
+ * At most two bytes are ever pending: the byte after a '/'
+ * that turned out to be code, and a byte that was pushed back.
+ */
+struct fused_in {
+    const unsigned char *p;
+    const unsigned char *end;
+    int state;
+    int npend;
+    int pend[2];
+};
+
+typedef struct fused_in fused_in_t;
+
+static inline int
+fused_getc(fused_in_t *in)
+{
+    if (in->npend != 0) {
+        return (in->pend[--in->npend]);
+    }
+    while (in->p < in->end) {
+        int chr = *in->p++;
+        int act = fused_cf[in->state][chr];
+
+        in->state = act & FUSED_STATE;
+        if (act & FUSED_EMIT) {
+            if (act & FUSED_EMIT_SLASH) {
+                in->pend[in->npend++] = chr;
+                return ('/');
+            }
+            return (chr);
+        }
+    }
+    return (EOF);
+}
+
+static inline void
+fused_ungetc(fused_in_t *in, int chr)
+{
+    in->pend[in->npend++] = chr;
+}
+
+/*
+ * Scan the |len| bytes of |buf|, the contents of |fname|.
+ * This follows incbot_src_buf(), step for step.
+ */
+static int
+incbot_src_buf_fused(const char *buf, size_t len, const char *fname)
+{
+    static const int type_maskv[2] = {
+        [IDSET_OTHER] = TYPE_ALL & ~TYPE_FUNCTION,
+        [IDSET_CALL]  = TYPE_FUNCTION | TYPE_KEYWORD,
+    };
+    fused_in_t in;
+    size_t lnr;
+    size_t col;
+    char idbuf[1024];
+    char *idend = idbuf + sizeof (idbuf) - 1;
+    int c;
+    bool in_preprocessor;
+
+    memset(id_trie_seen, 0, id_table_len);
+
+    in.p = (const unsigned char *)buf;
+    in.end = in.p + len;
+    in.state = S_START;
+    in.npend = 0;
+
+    lnr = 0;
+    col = 0;
+    in_preprocessor = false;
+    while ((c = fused_getc(&in)) != EOF) {
+        if (c == '\n') {
+            ++lnr;
+            col = 0;
+            in_preprocessor = false;
+        }
+        else {
+            ++col;
+        }
+
+        if (col == 1 && c == '#') {
+            in_preprocessor = true;
+        }
+
+        // Codes above 10 are letters and '_'; see datrie_code[].
+        if (datrie_code[c] > 10) {
+            char *dstp;
+            int32_t node;
+            symnr_t symnr;
+            index_t idnr;
+            int ctx = IDSET_OTHER;
+            bool first;
+
+            // The name is only needed for the include check,
+            // and for debug output.
+            //
+            node = datrie_step(id_trie, DATRIE_ROOT, c);
+            dstp = idbuf;
+            *dstp++ = c;
+            while ((c = fused_getc(&in)) != EOF && datrie_code[c] != 0) {
+                if (node != DATRIE_DEAD) {
+                    node = datrie_step(id_trie, node, c);
+                }
+                if (dstp < idend) {
+                    *dstp++ = c;
+                }
+                ++col;
+            }
+            *dstp = '\0';
+            while (c != EOF && isspace(c)) {
+                c = fused_getc(&in);
+                ++col;
+            }
+            if (c == '(') {
+                ctx = IDSET_CALL;
+            }
+            else if (datrie_code[(unsigned char)c] > 10) {
+                fused_ungetc(&in, c);
+            }
+
+            if (in_preprocessor && strcmp(idbuf, "include") == 0) {
+                while ((c = fused_getc(&in)) != EOF && c != '\n') {
+                    ///
+                }
+
+                if (c == '\n') {
+                    ++lnr;
+                    col = 0;
+                    in_preprocessor = false;
+                }
+                else {
+                    break;
+                }
+            }
+
+            symnr = datrie_value(id_trie, node);
+            idnr = undef_idnr;
+            first = false;
+            if (symnr != undef_symnr
+                && (id_hot[symnr - 1].type & type_maskv[ctx]) != 0) {
+                idnr = symnr - 1;
+                first = (id_trie_seen[idnr] & (1 << ctx)) == 0;
+                id_trie_seen[idnr] |= 1 << ctx;
+            }
+            if (first || debug) {
+                note_identifier(idbuf, idnr, lnr, fname, first);
             }
-#endif
             if (c == '\n') {
                 ++lnr;
             }
@@ -847,10 +1759,88 @@ incbot_src_stream(FILE *f, const char *fname)
     return (0);
 }
 
+/*
+ * Choose the scanner: LEXER_STANDARD, or LEXER_FUSED.
+ * Tracing always uses the standard scanner, since it reports
+ * on every lookup, and the fused scanner does not do any.
+ */
+void
+set_incbot_lexer(int lexer)
+{
+    incbot_lexer = lexer;
+}
+
+// ========== Section: source input ==========
+
+/*
+ * Read all of |f| into a buffer that is kept from one file to the next.
+ * Reads are as large as the room left in the buffer, which starts
+ * at 64 KiB and doubles, so a pipe is drained in big blocks.
+ */
+static int
+slurp_stream(FILE *f, const char *fname, char **rbuf, size_t *rlen)
+{
+    static char *buf;
+    static size_t sz;
+    size_t len;
+    size_t n;
+
+    if (buf == NULL) {
+        sz = 64 * 1024;
+        buf = (char *) guard_malloc(sz);
+    }
+    len = 0;
+    while ((n = fread(buf + len, 1, sz - len, f)) != 0) {
+        len += n;
+        if (len == sz) {
+            sz *= 2;
+            buf = (char *) guard_realloc(buf, sz);
+        }
+    }
+    if (ferror(f)) {
+        eprintf("read('%s') failed.\n", fname);
+        return (EIO);
+    }
+    *rbuf = buf;
+    *rlen = len;
+    return (0);
+}
+
+/*
+ * Get the whole of |f| into memory.  A regular file is mapped;
+ * anything else, such as a pipe on stdin, or a file that cannot
+ * be mapped, is read in.  Set |*rmapped| if the buffer must be
+ * unmapped when it is no longer needed.
+ */
+static int
+src_load(FILE *f, const char *fname, char **rbuf, size_t *rlen,
+    bool *rmapped)
+{
+    struct stat st;
+    void *map;
+
+    *rmapped = false;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                   fileno(f), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            *rbuf = (char *)map;
+            *rlen = (size_t)st.st_size;
+            *rmapped = true;
+            return (0);
+        }
+    }
+    return (slurp_stream(f, fname, rbuf, rlen));
+}
+
 int
 incbot_src_file(const char *fname)
 {
     FILE *f;
+    char *buf;
+    size_t len;
+    bool mapped;
     int err;
 
     if (fname[0] == '-' && !fname[1]) {
@@ -865,7 +1855,25 @@ incbot_src_file(const char *fname)
         }
     }
 
-    err = incbot_src_stream(f, fname);
+    err = src_load(f, fname, &buf, &len, &mapped);
+    if (err == 0) {
+        echo_src(buf, len);
+        if (incbot_lexer == LEXER_FUSED && id_ntraced == 0) {
+            if (!fused_cf_ready) {
+                init_fused_cf();
+            }
+            if (id_trie == NULL) {
+                build_id_trie();
+            }
+            err = incbot_src_buf_fused(buf, len, fname);
+        }
+        else {
+            err = incbot_src_buf(buf, len, fname);
+        }
+        if (mapped) {
+            munmap(buf, len);
+        }
+    }
 
     fclose(f);
     return (err);
@@ -932,7 +1940,7 @@ show_includes(void)
 
         if (ref_symnr != prev_ref_symnr) {
             char *ref_sym = dict_getname_nr(id_symtable, ref_symnr);
-            int id_types = id_table[id_ent].type;
+            int id_types = id_hot[id_ent].type;
             io_guard(write_str("    // Import "));
             // printf("    // Import ");
             if (id_types & TYPE_FUNCTION) {
@@ -968,6 +1976,17 @@ trace_identifier(const char *sym)
     if (idnr == undef_idnr) {
         return (ENOENT);
     }
-    id_table[idnr].trace = true;
+    if (idnr >= id_traced_sz) {
+        size_t sz = id_table_len;
+
+        id_traced = (bool *) guard_realloc(id_traced, sz * sizeof (bool));
+        memset(id_traced + id_traced_sz, 0,
+               (sz - id_traced_sz) * sizeof (bool));
+        id_traced_sz = sz;
+    }
+    if (!id_traced[idnr]) {
+        id_traced[idnr] = true;
+        ++id_ntraced;
+    }
     return (0);
 }
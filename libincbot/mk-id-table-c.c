@@ -0,0 +1,266 @@
+/*
+ * Filename: src/libincbot/mk-id-table-c.c
+ * Project: incbot
+ * Library: libincbot
+ * Brief: Build-time tool -- compile an id-table into C source code
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * usage: mk-id-table-c <id-table> <output.c>
+ *
+ * Load a text id-table, using the same code as incbot itself,
+ * and write C source code that defines the compiled image of it
+ * (see id-image.c) as static const data, along with the function
+ * read_id_table_builtin(), which uses that data in place.
+ *
+ * Also write a recognizer for the keywords of the table, and a few
+ * of the most common library identifiers, as a switch on length
+ * and first character.  read_id_table_builtin() installs it,
+ * with set_id_recognizer().
+ *
+ * This is not part of libincbot.  It is linked with the other
+ * objects of libincbot, so that the generated image always matches
+ * the layout of the tables in the library it is linked into.
+ *
+ */
+
+#include <errno.h>      // errno
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint64_t
+#include <stdio.h>      // FILE, fopen, fprintf, fclose
+#include <stdlib.h>     // exit, free, qsort
+#include <string.h>     // memcpy, strcmp, strlen
+#include <cscript.h>    // eprintf, guard_malloc, set_eprint_fh, sname
+#include <dict.h>       // dict_find, dict_getname_nr, undef_symnr
+#include <incbot.h>
+#include <incbot-impl.h>
+
+const char *program_path;
+const char *program_name;
+
+bool verbose = false;
+bool debug   = false;
+
+FILE *errprint_fh = NULL;
+FILE *dbgprint_fh = NULL;
+
+static const char *gen_brief
+    = "Compiled image of the built-in id-table, as static const data";
+
+/*
+ * Identifiers that are not keywords, but that are common enough
+ * in C source to be worth recognizing without a table lookup.
+ * Any that are not in the id-table are left out.
+ */
+static const char *hot_extra[] = {
+    "NULL", "size_t", "bool", "true", "false", "FILE",
+    "uint8_t", "uint16_t", "uint32_t", "uint64_t", "int32_t", "int64_t",
+    "errno", "stderr", "stdout", "printf", "fprintf",
+    "malloc", "free", "memcpy", "memset", "strlen", "strcmp", "exit",
+};
+
+#define NHOT_EXTRA (sizeof (hot_extra) / sizeof (hot_extra[0]))
+
+// Order by length, then first character, then the rest, so that
+// each case of the generated switch is a contiguous run.
+//
+static int
+hotcmp(const void *v1, const void *v2)
+{
+    const char *s1 = *(const char *const *)v1;
+    const char *s2 = *(const char *const *)v2;
+    size_t len1 = strlen(s1);
+    size_t len2 = strlen(s2);
+
+    if (len1 != len2) {
+        return (len1 < len2 ? -1 : 1);
+    }
+    return (strcmp(s1, s2));
+}
+
+/*
+ * Collect the names to recognize: every keyword in the table,
+ * and those of hot_extra[] that are in the table.
+ */
+static const char **
+collect_hot_names(size_t *rn)
+{
+    const char **namev;
+    size_t n;
+    size_t pos;
+    size_t i;
+
+    namev = (const char **)
+        guard_malloc((id_table_len + NHOT_EXTRA) * sizeof (char *));
+    n = 0;
+    for (pos = 0; pos < id_table_len; ++pos) {
+        if (id_hot[pos].type == TYPE_KEYWORD) {
+            namev[n++] = dict_getname_nr(id_symtable, id_cold[pos].sym);
+        }
+    }
+    for (i = 0; i < NHOT_EXTRA; ++i) {
+        if (dict_find(id_symtable, hot_extra[i]) != undef_symnr) {
+            namev[n++] = hot_extra[i];
+        }
+    }
+    qsort(namev, n, sizeof (char *), hotcmp);
+    *rn = n;
+    return (namev);
+}
+
+static void
+emit_recognizer(FILE *f, const char **namev, size_t n)
+{
+    size_t i;
+
+    fprintf(f, "static const char *const builtin_hot_names[%zu] = {\n", n);
+    for (i = 0; i < n; ++i) {
+        fprintf(f, "    \"%s\",\n", namev[i]);
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "static int\n");
+    fprintf(f, "builtin_recognize(const char *s, size_t len)\n");
+    fprintf(f, "{\n");
+    fprintf(f, "    switch (len) {\n");
+    for (i = 0; i < n; ++i) {
+        size_t len = strlen(namev[i]);
+
+        if (i == 0 || strlen(namev[i - 1]) != len) {
+            fprintf(f, "    case %zu:\n", len);
+            fprintf(f, "        switch (s[0]) {\n");
+        }
+        if (i == 0 || strlen(namev[i - 1]) != len
+            || namev[i - 1][0] != namev[i][0]) {
+            fprintf(f, "        case '%c':\n", namev[i][0]);
+        }
+        fprintf(f, "            if (memcmp(s + 1, \"%s\", %zu) == 0) {\n",
+            namev[i] + 1, len - 1);
+        fprintf(f, "                return (%zu);\n", i);
+        fprintf(f, "            }\n");
+        if (i + 1 == n || strlen(namev[i + 1]) != len
+            || namev[i + 1][0] != namev[i][0]) {
+            fprintf(f, "            break;\n");
+        }
+        if (i + 1 == n || strlen(namev[i + 1]) != len) {
+            fprintf(f, "        }\n");
+            fprintf(f, "        break;\n");
+        }
+    }
+    fprintf(f, "    }\n");
+    fprintf(f, "    return (-1);\n");
+    fprintf(f, "}\n\n");
+}
+
+static void
+emit_c_source(FILE *f, const char *tbl_fname, const char *img, size_t sz,
+    const char **hotv, size_t nhot)
+{
+    size_t nwords = sz / sizeof (uint64_t);
+    size_t wnr;
+
+    fprintf(f, "/*\n");
+    fprintf(f, " * Generated by %s from %s\n", program_name, tbl_fname);
+    fprintf(f, " * Brief: %s\n", gen_brief);
+    fprintf(f, " *\n");
+    fprintf(f, " * DO NOT EDIT.  Edit the id-table, and rebuild.\n");
+    fprintf(f, " */\n\n");
+    fprintf(f, "#include <stdbool.h>\n");
+    fprintf(f, "#include <stddef.h>\n");
+    fprintf(f, "#include <stdint.h>\n");
+    fprintf(f, "#include <string.h>\n");
+    fprintf(f, "#include <incbot.h>\n");
+    fprintf(f, "#include <incbot-impl.h>\n\n");
+
+    fprintf(f, "static const uint64_t builtin_image[%zu]\n", nwords);
+    fprintf(f, "    __attribute__((aligned(64))) = {\n");
+    for (wnr = 0; wnr < nwords; ++wnr) {
+        uint64_t w;
+
+        memcpy(&w, img + wnr * sizeof (w), sizeof (w));
+        if (wnr % 4 == 0) {
+            fputs("   ", f);
+        }
+        fprintf(f, " 0x%016llxULL,", (unsigned long long)w);
+        if (wnr % 4 == 3 || wnr + 1 == nwords) {
+            fputc('\n', f);
+        }
+    }
+    fprintf(f, "};\n\n");
+
+    emit_recognizer(f, hotv, nhot);
+
+    fprintf(f, "int\n");
+    fprintf(f, "read_id_table_builtin(void)\n");
+    fprintf(f, "{\n");
+    fprintf(f, "    bool in_place;\n\n");
+    fprintf(f, "    set_id_recognizer(builtin_recognize, builtin_hot_names, %zu);\n",
+        nhot);
+    fprintf(f, "    return (load_id_table_image((const char *)builtin_image,\n");
+    fprintf(f, "        sizeof (builtin_image), \"<built-in id-table>\", true,\n");
+    fprintf(f, "        &in_place));\n");
+    fprintf(f, "}\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    char *img;
+    size_t sz;
+    const char **hotv;
+    size_t nhot;
+    FILE *f;
+    int rv;
+
+    set_eprint_fh();
+    program_path = *argv;
+    program_name = sname(program_path);
+
+    if (argc != 3) {
+        eprintf("usage: %s <id-table> <output.c>\n", program_name);
+        exit(1);
+    }
+
+    rv = read_id_table_file(argv[1]);
+    if (rv != 0) {
+        exit(rv);
+    }
+
+    hotv = collect_hot_names(&nhot);
+    img = build_id_table_image(&sz);
+
+    f = fopen(argv[2], "w");
+    if (f == NULL) {
+        rv = errno;
+        eprintf("open('%s', w) failed.\n", argv[2]);
+        exit(rv);
+    }
+    emit_c_source(f, argv[1], img, sz, hotv, nhot);
+    if (fclose(f) != 0) {
+        rv = errno;
+        eprintf("write('%s') failed.\n", argv[2]);
+        remove(argv[2]);
+        exit(rv);
+    }
+
+    free(img);
+    free(hotv);
+    exit(0);
+}